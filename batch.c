@@ -0,0 +1,499 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Batch mode reads a directory or wildcard pattern of dump files made with
+// --dumpmem, and outputs the history of all of them as one stream ordered
+// by time. The dump files are read by a pool of threads. Dumps taken some
+// time apart overlap, so the raw history items of all of them are merged
+// and the items found in several dumps are dropped, before the rest are
+// formatted once as a single history, or exported with --export-columnar.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#endif
+
+#include "wsp.h"
+#include "utils.h"
+#include "writer.h"
+#include "weather.h"
+#include "transport.h"
+#include "thread.h"
+#include "parallel.h"
+#include "merge.h"
+#include "export.h"
+#include "batch.h"
+
+//
+// The history the rain in the first items of a window is found from, see
+// print_batch_history().
+//
+#define BATCH_LOOKBACK_SECONDS (7 * 24 * 60 * 60)
+
+typedef struct batch_file_s
+{
+	char *path;
+	batch_record_t *records;
+	unsigned int count;
+	weather_settings_t ws;
+	time_t read_time;
+	int failed;
+} batch_file_t;
+
+typedef struct batch_s
+{
+	batch_file_t *files;
+	unsigned int count;
+	unsigned int capacity;
+	unsigned int next;			// The next file to be read by a thread.
+	wsp_mutex_t mutex;
+} batch_t;
+
+static int add_file(batch_t *b, const char *path)
+{
+	if (b->count == b->capacity)
+	{
+		unsigned int capacity = max(b->capacity * 2, 64);
+		batch_file_t *files;
+
+		if (!(files = (batch_file_t *)realloc(b->files, capacity * sizeof(batch_file_t))))
+		{
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+
+		b->files = files;
+		b->capacity = capacity;
+	}
+
+	memset(&b->files[b->count], 0, sizeof(batch_file_t));
+
+	if (!(b->files[b->count].path = strdup(path)))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	b->count++;
+
+	return 0;
+}
+
+#ifdef WIN32
+
+//
+// Finds all files in a directory, or all files matching a wildcard pattern.
+//
+static int find_files(batch_t *b, const char *path)
+{
+	WIN32_FIND_DATAA fd;
+	HANDLE h;
+	char pattern[2048];
+	char dir[2048];
+	char file[4096];
+	DWORD attr = GetFileAttributesA(path);
+	char *sep;
+	int ret = 0;
+
+	if ((attr != INVALID_FILE_ATTRIBUTES) && (attr & FILE_ATTRIBUTE_DIRECTORY))
+	{
+		snprintf(dir, sizeof(dir), "%s", path);
+		snprintf(pattern, sizeof(pattern), "%s\\*", path);
+	}
+	else
+	{
+		snprintf(dir, sizeof(dir), "%s", path);
+		snprintf(pattern, sizeof(pattern), "%s", path);
+
+		sep = max(strrchr(dir, '\\'), strrchr(dir, '/'));
+		*(sep ? sep : dir) = '\0';
+	}
+
+	if ((h = FindFirstFileA(pattern, &fd)) == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+
+	do
+	{
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+
+		snprintf(file, sizeof(file), "%s%s%s", dir, *dir ? "\\" : "", fd.cFileName);
+
+		if ((ret = add_file(b, file)))
+			break;
+	} while (FindNextFileA(h, &fd));
+
+	FindClose(h);
+
+	return ret;
+}
+
+#else
+
+//
+// Finds all files in a directory, or all files matching a wildcard pattern.
+//
+static int find_files(batch_t *b, const char *path)
+{
+	struct stat st;
+	int ret = 0;
+
+	if (!stat(path, &st) && S_ISDIR(st.st_mode))
+	{
+		DIR *dir;
+		struct dirent *entry;
+		char file[4096];
+
+		if (!(dir = opendir(path)))
+		{
+			fprintf(stderr, "Failed to open directory \"%s\". ", path);
+			perror(NULL);
+			return -1;
+		}
+
+		while ((entry = readdir(dir)))
+		{
+			if (entry->d_name[0] == '.')
+				continue;
+
+			snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+
+			if (stat(file, &st) || !S_ISREG(st.st_mode))
+				continue;
+
+			if ((ret = add_file(b, file)))
+				break;
+		}
+
+		closedir(dir);
+	}
+	else
+	{
+		glob_t g;
+		size_t i;
+
+		if (glob(path, 0, NULL, &g))
+		{
+			return 0;
+		}
+
+		for (i = 0; (i < g.gl_pathc) && !ret; i++)
+		{
+			ret = add_file(b, g.gl_pathv[i]);
+		}
+
+		globfree(&g);
+	}
+
+	return ret;
+}
+
+#endif // WIN32
+
+static int compare_files(const void *a, const void *b)
+{
+	return strcmp(((const batch_file_t *)a)->path, ((const batch_file_t *)b)->path);
+}
+
+//
+// Reads the settings and the history items of a dump file.
+//
+static int read_batch_file(batch_t *b, unsigned int index)
+{
+	batch_file_t *bf = &b->files[index];
+	wsp_device_t *dev = NULL;
+	weather_history_t history;
+	int first;
+	int ret = -1;
+	unsigned int i;
+
+	memset(&history, 0, sizeof(history));
+
+	if (!(dev = open_transport(bf->path, NULL)))
+	{
+		goto fail;
+	}
+
+	if ((first = read_weather_data(dev, NULL, &bf->ws, &history)) < 0)
+	{
+		goto fail;
+	}
+
+	if (!(bf->records = (batch_record_t *)malloc(max(HISTORY_MAX - first, 1) * sizeof(batch_record_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		goto fail;
+	}
+
+	bf->read_time = history.read_time;
+
+	// The item at the current position is still being written to, it is
+	// output from a later dump once it's finished.
+	for (i = first; i < (HISTORY_MAX - 1); i++)
+	{
+		batch_record_t *r = &bf->records[bf->count];
+
+		r->item = *get_history_item(&history, i);
+		r->file = index;
+		r->position = bf->count++;
+	}
+
+	ret = 0;
+
+fail:
+	if (dev) close_transport(dev);
+	free_history(&history);
+
+	if (ret)
+	{
+		fprintf(stderr, "Failed to read the dump file \"%s\".\n", bf->path);
+		bf->count = 0;
+	}
+
+	return ret;
+}
+
+static void batch_worker(void *arg)
+{
+	batch_t *b = (batch_t *)arg;
+	unsigned int index;
+
+	while (1)
+	{
+		mutex_lock(&b->mutex);
+		index = b->next++;
+		mutex_unlock(&b->mutex);
+
+		if (index >= b->count)
+			break;
+
+		b->files[index].failed = read_batch_file(b, index);
+	}
+}
+
+//
+// Reads the dump files in parallel.
+//
+static void read_batch_files(batch_t *b)
+{
+	unsigned int thread_count = max(min(program_settings.threads, b->count), 1);
+	wsp_thread_t *threads;
+	unsigned int started = 0;
+	unsigned int i;
+
+	mutex_init(&b->mutex);
+
+	if ((threads = (wsp_thread_t *)malloc(thread_count * sizeof(wsp_thread_t))))
+	{
+		for (started = 0; started < thread_count; started++)
+		{
+			if (thread_create(&threads[started], batch_worker, b))
+			{
+				fprintf(stderr, "Failed to start a thread\n");
+				break;
+			}
+		}
+	}
+
+	// Whatever is left if no threads could be started.
+	batch_worker(b);
+
+	for (i = 0; i < started; i++)
+	{
+		thread_join(threads[i]);
+	}
+
+	free(threads);
+	mutex_destroy(&b->mutex);
+}
+
+//
+// Outputs the merged items as one history. A history only holds HISTORY_MAX
+// items, so longer ones are output a window at a time. Each window starts
+// with up to BATCH_LOOKBACK_SECONDS of the items already output, so the
+// rain over the last hour, day and week is found for its first items as
+// well. Like for a station, the 30 day and year rain of a window are the
+// rain since its first item, see advance_rain_windows().
+//
+static void print_batch_history(wsp_device_t *dev, weather_settings_t *ws, time_t read_time, weather_item_t *items, unsigned int count)
+{
+	history_output_t output = easyweather_output;
+	weather_history_t history;
+	unsigned int start = 0;
+	unsigned int begin;
+	unsigned int length;
+	writer_t w;
+
+	if (program_settings.json)
+	{
+		output = json_output;
+	}
+	else if (program_settings.show_formatted)
+	{
+		output = formatted_output;
+	}
+
+	writer_init(&w, stdout);
+
+	while (start < count)
+	{
+		for (begin = start;
+			(begin > 0) && ((start - begin) < (HISTORY_MAX / 2))
+			&& ((items[start].timestamp - items[begin].timestamp) < BATCH_LOOKBACK_SECONDS);
+			begin--);
+
+		length = min(count - begin, HISTORY_MAX);
+
+		memset(&history, 0, sizeof(history));
+		history.items = &items[begin];
+		history.first = HISTORY_MAX - length;
+		history.read_time = read_time;
+
+		print_history_parallel(&w, output, dev, ws, &history,
+							   history.first + (start - begin), HISTORY_MAX,
+							   (output == formatted_output) ? &program_settings.format : NULL);
+
+		// The items belong to the merged array.
+		history.items = NULL;
+		free_history(&history);
+
+		start = begin + length;
+	}
+
+	writer_free(&w);
+}
+
+//
+// Reads all dump files in a directory, or matching a wildcard pattern, and
+// outputs their history ordered by time with the duplicates removed.
+//
+int read_batch(const char *path)
+{
+	batch_t b;
+	batch_record_t *records = NULL;
+	weather_item_t *items = NULL;
+	wsp_device_t dev;
+	unsigned int newest = 0;
+	unsigned int total = 0;
+	unsigned int count = 0;
+	unsigned int failed = 0;
+	unsigned int i;
+	int ret = -1;
+
+	memset(&b, 0, sizeof(b));
+
+	if (find_files(&b, path))
+	{
+		goto cleanup;
+	}
+
+	if (b.count == 0)
+	{
+		fprintf(stderr, "No dump files found in \"%s\".\n", path);
+		goto cleanup;
+	}
+
+	qsort(b.files, b.count, sizeof(batch_file_t), compare_files);
+
+	debug_printf(1, "Reading %u dump files with %u threads\n", b.count, max(min(program_settings.threads, b.count), 1));
+
+	read_batch_files(&b);
+
+	for (i = 0; i < b.count; i++)
+	{
+		total += b.files[i].count;
+		failed += b.files[i].failed ? 1 : 0;
+
+		if (!b.files[i].failed
+		&& (b.files[newest].failed || (b.files[i].read_time >= b.files[newest].read_time)))
+		{
+			newest = i;
+		}
+	}
+
+	if (!(records = (batch_record_t *)malloc(max(total, 1) * sizeof(batch_record_t)))
+	|| !(items = (weather_item_t *)malloc(max(total, 1) * sizeof(weather_item_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		goto cleanup;
+	}
+
+	for (i = 0, total = 0; i < b.count; i++)
+	{
+		memcpy(&records[total], b.files[i].records, b.files[i].count * sizeof(batch_record_t));
+		total += b.files[i].count;
+		free(b.files[i].records);
+		b.files[i].records = NULL;
+	}
+
+	count = merge_records(records, total);
+
+	for (i = 0; i < count; i++)
+	{
+		items[i] = records[i].item;
+	}
+
+	debug_printf(1, "Read %u history items from %u dump files, %u of them duplicates\n", total, b.count, total - count);
+
+	// The merged history is tagged with the batch path, and has the settings
+	// of the newest dump. All of it is history, as far as the rain goes.
+	memset(&dev, 0, sizeof(dev));
+	snprintf(dev.label, sizeof(dev.label), "%s", path);
+	b.files[newest].ws.data_count = HISTORY_MAX;
+
+	if (program_settings.show_easyweather || program_settings.show_formatted || program_settings.json)
+	{
+		print_batch_history(&dev, &b.files[newest].ws, b.files[newest].read_time, items, count);
+	}
+
+	// Archives can hold far more items than a station, they are decoded in
+	// bulk, see decode_columns().
+	if (program_settings.export_columnar
+		&& export_items(program_settings.exportfile, items, count))
+	{
+		goto cleanup;
+	}
+
+	ret = failed ? -1 : 0;
+
+cleanup:
+	for (i = 0; i < b.count; i++)
+	{
+		free(b.files[i].path);
+		free(b.files[i].records);
+	}
+
+	free(b.files);
+	free(records);
+	free(items);
+
+	return ret;
+}
@@ -0,0 +1,661 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// A broker owning a weather station, for when several programs read it.
+// Only one of them can claim the USB device at a time, so with --broker
+// this one keeps it and serves the reads of the others over a Unix domain
+// socket. They connect with --connect, which reads through the broker
+// transport below instead of the device.
+//
+// The reads asked for by all clients while the station is busy are done
+// together: each address is read from the station once, fresh, and sent to
+// every client that asked for it. So clients reading the settings block or
+// the latest history items at the same time share a single read.
+//
+// Only reads are served, settings can't be changed through the broker.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include "wsp.h"
+#include "utils.h"
+#include "memory.h"
+#include "memcache.h"
+#include "unixsock.h"
+#include "broker.h"
+
+// A client going away shouldn't raise SIGPIPE.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+extern volatile sig_atomic_t stop_polling;
+
+static void put_u16(unsigned char *p, unsigned int v)
+{
+	p[0] = (unsigned char)(v & 0xff);
+	p[1] = (unsigned char)((v >> 8) & 0xff);
+}
+
+static void put_u32(unsigned char *p, unsigned long v)
+{
+	put_u16(p, (unsigned int)(v & 0xffff));
+	put_u16(p + 2, (unsigned int)((v >> 16) & 0xffff));
+}
+
+static unsigned int get_u16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+	return get_u16(p) | ((unsigned long)get_u16(p + 2) << 16);
+}
+
+static void put_header(unsigned char *p, unsigned int op, unsigned int status, unsigned long count)
+{
+	p[0] = BROKER_MAGIC;
+	p[1] = BROKER_VERSION;
+	p[2] = (unsigned char)op;
+	p[3] = (unsigned char)status;
+	put_u32(p + 4, count);
+}
+
+static int send_all(int fd, const unsigned char *data, size_t len)
+{
+	ssize_t sent;
+
+	while (len > 0)
+	{
+		if ((sent = send(fd, data, len, MSG_NOSIGNAL)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		data += sent;
+		len -= (size_t)sent;
+	}
+
+	return 0;
+}
+
+static int recv_all(int fd, unsigned char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+		if ((n = recv(fd, data, len, 0)) <= 0)
+		{
+			if ((n < 0) && (errno == EINTR))
+				continue;
+
+			return -1;
+		}
+
+		data += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+// ------------------------------------------------------------------------
+// The broker.
+// ------------------------------------------------------------------------
+
+typedef struct broker_client_s
+{
+	int fd;
+	unsigned char *buf;			// What has been received of the current request.
+	size_t len;
+	size_t size;
+	int waiting;				// A read request is waiting for the station.
+	unsigned int op;
+	unsigned long count;
+} broker_client_t;
+
+//
+// The addresses read for all the waiting clients, each one once.
+//
+typedef struct broker_round_s
+{
+	unsigned short *addrs;
+	unsigned int count;
+	char (*data)[32];
+	int *status;
+	unsigned short slots[MEMORY_SIZE];		// Where each address is in addrs, valid if marked.
+	unsigned int marks[MEMORY_SIZE];		// The round each address was last added in.
+	unsigned int round;
+} broker_round_t;
+
+static broker_client_t clients[BROKER_MAX_CLIENTS];
+static unsigned int client_count = 0;
+
+static void drop_client(unsigned int i)
+{
+	debug_printf(1, "Broker client %d disconnected\n", clients[i].fd);
+
+	close(clients[i].fd);
+	free(clients[i].buf);
+	clients[i] = clients[--client_count];
+}
+
+static void store_result(unsigned short addr, const char buf[32], int status, void *arg)
+{
+	broker_round_t *r = (broker_round_t *)arg;
+	unsigned int slot = r->slots[addr];
+
+	memcpy(r->data[slot], buf, 32);
+	r->status[slot] = status;
+}
+
+//
+// Reads the addresses all waiting clients asked for, and answers them.
+//
+static void serve_reads(wsp_device_t *dev, broker_round_t *r)
+{
+	unsigned char header[BROKER_HEADER_SIZE];
+	unsigned char *response;
+	unsigned int requests = 0;
+	unsigned int total = 0;
+	unsigned int i;
+	unsigned long j;
+
+	r->round++;
+	r->count = 0;
+
+	for (i = 0; i < client_count; i++)
+	{
+		broker_client_t *c = &clients[i];
+
+		if (!c->waiting)
+			continue;
+
+		requests++;
+
+		for (j = 0; j < c->count; j++)
+		{
+			unsigned int addr = get_u16(c->buf + BROKER_HEADER_SIZE + j * 2);
+
+			total++;
+
+			if (r->marks[addr] == r->round)
+				continue;
+
+			r->marks[addr] = r->round;
+			r->slots[addr] = (unsigned short)r->count;
+			r->addrs[r->count++] = (unsigned short)addr;
+
+			// Always read the station, the clients want it as it is now.
+			memcache_invalidate(dev->cache, addr, 32);
+		}
+	}
+
+	debug_printf(1, "Broker reading %u addresses for %u requests of %u addresses\n", r->count, requests, total);
+
+	read_weather_addresses(dev, r->addrs, r->count, store_result, r);
+
+	for (i = 0; i < client_count; i++)
+	{
+		broker_client_t *c = &clients[i];
+
+		if (!c->waiting)
+			continue;
+
+		if (!(response = (unsigned char *)malloc(max(c->count, 1) * BROKER_RECORD_SIZE)))
+		{
+			fprintf(stderr, "Out of memory\n");
+			drop_client(i--);
+			continue;
+		}
+
+		for (j = 0; j < c->count; j++)
+		{
+			unsigned char *rec = response + j * BROKER_RECORD_SIZE;
+			unsigned int addr = get_u16(c->buf + BROKER_HEADER_SIZE + j * 2);
+			unsigned int slot = r->slots[addr];
+
+			put_u16(rec, addr);
+			rec[2] = r->status[slot] ? 1 : 0;
+			rec[3] = 0;
+			memcpy(rec + 4, r->data[slot], 32);
+		}
+
+		put_header(header, BROKER_OP_READ, 0, c->count);
+
+		if (send_all(c->fd, header, sizeof(header))
+			|| send_all(c->fd, response, c->count * BROKER_RECORD_SIZE))
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				fprintf(stderr, "Broker client %d isn't reading its answers, dropping it\n", c->fd);
+			}
+
+			free(response);
+			drop_client(i--);
+			continue;
+		}
+
+		free(response);
+		c->waiting = 0;
+		c->len = 0;
+	}
+}
+
+//
+// Receives what a client has sent. When a whole request is in, info
+// requests are answered at once and read requests are marked as waiting.
+// Returns -1 if the client should be dropped.
+//
+static int receive_request(wsp_device_t *dev, broker_client_t *c)
+{
+	unsigned char header[BROKER_HEADER_SIZE];
+	size_t need = BROKER_HEADER_SIZE;
+	ssize_t n;
+
+	if (c->len >= BROKER_HEADER_SIZE)
+	{
+		need += c->count * 2;
+	}
+
+	if ((n = recv(c->fd, c->buf + c->len, need - c->len, 0)) <= 0)
+	{
+		return ((n < 0) && (errno == EINTR)) ? 0 : -1;
+	}
+
+	c->len += (size_t)n;
+
+	if (c->len == BROKER_HEADER_SIZE)
+	{
+		c->op = c->buf[2];
+		c->count = get_u32(c->buf + 4);
+
+		if ((c->buf[0] != BROKER_MAGIC) || (c->buf[1] != BROKER_VERSION)
+			|| ((c->op != BROKER_OP_INFO) && (c->op != BROKER_OP_READ))
+			|| (c->count > BROKER_MAX_ADDRESSES))
+		{
+			fprintf(stderr, "Broker client %d sent an invalid request\n", c->fd);
+			return -1;
+		}
+
+		if (c->op == BROKER_OP_INFO)
+		{
+			size_t len = strlen(dev->path);
+
+			c->len = 0;
+			put_header(header, BROKER_OP_INFO, 0, len);
+
+			return (send_all(c->fd, header, sizeof(header))
+				|| send_all(c->fd, (const unsigned char *)dev->path, len)) ? -1 : 0;
+		}
+	}
+
+	if ((c->len >= BROKER_HEADER_SIZE) && (c->len == (BROKER_HEADER_SIZE + c->count * 2)))
+	{
+		c->waiting = 1;
+	}
+
+	return 0;
+}
+
+//
+// Serves the station to the clients connecting to the socket at path,
+// until asked to stop.
+//
+int run_broker(wsp_device_t *dev, const char *path)
+{
+	struct timeval tv;
+	broker_round_t *r;
+	fd_set fds;
+	int server;
+	int max_fd;
+	int waiting;
+	int fd;
+	unsigned int i;
+
+	if (!(r = (broker_round_t *)calloc(1, sizeof(broker_round_t)))
+		|| !(r->addrs = (unsigned short *)malloc(MEMORY_SIZE * sizeof(unsigned short)))
+		|| !(r->data = (char (*)[32])malloc(MEMORY_SIZE * 32))
+		|| !(r->status = (int *)malloc(MEMORY_SIZE * sizeof(int))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		goto fail_alloc;
+	}
+
+	if ((server = listen_socket(path, "broker")) < 0)
+	{
+		goto fail_alloc;
+	}
+
+	debug_printf(1, "Broker serving \"%s\" on \"%s\"\n", dev->path, path);
+
+	while (!stop_polling)
+	{
+		FD_ZERO(&fds);
+		FD_SET(server, &fds);
+		max_fd = server;
+		waiting = 0;
+
+		for (i = 0; i < client_count; i++)
+		{
+			if (clients[i].waiting)
+			{
+				waiting = 1;
+				continue;
+			}
+
+			FD_SET(clients[i].fd, &fds);
+			max_fd = max(max_fd, clients[i].fd);
+		}
+
+		// Requests already in are only held back to pick up any others
+		// that came in at the same time.
+		tv.tv_sec = waiting ? 0 : 1;
+		tv.tv_usec = 0;
+
+		if (select(max_fd + 1, &fds, NULL, NULL, &tv) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			perror("Broker select failed. ");
+			break;
+		}
+
+		if (FD_ISSET(server, &fds) && ((fd = accept(server, NULL, NULL)) >= 0))
+		{
+			if (client_count >= BROKER_MAX_CLIENTS)
+			{
+				fprintf(stderr, "Too many broker clients, at most %d can connect.\n", BROKER_MAX_CLIENTS);
+				close(fd);
+			}
+			else
+			{
+				broker_client_t *c = &clients[client_count];
+				struct timeval timeout;
+
+				memset(c, 0, sizeof(*c));
+				c->fd = fd;
+				c->size = BROKER_HEADER_SIZE + BROKER_MAX_ADDRESSES * 2;
+
+				// The answers are sent to one client after the other, so a
+				// client that stops reading is dropped rather than holding
+				// up the rest.
+				timeout.tv_sec = BROKER_SEND_TIMEOUT;
+				timeout.tv_usec = 0;
+
+				if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)))
+				{
+					perror("Failed to set the broker client send timeout. ");
+					close(fd);
+				}
+				else if (!(c->buf = (unsigned char *)malloc(c->size)))
+				{
+					fprintf(stderr, "Out of memory\n");
+					close(fd);
+				}
+				else
+				{
+					debug_printf(1, "Broker client %d connected\n", fd);
+					client_count++;
+				}
+			}
+		}
+
+		for (i = 0; i < client_count; i++)
+		{
+			if (!clients[i].waiting && FD_ISSET(clients[i].fd, &fds)
+				&& receive_request(dev, &clients[i]))
+			{
+				drop_client(i--);
+			}
+		}
+
+		for (i = 0; i < client_count; i++)
+		{
+			if (clients[i].waiting)
+			{
+				serve_reads(dev, r);
+				break;
+			}
+		}
+	}
+
+	while (client_count > 0)
+	{
+		drop_client(0);
+	}
+
+	close(server);
+	unlink(path);
+	free(r->addrs);
+	free(r->data);
+	free(r->status);
+	free(r);
+
+	return 0;
+
+fail_alloc:
+	if (r)
+	{
+		free(r->addrs);
+		free(r->data);
+		free(r->status);
+		free(r);
+	}
+
+	return -1;
+}
+
+// ------------------------------------------------------------------------
+// The transport reading through a broker, see --connect.
+// ------------------------------------------------------------------------
+
+static int broker_transport_open(wsp_device_t *dev)
+{
+	struct sockaddr_un addr;
+	unsigned char header[BROKER_HEADER_SIZE];
+	unsigned long len;
+	char station[STATION_PATH_LEN];
+	int fd;
+
+	if (get_socket_address(program_settings.brokerpath, &addr))
+	{
+		return -1;
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		perror("Failed to create a socket. ");
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+	{
+		fprintf(stderr, "Failed to connect to the broker at \"%s\". ", program_settings.brokerpath);
+		perror(NULL);
+		close(fd);
+		return -1;
+	}
+
+	// The station is named after the one the broker has open.
+	put_header(header, BROKER_OP_INFO, 0, 0);
+
+	if (send_all(fd, header, sizeof(header))
+		|| recv_all(fd, header, sizeof(header))
+		|| (header[0] != BROKER_MAGIC) || (header[2] != BROKER_OP_INFO)
+		|| ((len = get_u32(header + 4)) >= sizeof(station))
+		|| recv_all(fd, (unsigned char *)station, len))
+	{
+		fprintf(stderr, "The broker at \"%s\" didn't answer.\n", program_settings.brokerpath);
+		close(fd);
+		return -1;
+	}
+
+	station[len] = 0;
+	snprintf(dev->path, sizeof(dev->path), "%s", station);
+	debug_printf(1, "Connected to the broker for \"%s\"\n", dev->path);
+
+	dev->data = (void *)(long)fd;
+
+	return 0;
+}
+
+static void broker_transport_close(wsp_device_t *dev)
+{
+	close((int)(long)dev->data);
+}
+
+//
+// Asks the broker for the given addresses, in requests of at most
+// BROKER_MAX_ADDRESSES. Returns the number of addresses that failed.
+//
+static int broker_transport_read_addresses(wsp_device_t *dev, const unsigned short *addrs, unsigned int count, read_address_cb cb, void *arg)
+{
+	int fd = (int)(long)dev->data;
+	unsigned char header[BROKER_HEADER_SIZE];
+	unsigned char *request;
+	unsigned char rec[BROKER_RECORD_SIZE];
+	unsigned int done = 0;
+	unsigned int n;
+	unsigned int i;
+	int failed = 0;
+
+	if (!(request = (unsigned char *)malloc(BROKER_MAX_ADDRESSES * 2)))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return count;
+	}
+
+	while (done < count)
+	{
+		n = min(count - done, BROKER_MAX_ADDRESSES);
+
+		for (i = 0; i < n; i++)
+		{
+			put_u16(request + i * 2, addrs[done + i]);
+		}
+
+		put_header(header, BROKER_OP_READ, 0, n);
+
+		if (send_all(fd, header, sizeof(header))
+			|| send_all(fd, request, n * 2)
+			|| recv_all(fd, header, sizeof(header))
+			|| (header[0] != BROKER_MAGIC) || (get_u32(header + 4) != n))
+		{
+			fprintf(stderr, "Lost the connection to the broker.\n");
+			break;
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			if (recv_all(fd, rec, sizeof(rec)))
+			{
+				fprintf(stderr, "Lost the connection to the broker.\n");
+				free(request);
+				return failed + (count - done - i);
+			}
+
+			if (rec[2])
+			{
+				failed++;
+			}
+
+			cb((unsigned short)get_u16(rec), (const char *)(rec + 4), rec[2] ? -1 : 0, arg);
+		}
+
+		done += n;
+	}
+
+	free(request);
+
+	return failed + (count - done);
+}
+
+typedef struct broker_read_s
+{
+	char *buf;
+	int status;
+} broker_read_t;
+
+static void copy_read(unsigned short addr, const char buf[32], int status, void *arg)
+{
+	broker_read_t *r = (broker_read_t *)arg;
+
+	memcpy(r->buf, buf, 32);
+	r->status = status;
+}
+
+static int broker_transport_read32(wsp_device_t *dev, unsigned short addr, char buf[32])
+{
+	broker_read_t r;
+
+	r.buf = buf;
+	r.status = -1;
+
+	if (broker_transport_read_addresses(dev, &addr, 1, copy_read, &r))
+		return -1;
+
+	return r.status;
+}
+
+static int broker_transport_write1(wsp_device_t *dev, unsigned short addr, char data)
+{
+	fprintf(stderr, "The weather station can't be written to through the broker.\n");
+	return -1;
+}
+
+static int broker_transport_write32(wsp_device_t *dev, unsigned short addr, char data[32])
+{
+	fprintf(stderr, "The weather station can't be written to through the broker.\n");
+	return -1;
+}
+
+static int broker_transport_ack(wsp_device_t *dev)
+{
+	return -1;
+}
+
+const wsp_transport_t broker_transport =
+{
+	"broker",
+	broker_transport_open,
+	broker_transport_close,
+	broker_transport_read32,
+	broker_transport_write1,
+	broker_transport_write32,
+	broker_transport_ack,
+	broker_transport_read_addresses,
+	NULL,
+	NULL
+};
@@ -0,0 +1,48 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __BROKER_H__
+#define __BROKER_H__
+
+//
+// The protocol spoken over the broker socket, see broker.c. All numbers
+// are little endian. A message is a header followed by its body:
+//
+//   magic (1), version (1), op (1), status (1), count (4)
+//
+// An info request has no body, the response body is the path of the
+// station, count bytes long. A read request has count addresses of 2
+// bytes, the response has count records of the address (2), the status
+// of the read (1), a padding byte and the 32 bytes read.
+//
+#define BROKER_MAGIC			0xb7
+#define BROKER_VERSION			1
+#define BROKER_HEADER_SIZE		8
+#define BROKER_RECORD_SIZE		36
+#define BROKER_MAX_ADDRESSES	4096
+#define BROKER_MAX_CLIENTS		64
+#define BROKER_SEND_TIMEOUT		2		// Seconds a client can hold up an answer before it's dropped.
+
+#define BROKER_OP_INFO			1
+#define BROKER_OP_READ			2
+
+int run_broker(wsp_device_t *dev, const char *path);
+
+#endif // __BROKER_H__
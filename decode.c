@@ -0,0 +1,187 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Bulk decoding of history items into column arrays, for when a large
+// number of them are processed at once. With SSE2 sixteen items are
+// decoded at a time by transposing their bytes, otherwise each item is
+// decoded in turn.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wsp.h"
+#include "decode.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define WSP_SSE2
+#include <emmintrin.h>
+#endif
+
+//
+// Allocates the columns for the given number of items, all in one block.
+//
+int alloc_columns(weather_columns_t *cols, unsigned int count)
+{
+	unsigned char *p;
+
+	memset(cols, 0, sizeof(weather_columns_t));
+
+	// 6 short columns and 5 byte columns.
+	if (!(p = (unsigned char *)malloc(max(count, 1) * (6 * sizeof(short) + 5))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	cols->count				= count;
+	cols->in_temp			= (short *)p;			p += count * sizeof(short);
+	cols->out_temp			= (short *)p;			p += count * sizeof(short);
+	cols->abs_pressure		= (unsigned short *)p;	p += count * sizeof(short);
+	cols->avg_wind			= (unsigned short *)p;	p += count * sizeof(short);
+	cols->gust_wind			= (unsigned short *)p;	p += count * sizeof(short);
+	cols->total_rain		= (unsigned short *)p;	p += count * sizeof(short);
+	cols->delay				= p;					p += count;
+	cols->in_humidity		= p;					p += count;
+	cols->out_humidity		= p;					p += count;
+	cols->wind_direction	= p;					p += count;
+	cols->status			= p;
+
+	return 0;
+}
+
+void free_columns(weather_columns_t *cols)
+{
+	// The first column is the start of the block.
+	free(cols->in_temp);
+	memset(cols, 0, sizeof(weather_columns_t));
+}
+
+//
+// Decodes one item, the same way as the accessors in weather.c.
+//
+static void decode_record(const unsigned char *b, weather_columns_t *cols, unsigned int i)
+{
+	cols->delay[i]			= b[0];
+	cols->in_humidity[i]	= b[1];
+	cols->in_temp[i]		= FIX_SIGN(b[2] | (b[3] << 8));
+	cols->out_humidity[i]	= b[4];
+	cols->out_temp[i]		= FIX_SIGN(b[5] | (b[6] << 8));
+	cols->abs_pressure[i]	= b[7] | (b[8] << 8);
+	cols->avg_wind[i]		= ((b[11] & 0xf) << 8) | b[9];
+	cols->gust_wind[i]		= ((b[11] >> 4) << 8) | b[10];
+	cols->wind_direction[i]	= b[12];
+	cols->total_rain[i]		= b[13] | (b[14] << 8);
+	cols->status[i]			= b[15];
+}
+
+#ifdef WSP_SSE2
+
+//
+// Converts sign-magnitude shorts to two's complement.
+//
+static __m128i fix_sign_epi16(__m128i v)
+{
+	__m128i sign = _mm_srai_epi16(v, 15);
+	__m128i magnitude = _mm_and_si128(v, _mm_set1_epi16(0x7fff));
+	return _mm_sub_epi16(_mm_xor_si128(magnitude, sign), sign);
+}
+
+//
+// Stores 16 shorts made from a column of low bytes and one of high bytes.
+//
+static void store_epi16(void *dst, __m128i low, __m128i high)
+{
+	_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(low, high));
+	_mm_storeu_si128((__m128i *)dst + 1, _mm_unpackhi_epi8(low, high));
+}
+
+static void store_signed_epi16(void *dst, __m128i low, __m128i high)
+{
+	_mm_storeu_si128((__m128i *)dst, fix_sign_epi16(_mm_unpacklo_epi8(low, high)));
+	_mm_storeu_si128((__m128i *)dst + 1, fix_sign_epi16(_mm_unpackhi_epi8(low, high)));
+}
+
+//
+// Decodes 16 items. Their bytes are transposed so that register n holds
+// byte n of all the items, which is then stored in its column.
+//
+static void decode_records_sse2(const unsigned char *records, size_t stride, weather_columns_t *cols, unsigned int i)
+{
+	__m128i x[16];
+	__m128i t[16];
+	__m128i low_nibbles = _mm_set1_epi8(0x0f);
+	int round;
+	int k;
+
+	for (k = 0; k < 16; k++)
+	{
+		x[k] = _mm_loadu_si128((const __m128i *)(records + k * stride));
+	}
+
+	for (round = 0; round < 4; round++)
+	{
+		for (k = 0; k < 8; k++)
+		{
+			t[2 * k]		= _mm_unpacklo_epi8(x[k], x[k + 8]);
+			t[2 * k + 1]	= _mm_unpackhi_epi8(x[k], x[k + 8]);
+		}
+
+		memcpy(x, t, sizeof(x));
+	}
+
+	_mm_storeu_si128((__m128i *)&cols->delay[i], x[0]);
+	_mm_storeu_si128((__m128i *)&cols->in_humidity[i], x[1]);
+	store_signed_epi16(&cols->in_temp[i], x[2], x[3]);
+	_mm_storeu_si128((__m128i *)&cols->out_humidity[i], x[4]);
+	store_signed_epi16(&cols->out_temp[i], x[5], x[6]);
+	store_epi16(&cols->abs_pressure[i], x[7], x[8]);
+	store_epi16(&cols->avg_wind[i], x[9], _mm_and_si128(x[11], low_nibbles));
+	store_epi16(&cols->gust_wind[i], x[10], _mm_and_si128(_mm_srli_epi16(x[11], 4), low_nibbles));
+	_mm_storeu_si128((__m128i *)&cols->wind_direction[i], x[12]);
+	store_epi16(&cols->total_rain[i], x[13], x[14]);
+	_mm_storeu_si128((__m128i *)&cols->status[i], x[15]);
+}
+
+#endif // WSP_SSE2
+
+//
+// Decodes a number of history items into the columns, starting at the
+// given offset in them. The items are stride bytes apart, which is
+// HISTORY_CHUNK_SIZE for the history in a memory dump and
+// sizeof(weather_item_t) for a history that has been read.
+//
+void decode_columns(const unsigned char *records, size_t stride, unsigned int count, weather_columns_t *cols, unsigned int offset)
+{
+	unsigned int i = 0;
+
+	#ifdef WSP_SSE2
+	for (; (i + 16) <= count; i += 16)
+	{
+		decode_records_sse2(records + i * stride, stride, cols, offset + i);
+	}
+	#endif // WSP_SSE2
+
+	for (; i < count; i++)
+	{
+		decode_record(records + i * stride, cols, offset + i);
+	}
+}
@@ -0,0 +1,50 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __DECODE_H__
+#define __DECODE_H__
+
+#include <stddef.h>
+
+//
+// The readings of a number of history items, decoded into one array per
+// field. The values are the ones the item_*() accessors in weather.h
+// return, and are scaled the same way.
+//
+typedef struct weather_columns_s
+{
+	unsigned int count;
+	unsigned char *delay;
+	unsigned char *in_humidity;
+	short *in_temp;
+	unsigned char *out_humidity;
+	short *out_temp;
+	unsigned short *abs_pressure;
+	unsigned short *avg_wind;		// Multiply by 0.1 to get m/s.
+	unsigned short *gust_wind;		// Multiply by 0.1 to get m/s.
+	unsigned char *wind_direction;
+	unsigned short *total_rain;
+	unsigned char *status;
+} weather_columns_t;
+
+int alloc_columns(weather_columns_t *cols, unsigned int count);
+void free_columns(weather_columns_t *cols);
+void decode_columns(const unsigned char *records, size_t stride, unsigned int count, weather_columns_t *cols, unsigned int offset);
+
+#endif // __DECODE_H__
@@ -0,0 +1,223 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Checks that decode_columns() gives exactly the same values as the item
+// accessors in weather.c. The items are decoded in bulk, which uses SSE2
+// for each full group of 16 where available, and one at a time, which
+// always uses the plain C decoding.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wsp.h"
+#include "weather.h"
+#include "decode.h"
+
+program_settings_t program_settings;
+
+//
+// The quick rain calculations in weather.c read from the station, which
+// isn't needed by the accessors tested here.
+//
+void get_history_chunk(wsp_device_t *dev, weather_settings_t *ws, unsigned short history_pos, unsigned char raw_data[HISTORY_CHUNK_SIZE])
+{
+	memset(raw_data, 0, HISTORY_CHUNK_SIZE);
+}
+
+// Enough for a number of SSE2 groups and a tail decoded one at a time.
+#define TEST_ITEMS (16 * 64 + 7)
+
+static unsigned long seed = 12345;
+
+static unsigned char random_byte()
+{
+	seed = seed * 1103515245 + 12345;
+	return (unsigned char)((seed >> 16) & 0xff);
+}
+
+//
+// The sign-magnitude temperatures and 4 bit wind nibbles at their limits.
+//
+static const unsigned short edge_temps[] = { 0x0000, 0x0001, 0x7fff, 0x8000, 0x8001, 0xffff, 0x7ffe, 0x80ff };
+static const unsigned char edge_winds[] = { 0x00, 0x0f, 0xf0, 0xff, 0x7f, 0xf7 };
+
+static void make_items(weather_item_t *items, unsigned int count)
+{
+	unsigned int edge_count = (sizeof(edge_temps) / sizeof(edge_temps[0])) * (sizeof(edge_winds) / sizeof(edge_winds[0]));
+	unsigned char *b;
+	unsigned int i;
+	unsigned int k;
+
+	memset(items, 0, count * sizeof(weather_item_t));
+
+	for (i = 0; i < count; i++)
+	{
+		b = items[i].raw_data;
+
+		for (k = 0; k < HISTORY_CHUNK_SIZE; k++)
+		{
+			b[k] = random_byte();
+		}
+
+		// Every combination of the edge cases, spread over the groups of 16
+		// and the tail, with the other bytes at 0x00 or 0xff.
+		if ((i % 3) == 0)
+		{
+			unsigned int e = (i / 3) % edge_count;
+			unsigned short temp = edge_temps[e % (sizeof(edge_temps) / sizeof(edge_temps[0]))];
+			unsigned char wind = edge_winds[e / (sizeof(edge_temps) / sizeof(edge_temps[0]))];
+
+			memset(b, (i & 1) ? 0xff : 0x00, HISTORY_CHUNK_SIZE);
+			b[2] = temp & 0xff;
+			b[3] = temp >> 8;
+			b[5] = (temp ^ 0x8000) & 0xff;
+			b[6] = (temp ^ 0x8000) >> 8;
+			b[9] = wind;
+			b[10] = wind ^ 0xff;
+			b[11] = wind;
+		}
+	}
+}
+
+static int check(const char *what, unsigned int i, long got, long expected)
+{
+	if (got != expected)
+	{
+		fprintf(stderr, "Item %u: %s is %ld, expected %ld\n", i, what, got, expected);
+		return 1;
+	}
+
+	return 0;
+}
+
+//
+// Compares the decoded columns to the accessors.
+//
+static int check_columns(const char *how, weather_item_t *items, weather_columns_t *cols, unsigned int count)
+{
+	weather_item_t *item;
+	unsigned int i;
+	int errors = 0;
+
+	for (i = 0; (i < count) && (errors < 10); i++)
+	{
+		item = &items[i];
+
+		errors += check("delay", i, cols->delay[i], item_delay(item));
+		errors += check("in_humidity", i, cols->in_humidity[i], item_in_humidity(item));
+		errors += check("in_temp", i, cols->in_temp[i], item_in_temp(item));
+		errors += check("out_humidity", i, cols->out_humidity[i], item_out_humidity(item));
+		errors += check("out_temp", i, cols->out_temp[i], item_out_temp(item));
+		errors += check("abs_pressure", i, cols->abs_pressure[i], item_abs_pressure(item));
+		errors += check("wind_direction", i, cols->wind_direction[i], item_wind_direction(item));
+		errors += check("total_rain", i, cols->total_rain[i], item_total_rain(item));
+		errors += check("status", i, cols->status[i], item_status(item));
+
+		// The accessors only give the wind speeds scaled.
+		if ((cols->avg_wind[i] * 0.1f) != convert_avg_windspeed(item))
+		{
+			fprintf(stderr, "Item %u: avg_wind is %u\n", i, cols->avg_wind[i]);
+			errors++;
+		}
+
+		if ((cols->gust_wind[i] * 0.1f) != convert_gust_windspeed(item))
+		{
+			fprintf(stderr, "Item %u: gust_wind is %u\n", i, cols->gust_wind[i]);
+			errors++;
+		}
+	}
+
+	printf("%s: %s\n", how, errors ? "FAILED" : "ok");
+
+	return errors;
+}
+
+//
+// Compares two sets of columns byte for byte.
+//
+static int compare_columns(const char *how, weather_columns_t *a, weather_columns_t *b, unsigned int count)
+{
+	int same = !memcmp(a->in_temp, b->in_temp, count * sizeof(short))
+			&& !memcmp(a->out_temp, b->out_temp, count * sizeof(short))
+			&& !memcmp(a->abs_pressure, b->abs_pressure, count * sizeof(short))
+			&& !memcmp(a->avg_wind, b->avg_wind, count * sizeof(short))
+			&& !memcmp(a->gust_wind, b->gust_wind, count * sizeof(short))
+			&& !memcmp(a->total_rain, b->total_rain, count * sizeof(short))
+			&& !memcmp(a->delay, b->delay, count)
+			&& !memcmp(a->in_humidity, b->in_humidity, count)
+			&& !memcmp(a->out_humidity, b->out_humidity, count)
+			&& !memcmp(a->wind_direction, b->wind_direction, count)
+			&& !memcmp(a->status, b->status, count);
+
+	printf("%s: %s\n", how, same ? "ok" : "FAILED");
+
+	return !same;
+}
+
+int main(int argc, char **argv)
+{
+	weather_columns_t bulk;
+	weather_columns_t single;
+	weather_columns_t packed;
+	weather_item_t *items;
+	unsigned char *records;
+	unsigned int i;
+	int errors = 0;
+
+	if (!(items = (weather_item_t *)malloc(TEST_ITEMS * sizeof(weather_item_t)))
+		|| !(records = (unsigned char *)malloc(TEST_ITEMS * HISTORY_CHUNK_SIZE))
+		|| alloc_columns(&bulk, TEST_ITEMS)
+		|| alloc_columns(&single, TEST_ITEMS)
+		|| alloc_columns(&packed, TEST_ITEMS))
+	{
+		return 1;
+	}
+
+	make_items(items, TEST_ITEMS);
+
+	// The same items back to back, the way they are in a memory dump.
+	for (i = 0; i < TEST_ITEMS; i++)
+	{
+		memcpy(records + i * HISTORY_CHUNK_SIZE, items[i].raw_data, HISTORY_CHUNK_SIZE);
+	}
+
+	decode_columns(items[0].raw_data, sizeof(weather_item_t), TEST_ITEMS, &bulk, 0);
+	decode_columns(records, HISTORY_CHUNK_SIZE, TEST_ITEMS, &packed, 0);
+
+	for (i = 0; i < TEST_ITEMS; i++)
+	{
+		decode_columns(items[i].raw_data, sizeof(weather_item_t), 1, &single, i);
+	}
+
+	errors += check_columns("one at a time vs accessors", items, &single, TEST_ITEMS);
+	errors += check_columns("bulk vs accessors", items, &bulk, TEST_ITEMS);
+	errors += compare_columns("bulk vs one at a time", &bulk, &single, TEST_ITEMS);
+	errors += compare_columns("dump layout vs one at a time", &packed, &single, TEST_ITEMS);
+
+	free_columns(&bulk);
+	free_columns(&single);
+	free_columns(&packed);
+	free(records);
+	free(items);
+
+	return errors ? 1 : 0;
+}
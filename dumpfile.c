@@ -0,0 +1,247 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Transport reading from a memory dump made with --dumpmem, instead of
+// the weather station. The dump is mapped into memory and can not be
+// written to.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "wsp.h"
+#include "utils.h"
+#include "memory.h"
+
+//
+// The whole dump is mapped into memory, and reads are served straight
+// out of the mapping without copying.
+//
+typedef struct file_map_s
+{
+	const char *data;
+	size_t size;
+	char tail[32];		// Zero padded copy of a read running past the end of the mapping.
+	#ifdef WIN32
+	HANDLE file;
+	HANDLE mapping;
+	#else
+	int fd;
+	#endif
+} file_map_t;
+
+//
+// Maps the dump file into memory.
+//
+static int map_file(file_map_t *m, const char *path)
+{
+	#ifdef WIN32
+	LARGE_INTEGER size;
+
+	if ((m->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+							OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "Failed to open file \"%s\".\n", path);
+		return -1;
+	}
+
+	if (!GetFileSizeEx(m->file, &size) || (size.QuadPart == 0))
+	{
+		fprintf(stderr, "The file \"%s\" is empty.\n", path);
+		CloseHandle(m->file);
+		return -1;
+	}
+
+	m->size = (size_t)size.QuadPart;
+
+	if (!(m->mapping = CreateFileMapping(m->file, NULL, PAGE_READONLY, 0, 0, NULL))
+		|| !(m->data = (const char *)MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0)))
+	{
+		fprintf(stderr, "Failed to map file \"%s\" into memory.\n", path);
+		if (m->mapping) CloseHandle(m->mapping);
+		CloseHandle(m->file);
+		return -1;
+	}
+	#else
+	struct stat st;
+	void *data;
+
+	if ((m->fd = open(path, O_RDONLY)) < 0)
+	{
+		fprintf(stderr, "Failed to open file \"%s\". ", path);
+		perror(NULL);
+		return -1;
+	}
+
+	if (fstat(m->fd, &st) || (st.st_size == 0))
+	{
+		fprintf(stderr, "The file \"%s\" is empty.\n", path);
+		close(m->fd);
+		return -1;
+	}
+
+	m->size = (size_t)st.st_size;
+
+	if ((data = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, m->fd, 0)) == MAP_FAILED)
+	{
+		fprintf(stderr, "Failed to map file \"%s\" into memory. ", path);
+		perror(NULL);
+		close(m->fd);
+		return -1;
+	}
+
+	m->data = (const char *)data;
+	#endif
+
+	return 0;
+}
+
+static void unmap_file(file_map_t *m)
+{
+	#ifdef WIN32
+	UnmapViewOfFile(m->data);
+	CloseHandle(m->mapping);
+	CloseHandle(m->file);
+	#else
+	munmap((void *)m->data, m->size);
+	close(m->fd);
+	#endif
+}
+
+static int file_transport_open(wsp_device_t *dev)
+{
+	file_map_t *m;
+
+	// Each station can be given its own dump file.
+	if (!*dev->path
+	&& (snprintf(dev->path, sizeof(dev->path), "%s", program_settings.infile) >= (int)sizeof(dev->path)))
+	{
+		fprintf(stderr, "The path \"%s\" is too long, at most %d characters.\n",
+				program_settings.infile, STATION_PATH_LEN - 1);
+		return -1;
+	}
+
+	debug_printf(1, "Reading input from \"%s\"\n", dev->path);
+
+	if (!(m = (file_map_t *)calloc(1, sizeof(file_map_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	if (map_file(m, dev->path))
+	{
+		free(m);
+		return -1;
+	}
+
+	dev->data = m;
+
+	return 0;
+}
+
+static void file_transport_close(wsp_device_t *dev)
+{
+	unmap_file((file_map_t *)dev->data);
+	free(dev->data);
+}
+
+//
+// Returns a pointer to the 32 bytes at the given address in the mapping.
+//
+static const char *file_transport_map(wsp_device_t *dev, unsigned short addr)
+{
+	file_map_t *m = (file_map_t *)dev->data;
+
+	// Special case if we try to read the next to last history chunk,
+	// only the last 16 bytes of the history are in the dump.
+	size_t bytes_to_read = (addr == (HISTORY_END - HISTORY_CHUNK_SIZE)) ? 16 : 32;
+
+	if ((addr + bytes_to_read) > m->size)
+	{
+		fprintf(stderr, "Tried to read past the end of file.\n");
+		return NULL;
+	}
+
+	if (((size_t)addr + 32) > m->size)
+	{
+		memset(m->tail, 0, sizeof(m->tail));
+		memcpy(m->tail, m->data + addr, bytes_to_read);
+		return m->tail;
+	}
+
+	return m->data + addr;
+}
+
+static int file_transport_read32(wsp_device_t *dev, unsigned short addr, char buf[32])
+{
+	const char *p;
+
+	if (!(p = file_transport_map(dev, addr)))
+	{
+		return -1;
+	}
+
+	memcpy(buf, p, 32);
+
+	return 0;
+}
+
+static int file_transport_write1(wsp_device_t *dev, unsigned short addr, char data)
+{
+	fprintf(stderr, "Cannot write to a dump file.\n");
+	return -1;
+}
+
+static int file_transport_write32(wsp_device_t *dev, unsigned short addr, char data[32])
+{
+	fprintf(stderr, "Cannot write to a dump file.\n");
+	return -1;
+}
+
+static int file_transport_ack(wsp_device_t *dev)
+{
+	return -1;
+}
+
+const wsp_transport_t file_transport =
+{
+	"file",
+	file_transport_open,
+	file_transport_close,
+	file_transport_read32,
+	file_transport_write1,
+	file_transport_write32,
+	file_transport_ack,
+	NULL,
+	NULL,
+	file_transport_map
+};
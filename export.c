@@ -0,0 +1,556 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Exports the history as typed columns in the Arrow IPC file format, also
+// known as Feather version 2, so that it can be loaded by pyarrow, pandas,
+// polars, DuckDB and R without parsing any text. The columns are 64 byte
+// aligned, so the file can be memory mapped and each column used as an
+// array as it is. All numbers are little endian.
+//
+// The file is one record batch:
+//
+//   "ARROW1", padded to 8 bytes.
+//   The Schema message.
+//   The RecordBatch message, followed by its body with the columns.
+//   The end of stream marker, 0xFFFFFFFF and a zero length.
+//   The Footer, its length as an int32, and "ARROW1".
+//
+// Each message is a 0xFFFFFFFF continuation marker, the length of its
+// metadata as an int32, and the metadata, padded to 8 bytes.
+//
+// The metadata are FlatBuffers tables, see Message.fbs, Schema.fbs and
+// File.fbs in the Arrow format. Only the row count and the buffer sizes
+// change between exports, so the tables are written with the fixed layouts
+// below rather than with a FlatBuffers builder. Offsets are relative to the
+// start of a table, and each table is followed by its vtable. The
+// vtable offset is the table position minus the vtable position.
+//
+// The values are decoded with decode_columns(), and the derived values
+// are calculated a column at a time.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wsp.h"
+#include "utils.h"
+#include "weather.h"
+#include "decode.h"
+#include "export.h"
+
+#define EXPORT_MAGIC "ARROW1"
+#define EXPORT_ALIGN 64
+#define EXPORT_CONTINUATION 0xffffffff
+
+// Message.fbs and Schema.fbs.
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_TIMESTAMP 10
+#define ARROW_PRECISION_SINGLE 1
+#define ARROW_TIME_UNIT_SECOND 0
+
+#define EXPORT_COLUMN_COUNT 17
+
+//
+// The sizes of the fixed layouts, see put_schema(), put_message(),
+// put_record_batch() and put_footer().
+//
+#define FIELD_SIZE 96
+#define SCHEMA_SIZE (88 + EXPORT_COLUMN_COUNT * FIELD_SIZE)
+#define MESSAGE_SIZE 40
+#define RECORD_BATCH_SIZE (56 + 48 * EXPORT_COLUMN_COUNT)
+#define FOOTER_SIZE (72 + SCHEMA_SIZE)
+
+typedef enum column_type_e
+{
+	COLUMN_UINT8 = 1,
+	COLUMN_UINT16 = 2,
+	COLUMN_TIMESTAMP = 3,		// int64, seconds since the epoch.
+	COLUMN_FLOAT32 = 4
+} column_type_t;
+
+typedef struct export_column_s
+{
+	const char *name;
+	column_type_t type;
+	unsigned int size;
+	unsigned char *values;		// Encoded, count * size bytes.
+} export_column_t;
+
+static void put_le16(unsigned char *p, unsigned int v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void put_le32(unsigned char *p, unsigned int v)
+{
+	put_le16(p, v & 0xffff);
+	put_le16(p + 2, v >> 16);
+}
+
+static void put_le64(unsigned char *p, unsigned long long v)
+{
+	put_le32(p, (unsigned int)(v & 0xffffffff));
+	put_le32(p + 4, (unsigned int)(v >> 32));
+}
+
+static void put_float(unsigned char *p, float v)
+{
+	unsigned int bits;
+	memcpy(&bits, &v, sizeof(bits));
+	put_le32(p, bits);
+}
+
+//
+// Writes a vtable. The size of the vtable and of its table, then the offset
+// in the table of each field, 0 for the ones left out.
+//
+static void put_vtable(unsigned char *p, unsigned int table_size, const unsigned short *offsets, unsigned int count)
+{
+	unsigned int k;
+
+	put_le16(p, 4 + count * 2);
+	put_le16(p + 2, table_size);
+
+	for (k = 0; k < count; k++)
+	{
+		put_le16(p + 4 + k * 2, offsets[k]);
+	}
+}
+
+//
+// Writes the type of a column, 32 bytes. One of:
+//
+//   Int            0 Table, 4 bitWidth, 8 is_signed, 12 vtable.
+//   FloatingPoint  0 Table, 4 precision, 8 vtable.
+//   Timestamp      0 Table, 4 timezone, 8 unit, 12 vtable, 20 "UTC".
+//
+static unsigned char put_type(unsigned char *p, column_type_t type)
+{
+	static const unsigned short int_fields[] = { 4, 8 };
+	static const unsigned short float_fields[] = { 4 };
+	static const unsigned short timestamp_fields[] = { 8, 4 };
+
+	switch (type)
+	{
+		case COLUMN_UINT8:
+		case COLUMN_UINT16:
+			put_le32(p, (unsigned int)-12);
+			put_le32(p + 4, (type == COLUMN_UINT8) ? 8 : 16);
+			put_vtable(p + 12, 12, int_fields, 2);
+			return ARROW_TYPE_INT;
+		case COLUMN_FLOAT32:
+			put_le32(p, (unsigned int)-8);
+			put_le16(p + 4, ARROW_PRECISION_SINGLE);
+			put_vtable(p + 8, 8, float_fields, 1);
+			return ARROW_TYPE_FLOATING_POINT;
+		case COLUMN_TIMESTAMP:
+		default:
+			put_le32(p, (unsigned int)-12);
+			put_le32(p + 4, 20 - 4);
+			put_le16(p + 8, ARROW_TIME_UNIT_SECOND);
+			put_vtable(p + 12, 12, timestamp_fields, 2);
+			put_le32(p + 20, 3);
+			memcpy(p + 24, "UTC", 3);
+			return ARROW_TYPE_TIMESTAMP;
+	}
+}
+
+//
+// Writes the Field table of a column, FIELD_SIZE bytes. Not nullable, and
+// with no children:
+//
+//   0  Table, 4 name, 8 type, 12 children, 17 type_type.
+//   20 vtable.
+//   36 The children, an empty vector.
+//   40 The type, see put_type().
+//   72 The name, at most 19 characters.
+//
+static void put_field(unsigned char *p, const export_column_t *c)
+{
+	static const unsigned short fields[] = { 4, 0, 17, 8, 0, 12 };
+	size_t length = strlen(c->name);
+
+	put_le32(p, (unsigned int)-20);
+	put_le32(p + 4, 72 - 4);
+	put_le32(p + 8, 40 - 8);
+	put_le32(p + 12, 36 - 12);
+	p[17] = put_type(p + 40, c->type);
+	put_vtable(p + 20, 20, fields, 6);
+	put_le32(p + 72, (unsigned int)length);
+	memcpy(p + 76, c->name, length);
+}
+
+//
+// Writes the Schema table, SCHEMA_SIZE bytes:
+//
+//   0  Table, 4 fields.
+//   8  vtable.
+//   16 The fields, a vector of offsets.
+//   88 The Field tables, see put_field().
+//
+static void put_schema(unsigned char *p, const export_column_t *columns)
+{
+	static const unsigned short fields[] = { 0, 4 };
+	unsigned int k;
+
+	put_le32(p, (unsigned int)-8);
+	put_le32(p + 4, 16 - 4);
+	put_vtable(p + 8, 8, fields, 2);
+	put_le32(p + 16, EXPORT_COLUMN_COUNT);
+
+	for (k = 0; k < EXPORT_COLUMN_COUNT; k++)
+	{
+		put_le32(p + 20 + k * 4, (88 + k * FIELD_SIZE) - (20 + k * 4));
+		put_field(p + 88 + k * FIELD_SIZE, &columns[k]);
+	}
+}
+
+//
+// Writes the Message table, MESSAGE_SIZE bytes. The header follows it.
+//
+//   0  The offset of the root table.
+//   4  vtable.
+//   16 Table, 20 header, 24 bodyLength, 32 version, 34 header_type.
+//
+static void put_message(unsigned char *p, unsigned char header_type, unsigned long long body_length)
+{
+	static const unsigned short fields[] = { 16, 18, 4, 8 };
+
+	put_le32(p, 16);
+	put_vtable(p + 4, 24, fields, 4);
+	put_le32(p + 16, 16 - 4);
+	put_le32(p + 20, MESSAGE_SIZE - 20);
+	put_le64(p + 24, body_length);
+	put_le16(p + 32, ARROW_METADATA_V5);
+	p[34] = header_type;
+}
+
+//
+// Writes the RecordBatch table, RECORD_BATCH_SIZE bytes, and returns the
+// length of the body. Each column is a buffer for the validity bitmap,
+// empty since there are no nulls, and one with the values.
+//
+//   0  Table, 4 nodes, 8 length, 16 buffers.
+//   24 vtable.
+//   44 The nodes, a vector of a length and null count for each column.
+//   The buffers, a vector of an offset in the body and a length, after 4
+//   bytes of padding so that both vectors have their values 8 byte aligned.
+//
+static unsigned long long put_record_batch(unsigned char *p, unsigned int count, const export_column_t *columns)
+{
+	static const unsigned short fields[] = { 8, 4, 16 };
+	unsigned char *nodes = p + 44;
+	unsigned char *buffers = nodes + 8 + EXPORT_COLUMN_COUNT * 16;
+	unsigned long long offset = 0;
+	unsigned long long length;
+	unsigned int k;
+
+	put_le32(p, (unsigned int)-24);
+	put_le32(p + 4, 44 - 4);
+	put_le64(p + 8, count);
+	put_le32(p + 16, (unsigned int)(buffers - p) - 16);
+	put_vtable(p + 24, 24, fields, 3);
+
+	put_le32(nodes, EXPORT_COLUMN_COUNT);
+	put_le32(buffers, EXPORT_COLUMN_COUNT * 2);
+
+	for (k = 0; k < EXPORT_COLUMN_COUNT; k++)
+	{
+		length = (unsigned long long)count * columns[k].size;
+
+		put_le64(nodes + 4 + k * 16, count);
+		put_le64(buffers + 4 + k * 32, offset);
+		put_le64(buffers + 4 + k * 32 + 16, offset);
+		put_le64(buffers + 4 + k * 32 + 24, length);
+
+		offset += (length + EXPORT_ALIGN - 1) / EXPORT_ALIGN * EXPORT_ALIGN;
+	}
+
+	return offset;
+}
+
+//
+// Writes the Footer, FOOTER_SIZE bytes, with the Block of the record batch:
+//
+//   0  The offset of the root table.
+//   4  vtable.
+//   16 Table, 20 schema, 24 dictionaries, 28 recordBatches, 32 version.
+//   40 The dictionaries, an empty vector.
+//   44 The record batches, a vector of one Block.
+//   72 The Schema table, see put_schema().
+//
+static void put_footer(unsigned char *p, unsigned long long offset, unsigned int metadata_length, unsigned long long body_length, const export_column_t *columns)
+{
+	static const unsigned short fields[] = { 16, 4, 8, 12 };
+
+	put_le32(p, 16);
+	put_vtable(p + 4, 24, fields, 4);
+	put_le32(p + 16, 16 - 4);
+	put_le32(p + 20, 72 - 20);
+	put_le32(p + 24, 40 - 24);
+	put_le32(p + 28, 44 - 28);
+	put_le16(p + 32, ARROW_METADATA_V5);
+
+	put_le32(p + 40, 0);
+	put_le32(p + 44, 1);
+	put_le64(p + 48, offset);
+	put_le32(p + 56, metadata_length);
+	put_le64(p + 64, body_length);
+
+	put_schema(p + 72, columns);
+}
+
+//
+// Writes an encapsulated message, the continuation marker, the length of
+// the metadata and the metadata.
+//
+static void write_message(FILE *f, const unsigned char *metadata, unsigned int length)
+{
+	unsigned char prefix[8];
+
+	put_le32(prefix, EXPORT_CONTINUATION);
+	put_le32(prefix + 4, length);
+	fwrite(prefix, 1, sizeof(prefix), f);
+	fwrite(metadata, 1, length, f);
+}
+
+//
+// Encodes a column of bytes.
+//
+static void put_uint8_column(export_column_t *c, const unsigned char *v, unsigned int count)
+{
+	memcpy(c->values, v, count);
+}
+
+//
+// Encodes a column of 16 bit values.
+//
+static void put_uint16_column(export_column_t *c, const unsigned short *v, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+	{
+		put_le16(c->values + i * 2, v[i]);
+	}
+}
+
+//
+// Encodes a column of readings scaled by 0.1, the same as the text output.
+//
+static void put_tenths_column(export_column_t *c, const short *v, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+	{
+		put_float(c->values + i * 4, v[i] * 0.1f);
+	}
+}
+
+static void put_utenths_column(export_column_t *c, const unsigned short *v, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+	{
+		put_float(c->values + i * 4, v[i] * 0.1f);
+	}
+}
+
+//
+// Writes count history items to an Arrow IPC file.
+//
+int export_items(const char *path, weather_item_t *items, unsigned int count)
+{
+	export_column_t columns[EXPORT_COLUMN_COUNT] =
+	{
+		{ "timestamp",		COLUMN_TIMESTAMP, 8, NULL },	// Seconds since the epoch, UTC.
+		{ "index",			COLUMN_UINT16,	2, NULL },	// History index, 1-4080.
+		{ "address",		COLUMN_UINT16,	2, NULL },	// History address.
+		{ "delay",			COLUMN_UINT8,	1, NULL },	// Minutes since the previous item.
+		{ "in_humidity",	COLUMN_UINT8,	1, NULL },	// %
+		{ "in_temp",		COLUMN_FLOAT32,	4, NULL },	// Celcius.
+		{ "out_humidity",	COLUMN_UINT8,	1, NULL },	// %
+		{ "out_temp",		COLUMN_FLOAT32,	4, NULL },	// Celcius.
+		{ "dewpoint",		COLUMN_FLOAT32,	4, NULL },	// Celcius.
+		{ "windchill",		COLUMN_FLOAT32,	4, NULL },	// Celcius.
+		{ "abs_pressure",	COLUMN_FLOAT32,	4, NULL },	// hPa.
+		{ "rel_pressure",	COLUMN_FLOAT32,	4, NULL },	// hPa.
+		{ "avg_wind",		COLUMN_FLOAT32,	4, NULL },	// m/s.
+		{ "gust_wind",		COLUMN_FLOAT32,	4, NULL },	// m/s.
+		{ "wind_direction",	COLUMN_UINT8,	1, NULL },	// 0-15, times 22.5 degrees.
+		{ "rain_ticks",		COLUMN_UINT16,	2, NULL },	// Times 0.3 mm.
+		{ "status",			COLUMN_UINT8,	1, NULL }	// Status bits.
+	};
+	unsigned char metadata[FOOTER_SIZE];
+	unsigned char zeros[EXPORT_ALIGN];
+	unsigned int metadata_length;
+	unsigned long long batch_offset;
+	unsigned long long body_length;
+	unsigned long long offset;
+	unsigned char *block = NULL;
+	size_t block_size = 0;
+	weather_columns_t cols;
+	FILE *f = NULL;
+	int ret = -1;
+	unsigned int i;
+	unsigned int k;
+
+	memset(&cols, 0, sizeof(cols));
+	memset(zeros, 0, sizeof(zeros));
+
+	for (k = 0; k < EXPORT_COLUMN_COUNT; k++)
+	{
+		block_size += (size_t)count * columns[k].size;
+	}
+
+	if (alloc_columns(&cols, max(count, 1))
+		|| !(block = (unsigned char *)malloc(max(block_size, 1))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		goto fail;
+	}
+
+	for (k = 0, offset = 0; k < EXPORT_COLUMN_COUNT; k++)
+	{
+		columns[k].values = block + offset;
+		offset += (unsigned long long)count * columns[k].size;
+	}
+
+	if (count > 0)
+	{
+		decode_columns(items[0].raw_data, sizeof(weather_item_t), count, &cols, 0);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		put_le64(columns[0].values + i * 8, (unsigned long long)(long long)items[i].timestamp);
+		put_le16(columns[1].values + i * 2, items[i].history_index);
+		put_le16(columns[2].values + i * 2, items[i].address);
+	}
+
+	put_uint8_column(&columns[3], cols.delay, count);
+	put_uint8_column(&columns[4], cols.in_humidity, count);
+	put_tenths_column(&columns[5], cols.in_temp, count);
+	put_uint8_column(&columns[6], cols.out_humidity, count);
+	put_tenths_column(&columns[7], cols.out_temp, count);
+
+	for (i = 0; i < count; i++)
+	{
+		put_float(columns[8].values + i * 4, compute_dewpoint(cols.out_temp[i] * 0.1f, cols.out_humidity[i]));
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		put_float(columns[9].values + i * 4, compute_windchill(cols.out_temp[i] * 0.1f, cols.avg_wind[i] * 0.1f));
+	}
+
+	put_utenths_column(&columns[10], cols.abs_pressure, count);
+
+	for (i = 0; i < count; i++)
+	{
+		put_float(columns[11].values + i * 4, compute_rel_pressure(cols.abs_pressure[i], cols.out_temp[i]));
+	}
+
+	put_utenths_column(&columns[12], cols.avg_wind, count);
+	put_utenths_column(&columns[13], cols.gust_wind, count);
+	put_uint8_column(&columns[14], cols.wind_direction, count);
+	put_uint16_column(&columns[15], cols.total_rain, count);
+	put_uint8_column(&columns[16], cols.status, count);
+
+	if (!(f = fopen(path, "wb")))
+	{
+		fprintf(stderr, "Failed to open %s for writing\n", path);
+		goto fail;
+	}
+
+	memset(metadata, 0, sizeof(metadata));
+	memcpy(metadata, EXPORT_MAGIC, sizeof(EXPORT_MAGIC));
+	fwrite(metadata, 1, 8, f);
+
+	put_message(metadata, ARROW_HEADER_SCHEMA, 0);
+	put_schema(metadata + MESSAGE_SIZE, columns);
+	write_message(f, metadata, MESSAGE_SIZE + SCHEMA_SIZE);
+
+	// The metadata of the record batch is padded so its body is aligned.
+	batch_offset = 8 + 8 + MESSAGE_SIZE + SCHEMA_SIZE;
+	metadata_length = MESSAGE_SIZE + RECORD_BATCH_SIZE;
+	metadata_length += (EXPORT_ALIGN - (batch_offset + 8 + metadata_length) % EXPORT_ALIGN) % EXPORT_ALIGN;
+
+	memset(metadata, 0, sizeof(metadata));
+	body_length = put_record_batch(metadata + MESSAGE_SIZE, count, columns);
+	put_message(metadata, ARROW_HEADER_RECORD_BATCH, body_length);
+	write_message(f, metadata, metadata_length);
+
+	for (k = 0; k < EXPORT_COLUMN_COUNT; k++)
+	{
+		size_t length = (size_t)count * columns[k].size;
+
+		fwrite(columns[k].values, 1, length, f);
+		fwrite(zeros, 1, (EXPORT_ALIGN - (length % EXPORT_ALIGN)) % EXPORT_ALIGN, f);
+	}
+
+	// The end of stream marker.
+	write_message(f, zeros, 0);
+
+	memset(metadata, 0, sizeof(metadata));
+	put_footer(metadata, batch_offset, 8 + metadata_length, body_length, columns);
+	fwrite(metadata, 1, FOOTER_SIZE, f);
+	put_le32(metadata, FOOTER_SIZE);
+	fwrite(metadata, 1, 4, f);
+	fwrite(EXPORT_MAGIC, 1, 6, f);
+
+	if (ferror(f))
+	{
+		fprintf(stderr, "Failed to write to %s\n", path);
+		goto fail;
+	}
+
+	ret = 0;
+
+fail:
+	if (f) fclose(f);
+	free(block);
+	free_columns(&cols);
+
+	return ret;
+}
+
+//
+// Writes the history items from first up to end to an Arrow IPC file.
+//
+int export_columnar(const char *path, weather_history_t *history, unsigned int first, unsigned int end)
+{
+	if ((first < history->first) || (end > HISTORY_MAX))
+	{
+		fprintf(stderr, "The history to export hasn't been read\n");
+		return -1;
+	}
+
+	// The items read are stored one after the other.
+	return export_items(path, (end > first) ? get_history_item(history, first) : NULL, (end > first) ? (end - first) : 0);
+}
@@ -0,0 +1,146 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// The --format string is compiled once into a list of ops, instead of being
+// parsed again for each history item that is output. So an incorrect format
+// string is also caught before anything is read from the weather station.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wsp.h"
+#include "format.h"
+
+// The format variables, see print_history_item_formatstring().
+static const char format_fields[] = "ihLHtTCcWGDdPpRrFfNeEab";
+
+//
+// Adds a character of literal text, extending the previous op if that is
+// literal text as well.
+//
+static void add_literal(format_t *fmt, unsigned int *text_len, char c)
+{
+	format_op_t *op = (fmt->count > 0) ? &fmt->ops[fmt->count - 1] : NULL;
+
+	if (!op || op->field)
+	{
+		op = &fmt->ops[fmt->count++];
+		op->field = 0;
+		op->offset = *text_len;
+		op->length = 0;
+	}
+
+	fmt->text[(*text_len)++] = c;
+	op->length++;
+}
+
+//
+// Compiles a format string into a list of ops.
+//
+int compile_format(format_t *fmt, const char *format_str)
+{
+	size_t len = strlen(format_str);
+	unsigned int text_len = 0;
+	const char *s = format_str;
+
+	memset(fmt, 0, sizeof(format_t));
+
+	// There is never more than one op, or one character of text,
+	// for each character in the format string.
+	fmt->ops = (format_op_t *)malloc((len + 1) * sizeof(format_op_t));
+	fmt->text = (char *)malloc(len + 1);
+
+	if (!fmt->ops || !fmt->text)
+	{
+		fprintf(stderr, "Out of memory\n");
+		free_format(fmt);
+		return -1;
+	}
+
+	while (*s)
+	{
+		if (*s == '%')
+		{
+			s++;
+
+			if (*s == '%')
+			{
+				add_literal(fmt, &text_len, '%');
+			}
+			else if (*s && strchr(format_fields, *s))
+			{
+				format_op_t *op = &fmt->ops[fmt->count++];
+				op->field = *s;
+				op->offset = 0;
+				op->length = 0;
+
+				if (strchr("rfF", *s))
+				{
+					fmt->needs |= FORMAT_NEEDS_RAIN;
+				}
+			}
+			else if (*s)
+			{
+				fprintf(stderr, "Incorrect format string at character %d, %%%c is not a valid variable.\n", (int)(s - format_str), *s);
+				free_format(fmt);
+				return -1;
+			}
+			else
+			{
+				fprintf(stderr, "Incorrect format string, it ends with a single %%.\n");
+				free_format(fmt);
+				return -1;
+			}
+		}
+		else if (*s == '\\')
+		{
+			s++;
+
+			switch (*s)
+			{
+				case 'n': add_literal(fmt, &text_len, '\n'); break;
+				case 't': add_literal(fmt, &text_len, '\t'); break;
+				case 'r': add_literal(fmt, &text_len, '\r'); break;
+				case '\0': add_literal(fmt, &text_len, '\\'); s--; break;
+				default: add_literal(fmt, &text_len, *s); break;
+			}
+		}
+		else
+		{
+			add_literal(fmt, &text_len, *s);
+		}
+
+		s++;
+	}
+
+	return 0;
+}
+
+//
+// Frees a compiled format string.
+//
+void free_format(format_t *fmt)
+{
+	free(fmt->ops);
+	free(fmt->text);
+	memset(fmt, 0, sizeof(format_t));
+}
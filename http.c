@@ -0,0 +1,501 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// A small HTTP server for --http, so dashboards can get the current
+// conditions without each of them opening the station. Every poll in daemon
+// mode updates a copy of the settings block and the history kept in memory,
+// and the requests are answered from that as JSON, see json.c:
+//
+//   /current			The item the station is writing to now.
+//   /status			The settings block, see --status.
+//   /maxmin			The max and min values, see --maxmin.
+//   /history?since=t	The finished history items after the time t, in
+//						seconds since the epoch, as an array.
+//   /metrics			The counters and latest values in the Prometheus
+//						text format, see metrics.c.
+//
+// The requests are answered one at a time on a thread of their own. Only
+// GET is supported, and the connection is closed after each response.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <winsock2.h>
+typedef int socklen_t;
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+#include "wsp.h"
+#include "utils.h"
+#include "writer.h"
+#include "json.h"
+#include "weather.h"
+#include "thread.h"
+#include "metrics.h"
+#include "http.h"
+
+// A client closing the connection early shouldn't raise SIGPIPE.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define HTTP_REQUEST_SIZE 4096
+#define HTTP_TIMEOUT_SECONDS 2
+
+//
+// The latest settings block and history read. The history holds the
+// finished items in order, followed by the current item, and keeps the
+// last HISTORY_MAX of them.
+//
+typedef struct http_cache_s
+{
+	wsp_mutex_t mutex;
+	wsp_device_t *dev;
+	weather_settings_t ws;
+	weather_history_t history;
+	unsigned int count;
+} http_cache_t;
+
+static http_cache_t cache;
+static SOCKET server = INVALID_SOCKET;
+static wsp_thread_t server_thread;
+static int stop_server = 0;			// Guarded by the cache mutex.
+
+//
+// Adds the history items read in a poll to the cache. Cached items at or
+// after the first new one are replaced, in case the station memory was
+// reset and the history starts over.
+//
+void update_http_cache(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int first, unsigned int end)
+{
+	weather_item_t *items;
+	unsigned int count;
+	unsigned int keep;
+	unsigned int i;
+	time_t start;
+
+	if (first >= HISTORY_MAX)
+	{
+		return;
+	}
+
+	mutex_lock(&cache.mutex);
+
+	items = cache.history.items;
+	count = cache.count;
+
+	// The last cached item was still being written to.
+	if (count > 0)
+	{
+		count--;
+	}
+
+	start = get_history_item(history, first)->timestamp;
+
+	while ((count > 0) && (items[count - 1].timestamp >= start))
+	{
+		count--;
+	}
+
+	// Make room for the finished items and the current one.
+	keep = min(count, HISTORY_MAX - min(end - first + 1, HISTORY_MAX));
+	memmove(items, items + (count - keep), keep * sizeof(weather_item_t));
+	count = keep;
+
+	for (i = first; (i < end) && (count < HISTORY_MAX - 1); i++)
+	{
+		items[count++] = *get_history_item(history, i);
+	}
+
+	items[count++] = *get_history_item(history, HISTORY_MAX - 1);
+
+	// The cached items are at the end of a history, like when read.
+	cache.dev = dev;
+	cache.ws = *ws;
+	cache.count = count;
+	cache.history.first = HISTORY_MAX - count;
+	cache.history.read_time = history->read_time;
+	free(cache.history.elapsed);
+	free(cache.history.rain_wraps);
+	cache.history.elapsed = NULL;
+	cache.history.rain_wraps = NULL;
+	prepare_rain_index(&cache.history);
+
+	mutex_unlock(&cache.mutex);
+}
+
+//
+// Formats the response to a request for the given path.
+// Returns the HTTP status, and sets the type of the response.
+//
+static int format_response(writer_t *w, const char *path, const char **content_type)
+{
+	weather_history_t *history = &cache.history;
+	const char *query = strchr(path, '?');
+	size_t len = query ? (size_t)(query - path) : strlen(path);
+	unsigned int i;
+	int first_item = 1;
+
+	*content_type = "application/json";
+
+	// The counters are there even if the station couldn't be read.
+	if ((len == 8) && !strncmp(path, "/metrics", len))
+	{
+		*content_type = "text/plain; version=0.0.4";
+		print_metrics(w, &cache.dev, 1);
+		return 200;
+	}
+
+	if (!cache.count)
+	{
+		writer_str(w, "{\"error\":\"The station hasn't been read yet.\"}\n");
+		return 503;
+	}
+
+	if ((len == 8) && !strncmp(path, "/current", len))
+	{
+		print_json_current(w, cache.dev, &cache.ws, history, HISTORY_MAX - 1);
+	}
+	else if ((len == 7) && !strncmp(path, "/status", len))
+	{
+		print_json_status(w, cache.dev, &cache.ws);
+	}
+	else if ((len == 7) && !strncmp(path, "/maxmin", len))
+	{
+		print_json_maxmin(w, cache.dev, &cache.ws);
+	}
+	else if ((len == 8) && !strncmp(path, "/history", len))
+	{
+		const char *since_arg = query ? strstr(query, "since=") : NULL;
+		time_t since = since_arg ? (time_t)strtol(since_arg + 6, NULL, 10) : 0;
+
+		writer_char(w, '[');
+
+		for (i = history->first; i < (HISTORY_MAX - 1); i++)
+		{
+			if (get_history_item(history, i)->timestamp <= since)
+				continue;
+
+			if (!first_item)
+			{
+				writer_char(w, ',');
+			}
+
+			print_json_item(w, cache.dev, &cache.ws, history, i);
+			first_item = 0;
+		}
+
+		writer_str(w, "]\n");
+	}
+	else
+	{
+		writer_str(w, "{\"error\":\"Not found.\"}\n");
+		return 404;
+	}
+
+	return 200;
+}
+
+static const char *status_text(int status)
+{
+	switch (status)
+	{
+		default:
+		case 200: return "OK";
+		case 400: return "Bad Request";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 503: return "Service Unavailable";
+	}
+}
+
+//
+// Sends all of a buffer, or gives up.
+//
+static int send_all(SOCKET s, const char *data, size_t len)
+{
+	int sent;
+
+	while (len > 0)
+	{
+		if ((sent = send(s, data, (int)len, MSG_NOSIGNAL)) <= 0)
+		{
+			return -1;
+		}
+
+		data += sent;
+		len -= (size_t)sent;
+	}
+
+	return 0;
+}
+
+//
+// Reads a request from a client and answers it.
+//
+static void handle_client(SOCKET client)
+{
+	char request[HTTP_REQUEST_SIZE];
+	char header[256];
+	char path[HTTP_REQUEST_SIZE];
+	const char *content_type = "application/json";
+	size_t len = 0;
+	int header_len;
+	int status;
+	int n;
+	writer_t w;
+
+	// Only the request line is needed, but read the whole header so the
+	// client doesn't get a reset when the connection is closed.
+	while (len < (sizeof(request) - 1))
+	{
+		if ((n = recv(client, request + len, (int)(sizeof(request) - 1 - len), 0)) <= 0)
+			break;
+
+		len += (size_t)n;
+		request[len] = 0;
+
+		if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+			break;
+	}
+
+	request[len] = 0;
+	writer_init(&w, NULL);
+
+	// Logged below even if the request line can't be parsed.
+	path[0] = 0;
+
+	if (sscanf(request, "%*s %4095s", path) != 1)
+	{
+		writer_str(&w, "{\"error\":\"Bad request.\"}\n");
+		status = 400;
+	}
+	else if (strncmp(request, "GET ", 4))
+	{
+		writer_str(&w, "{\"error\":\"Only GET is supported.\"}\n");
+		status = 405;
+	}
+	else
+	{
+		mutex_lock(&cache.mutex);
+		status = format_response(&w, path, &content_type);
+		mutex_unlock(&cache.mutex);
+	}
+
+	debug_printf(1, "HTTP %s: %d\n", path, status);
+
+	header_len = snprintf(header, sizeof(header),
+		"HTTP/1.0 %d %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %lu\r\n"
+		"Cache-Control: no-cache\r\n"
+		"Connection: close\r\n\r\n",
+		status, status_text(status), content_type, (unsigned long)w.len);
+
+	if (!send_all(client, header, (size_t)header_len))
+	{
+		send_all(client, w.data, w.len);
+	}
+
+	writer_free(&w);
+}
+
+//
+// Answers requests until the server is stopped. The socket is checked
+// every second, so stopping doesn't have to wait for a request.
+//
+static void server_main(void *arg)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len;
+	struct timeval tv;
+	fd_set fds;
+	SOCKET client;
+	int stop;
+
+	while (1)
+	{
+		mutex_lock(&cache.mutex);
+		stop = stop_server;
+		mutex_unlock(&cache.mutex);
+
+		if (stop)
+			break;
+
+		FD_ZERO(&fds);
+		FD_SET(server, &fds);
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+
+		if (select((int)server + 1, &fds, NULL, NULL, &tv) <= 0)
+			continue;
+
+		addr_len = sizeof(addr);
+
+		if ((client = accept(server, (struct sockaddr *)&addr, &addr_len)) == INVALID_SOCKET)
+			continue;
+
+		// A client that stops sending can't hold up the others for long.
+		#ifdef WIN32
+		{
+			DWORD timeout = HTTP_TIMEOUT_SECONDS * 1000;
+			setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+			setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout));
+		}
+		#else
+		tv.tv_sec = HTTP_TIMEOUT_SECONDS;
+		tv.tv_usec = 0;
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof(tv));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char *)&tv, sizeof(tv));
+		#endif
+
+		handle_client(client);
+		closesocket(client);
+	}
+}
+
+//
+// Starts listening on the address given with --http, as [address:]port,
+// for the given station. Only the local machine can connect unless an
+// address is given.
+//
+int start_http_server(wsp_device_t *dev)
+{
+	struct sockaddr_in addr;
+	char address[64] = "127.0.0.1";
+	const char *port = program_settings.http_address;
+	const char *colon = strrchr(port, ':');
+	int reuse = 1;
+
+	#ifdef WIN32
+	WSADATA wsa;
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsa))
+	{
+		fprintf(stderr, "Failed to start Winsock\n");
+		return -1;
+	}
+	#endif
+
+	if (colon)
+	{
+		snprintf(address, sizeof(address), "%.*s", (int)(colon - port), port);
+		port = colon + 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)atoi(port));
+	addr.sin_addr.s_addr = inet_addr(address);
+
+	if ((addr.sin_addr.s_addr == INADDR_NONE) || !addr.sin_port)
+	{
+		fprintf(stderr, "Invalid HTTP address %s, use [address:]port.\n", program_settings.http_address);
+		return -1;
+	}
+
+	mutex_init(&cache.mutex);
+
+	if (!(cache.history.items = (weather_item_t *)calloc(HISTORY_MAX, sizeof(weather_item_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		mutex_destroy(&cache.mutex);
+		return -1;
+	}
+
+	cache.history.first = HISTORY_MAX;
+	cache.dev = dev;
+
+	if ((server = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET)
+	{
+		perror("Failed to create the HTTP socket. ");
+		goto fail;
+	}
+
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+	if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) || listen(server, 16))
+	{
+		fprintf(stderr, "Failed to listen for HTTP on %s:%s\n", address, port);
+		goto fail;
+	}
+
+	stop_server = 0;
+
+	if (thread_create(&server_thread, server_main, NULL))
+	{
+		fprintf(stderr, "Failed to start the HTTP server thread\n");
+		goto fail;
+	}
+
+	debug_printf(1, "Listening for HTTP on %s:%s\n", address, port);
+
+	return 0;
+
+fail:
+	if (server != INVALID_SOCKET)
+	{
+		closesocket(server);
+		server = INVALID_SOCKET;
+	}
+
+	free_history(&cache.history);
+	mutex_destroy(&cache.mutex);
+
+	return -1;
+}
+
+//
+// Stops answering requests and frees the cache.
+//
+void stop_http_server()
+{
+	if (server == INVALID_SOCKET)
+	{
+		return;
+	}
+
+	mutex_lock(&cache.mutex);
+	stop_server = 1;
+	mutex_unlock(&cache.mutex);
+
+	thread_join(server_thread);
+	closesocket(server);
+	server = INVALID_SOCKET;
+
+	free_history(&cache.history);
+	mutex_destroy(&cache.mutex);
+
+	#ifdef WIN32
+	WSACleanup();
+	#endif
+}
@@ -0,0 +1,28 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+int start_http_server(wsp_device_t *dev);
+void update_http_cache(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int first, unsigned int end);
+void stop_http_server();
+
+#endif // __HTTP_H__
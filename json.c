@@ -0,0 +1,315 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Outputs JSON Lines, one object per line for each history item and for
+// the status, settings, alarms and max/min values. Every object has a
+// "type" and the "station" it is from. The values are scaled the same way
+// as in the other outputs.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "wsp.h"
+#include "utils.h"
+#include "writer.h"
+#include "weather.h"
+#include "transport.h"
+#include "json.h"
+
+//
+// Starts an object. The fields are added with the json_*() functions,
+// each of them begins with a comma.
+//
+static void begin_object(writer_t *w, wsp_device_t *dev, const char *type)
+{
+	writer_str(w, "{\"type\":");
+	writer_json_string(w, type);
+	writer_str(w, ",\"station\":");
+	writer_json_string(w, dev->label);
+}
+
+static void end_object(writer_t *w)
+{
+	writer_str(w, "}\n");
+}
+
+static void json_key(writer_t *w, const char *key)
+{
+	writer_str(w, ",\"");
+	writer_str(w, key);
+	writer_str(w, "\":");
+}
+
+static void json_uint(writer_t *w, const char *key, unsigned int v)
+{
+	json_key(w, key);
+	writer_uint(w, v, 0, ' ');
+}
+
+static void json_int(writer_t *w, const char *key, int v)
+{
+	json_key(w, key);
+	writer_int(w, v);
+}
+
+static void json_fixed(writer_t *w, const char *key, float v, unsigned int decimals)
+{
+	json_key(w, key);
+	writer_json_fixed(w, v, decimals);
+}
+
+static void json_string(writer_t *w, const char *key, const char *s)
+{
+	json_key(w, key);
+	writer_json_string(w, s);
+}
+
+static void json_bool(writer_t *w, const char *key, int v)
+{
+	json_key(w, key);
+	writer_str(w, v ? "true" : "false");
+}
+
+//
+// Adds a timestamp as seconds since the epoch, and as a local date and
+// time unless --epoch is given.
+//
+static void json_timestamp(writer_t *w, const char *key, const char *text_key, time_t t)
+{
+	json_key(w, key);
+	writer_time(w, t);
+
+	if (!program_settings.epoch)
+	{
+		json_key(w, text_key);
+		writer_char(w, '"');
+		writer_timestamp(w, t);
+		writer_char(w, '"');
+	}
+}
+
+//
+// Adds a date from the station, which is in local time already.
+//
+static void json_bcd_date(writer_t *w, const char *key, unsigned char date[5])
+{
+	bcd_date_t d = parse_bcd_date(date);
+
+	json_key(w, key);
+	writer_char(w, '"');
+	writer_uint(w, d.year, 0, '0');
+	writer_char(w, '-');
+	writer_uint(w, d.month, 2, '0');
+	writer_char(w, '-');
+	writer_uint(w, d.day, 2, '0');
+	writer_char(w, ' ');
+	writer_uint(w, d.hour, 2, '0');
+	writer_char(w, ':');
+	writer_uint(w, d.minute, 2, '0');
+	writer_str(w, ":00\"");
+}
+
+//
+// Adds a max or min value and when it was recorded, as an object.
+//
+static void json_record(writer_t *w, const char *key, float v, unsigned int decimals, unsigned char date[5])
+{
+	json_key(w, key);
+	writer_str(w, "{\"value\":");
+	writer_json_fixed(w, v, decimals);
+	json_bcd_date(w, "time", date);
+	writer_char(w, '}');
+}
+
+//
+// Adds an alarm value and if the alarm is enabled, as an object.
+//
+static void json_alarm(writer_t *w, const char *key, float v, unsigned int decimals, unsigned char enable, unsigned int bit)
+{
+	json_key(w, key);
+	writer_str(w, "{\"value\":");
+	writer_json_fixed(w, v, decimals);
+	json_bool(w, "enabled", (enable >> bit) & 0x1);
+	writer_char(w, '}');
+}
+
+//
+// Outputs a history item as an object of the given type.
+//
+static void print_item_object(writer_t *w, wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index, const char *type)
+{
+	weather_item_t *item = get_history_item(history, index);
+
+	begin_object(w, dev, type);
+	json_uint(w, "index", item->history_index);
+	json_uint(w, "address", item->address);
+	json_timestamp(w, "timestamp", "time", item->timestamp);
+	json_uint(w, "delay", item_delay(item));
+	json_bool(w, "contact", has_contact_with_sensor(item));
+	json_uint(w, "in_humidity", item_in_humidity(item));
+	json_fixed(w, "in_temp", item_in_temp(item) * 0.1f, 1);
+	json_uint(w, "out_humidity", item_out_humidity(item));
+	json_fixed(w, "out_temp", item_out_temp(item) * 0.1f, 1);
+	json_fixed(w, "dewpoint", calculate_dewpoint(item), 1);
+	json_fixed(w, "windchill", calculate_windchill(item), 1);
+	json_fixed(w, "abs_pressure", item_abs_pressure(item) * 0.1f, 1);
+	json_fixed(w, "rel_pressure", calculate_rel_pressure(item), 1);
+	json_fixed(w, "avg_wind", convert_avg_windspeed(item), 1);
+	json_uint(w, "avg_wind_beaufort", calculate_beaufort(convert_avg_windspeed(item)));
+	json_fixed(w, "gust_wind", convert_gust_windspeed(item), 1);
+	json_uint(w, "gust_wind_beaufort", calculate_beaufort(convert_gust_windspeed(item)));
+	json_fixed(w, "wind_direction", item_wind_direction(item) * 22.5f, 1);
+	json_string(w, "wind_direction_name", get_wind_direction(item_wind_direction(item)));
+	json_uint(w, "rain_ticks", item_total_rain(item));
+	json_fixed(w, "total_rain", item_total_rain(item) * 0.3f, 1);
+	json_fixed(w, "rain_1h", calculate_rain_1h(dev, ws, history, index), 1);
+	json_fixed(w, "rain_24h", calculate_rain_24h(dev, ws, history, index), 1);
+	json_uint(w, "status", item_status(item));
+	end_object(w);
+}
+
+void print_json_item(writer_t *w, wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index)
+{
+	print_item_object(w, dev, ws, history, index, "history");
+}
+
+//
+// Outputs the item the station is still writing to. It has the same
+// fields as a history item, but changes until the next one is started.
+//
+void print_json_current(writer_t *w, wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index)
+{
+	print_item_object(w, dev, ws, history, index, "current");
+}
+
+void print_json_status(writer_t *w, wsp_device_t *dev, weather_settings_t *ws)
+{
+	begin_object(w, dev, "status");
+	json_uint(w, "read_period", ws->read_period);
+	json_int(w, "timezone", ws->timezone);
+	json_uint(w, "data_count", ws->data_count);
+	json_uint(w, "data_max", HISTORY_MAX);
+	json_uint(w, "current_pos", ws->current_pos);
+	json_fixed(w, "rel_pressure", ws->relative_pressure * 0.1f, 1);
+	json_fixed(w, "abs_pressure", ws->absolute_pressure * 0.1f, 1);
+	json_bcd_date(w, "time", ws->datetime);
+	end_object(w);
+}
+
+void print_json_settings(writer_t *w, wsp_device_t *dev, weather_settings_t *ws)
+{
+	const char *pressure_unit = "";
+	const char *wind_unit = "";
+
+	if (ws->unit_settings1 & (1 << 5))
+		pressure_unit = "hPa";
+	else if (ws->unit_settings1 & (1 << 6))
+		pressure_unit = "inHg";
+	else if (ws->unit_settings1 & (1 << 7))
+		pressure_unit = "mmHg";
+
+	if (ws->unit_settings2 & (1 << 0))
+		wind_unit = "m/s";
+	else if (ws->unit_settings2 & (1 << 1))
+		wind_unit = "km/h";
+	else if (ws->unit_settings2 & (1 << 2))
+		wind_unit = "knot";
+	else if (ws->unit_settings2 & (1 << 3))
+		wind_unit = "m/h";
+	else if (ws->unit_settings2 & (1 << 4))
+		wind_unit = "bft";
+
+	begin_object(w, dev, "settings");
+	json_string(w, "in_temp_unit", (ws->unit_settings1 & (1 << 0)) ? "Fahrenheit" : "Celcius");
+	json_string(w, "out_temp_unit", (ws->unit_settings1 & (1 << 1)) ? "Fahrenheit" : "Celcius");
+	json_string(w, "rain_unit", (ws->unit_settings1 & (1 << 2)) ? "mm" : "inch");
+	json_string(w, "pressure_unit", pressure_unit);
+	json_string(w, "wind_unit", wind_unit);
+	json_uint(w, "unit_settings1", ws->unit_settings1);
+	json_uint(w, "unit_settings2", ws->unit_settings2);
+	json_uint(w, "display_options1", ws->display_options1);
+	json_uint(w, "display_options2", ws->display_options2);
+	end_object(w);
+}
+
+void print_json_alarms(writer_t *w, wsp_device_t *dev, weather_settings_t *ws)
+{
+	begin_object(w, dev, "alarms");
+	json_key(w, "time");
+	writer_str(w, "{\"value\":\"");
+	writer_uint(w, (ws->alarm_time >> 4) & 0xf, 2, '0');
+	writer_char(w, ':');
+	writer_uint(w, ws->alarm_time & 0xf, 2, '0');
+	writer_char(w, '"');
+	json_bool(w, "enabled", (ws->alarm_enable1 >> 1) & 0x1);
+	writer_char(w, '}');
+	json_alarm(w, "wind_direction", ws->alarm_wind_direction * 22.5f, 1,	ws->alarm_enable1, 2);
+	json_alarm(w, "in_humidity_low", ws->alarm_inhumid_low, 0,				ws->alarm_enable1, 4);
+	json_alarm(w, "in_humidity_high", ws->alarm_inhumid_high, 0,			ws->alarm_enable1, 5);
+	json_alarm(w, "out_humidity_low", ws->alarm_outhumid_low, 0,			ws->alarm_enable1, 6);
+	json_alarm(w, "out_humidity_high", ws->alarm_outhumid_high, 0,			ws->alarm_enable1, 7);
+	json_alarm(w, "avg_wind", ws->alarm_avg_wspeed_ms * 0.1f, 1,			ws->alarm_enable2, 0);
+	json_alarm(w, "gust_wind", ws->alarm_gust_wspeed_ms, 0,				ws->alarm_enable2, 1);
+	json_alarm(w, "rain_hourly", ws->alarm_rain_hourly * 0.3f, 1,			ws->alarm_enable2, 2);
+	json_alarm(w, "rain_daily", ws->alarm_rain_daily * 0.3f, 1,			ws->alarm_enable2, 3);
+	json_alarm(w, "abs_pressure_low", ws->alarm_abs_pressure_low * 0.1f, 1,	ws->alarm_enable2, 4);
+	json_alarm(w, "abs_pressure_high", ws->alarm_abs_pressure_high * 0.1f, 1,	ws->alarm_enable2, 5);
+	json_alarm(w, "rel_pressure_low", ws->alarm_rel_pressure_low * 0.1f, 1,	ws->alarm_enable2, 6);
+	json_alarm(w, "rel_pressure_high", ws->alarm_rel_pressure_high * 0.1f, 1,	ws->alarm_enable2, 7);
+	json_alarm(w, "in_temp_low", ws->alarm_intemp_low * 0.1f, 1,			ws->alarm_enable3, 0);
+	json_alarm(w, "in_temp_high", ws->alarm_intemp_high * 0.1f, 1,			ws->alarm_enable3, 1);
+	json_alarm(w, "out_temp_low", ws->alarm_outtemp_low * 0.1f, 1,			ws->alarm_enable3, 2);
+	json_alarm(w, "out_temp_high", ws->alarm_outtemp_high * 0.1f, 1,		ws->alarm_enable3, 3);
+	json_alarm(w, "windchill_low", ws->alarm_windchill_low * 0.1f, 1,		ws->alarm_enable3, 4);
+	json_alarm(w, "windchill_high", ws->alarm_windchill_high * 0.1f, 1,	ws->alarm_enable3, 5);
+	json_alarm(w, "dewpoint_low", ws->alarm_dewpoint_low * 0.1f, 1,		ws->alarm_enable3, 6);
+	json_alarm(w, "dewpoint_high", ws->alarm_dewpoint_high * 0.1f, 1,		ws->alarm_enable3, 7);
+	end_object(w);
+}
+
+void print_json_maxmin(writer_t *w, wsp_device_t *dev, weather_settings_t *ws)
+{
+	begin_object(w, dev, "maxmin");
+	json_record(w, "max_in_temp", ws->max_intemp * 0.1f, 1,				ws->max_intemp_date);
+	json_record(w, "min_in_temp", ws->min_intemp * 0.1f, 1,				ws->min_intemp_date);
+	json_record(w, "max_in_humidity", ws->max_inhumid, 0,					ws->max_inhumid_date);
+	json_record(w, "min_in_humidity", ws->min_inhumid, 0,					ws->min_inhumid_date);
+	json_record(w, "max_out_temp", ws->max_outtemp * 0.1f, 1,				ws->max_outtemp_date);
+	json_record(w, "min_out_temp", ws->min_outtemp * 0.1f, 1,				ws->min_outtemp_date);
+	json_record(w, "max_windchill", ws->max_windchill * 0.1f, 1,			ws->max_windchill_date);
+	json_record(w, "min_windchill", ws->min_windchill * 0.1f, 1,			ws->min_windchill_date);
+	json_record(w, "max_dewpoint", ws->max_dewpoint * 0.1f, 1,				ws->max_dewpoint_date);
+	json_record(w, "min_dewpoint", ws->min_dewpoint * 0.1f, 1,				ws->min_dewpoint_date);
+	json_record(w, "max_out_humidity", ws->max_outhumid, 0,				ws->max_outhumid_date);
+	json_record(w, "min_out_humidity", ws->min_outhumid, 0,				ws->min_outhumid_date);
+	json_record(w, "max_abs_pressure", ws->max_abs_pressure * 0.1f, 1,		ws->max_abs_pressure_date);
+	json_record(w, "min_abs_pressure", ws->min_abs_pressure * 0.1f, 1,		ws->min_abs_pressure_date);
+	json_record(w, "max_rel_pressure", ws->max_rel_pressure * 0.1f, 1,		ws->max_rel_pressure_date);
+	json_record(w, "min_rel_pressure", ws->min_rel_pressure * 0.1f, 1,		ws->min_rel_pressure_date);
+	json_record(w, "max_avg_wind", ws->max_avg_wspeed * 0.1f, 1,			ws->max_avg_wspeed_date);
+	json_record(w, "max_gust_wind", ws->max_gust_wspeed * 0.1f, 1,			ws->max_gust_wspeed_date);
+	json_record(w, "max_rain_hourly", ws->max_rain_hourly * 0.3f, 1,		ws->max_rain_hourly_date);
+	json_record(w, "max_rain_daily", ws->max_rain_daily * 0.3f, 1,			ws->max_rain_daily_date);
+	json_record(w, "max_rain_weekly", ws->max_rain_weekly * 0.3f, 1,		ws->max_rain_weekly_date);
+	json_record(w, "max_rain_monthly", ws->max_rain_monthly * 0.3f, 1,		ws->max_rain_monthly_date);
+	json_record(w, "max_rain_total", ws->max_rain_total * 0.3f, 1,			ws->max_rain_total_date);
+	end_object(w);
+}
@@ -0,0 +1,244 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// A mirror of the 64 KB weather station memory, kept in 32-byte blocks
+// (the size of each read). All reads go through it, so an address is
+// only read from the station once no matter how many parts of the
+// program needs it.
+//
+// Each block is stamped with the generation it was read in. A new
+// generation is started for each poll, so that the parts of the memory
+// the station writes to can be expired while the rest of the history,
+// which never changes once written, is kept.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "wsp.h"
+#include "utils.h"
+#include "memory.h"
+#include "memcache.h"
+
+
+#define BLOCK_INDEX(addr) ((addr) / MEMCACHE_BLOCK_SIZE)
+#define IS_BLOCK_ALIGNED(addr) (((addr) % MEMCACHE_BLOCK_SIZE) == 0)
+
+//
+// Creates an empty cache, one is needed for each weather station.
+//
+memcache_t *memcache_create()
+{
+	memcache_t *cache;
+
+	if (!(cache = (memcache_t *)calloc(1, sizeof(memcache_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+
+	cache->generation = 1;
+
+	return cache;
+}
+
+void memcache_destroy(memcache_t *cache)
+{
+	free(cache);
+}
+
+//
+// Is the 32-byte block at the given address in the cache?
+// Counts a miss if it is not.
+//
+int memcache_contains(memcache_t *cache, unsigned short addr)
+{
+	if (!IS_BLOCK_ALIGNED(addr) || !(cache->flags[BLOCK_INDEX(addr)] & MEMCACHE_VALID))
+	{
+		cache->misses++;
+		return 0;
+	}
+
+	return 1;
+}
+
+//
+// Gets a 32-byte block from the cache. Returns 0 if it was found.
+// Only reads aligned to a block are cached.
+//
+int memcache_lookup(memcache_t *cache, unsigned short addr, char buf[32])
+{
+	if (!memcache_contains(cache, addr))
+	{
+		return -1;
+	}
+
+	memcpy(buf, &cache->data[addr], MEMCACHE_BLOCK_SIZE);
+	cache->hits++;
+
+	return 0;
+}
+
+//
+// Stores a 32-byte block that was read from the station.
+//
+void memcache_store(memcache_t *cache, unsigned short addr, const char buf[32])
+{
+	unsigned int block = BLOCK_INDEX(addr);
+
+	if (!IS_BLOCK_ALIGNED(addr))
+		return;
+
+	// Never overwrite local changes that haven't been written back yet.
+	if (cache->flags[block] & MEMCACHE_DIRTY)
+		return;
+
+	memcpy(&cache->data[addr], buf, MEMCACHE_BLOCK_SIZE);
+	cache->flags[block] = MEMCACHE_VALID;
+	cache->stamps[block] = cache->generation;
+}
+
+//
+// Updates the cached blocks after data was written to the station.
+//
+void memcache_update(memcache_t *cache, unsigned short addr, const char *data, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; (i < len) && ((addr + i) < MEMORY_SIZE); i++)
+	{
+		if (cache->flags[BLOCK_INDEX(addr + i)] & MEMCACHE_VALID)
+		{
+			cache->data[addr + i] = data[i];
+		}
+	}
+}
+
+//
+// Changes cached data without writing it to the station. The blocks
+// are marked as dirty, and are written with memcache_flush().
+// The blocks must have been read first.
+//
+int memcache_modify(memcache_t *cache, unsigned short addr, const char *data, unsigned int len)
+{
+	unsigned int i;
+
+	assert((addr + len) <= MEMORY_SIZE);
+
+	for (i = BLOCK_INDEX(addr); i <= BLOCK_INDEX(addr + len - 1); i++)
+	{
+		if (!(cache->flags[i] & MEMCACHE_VALID))
+		{
+			return -1;
+		}
+	}
+
+	memcpy(&cache->data[addr], data, len);
+
+	for (i = BLOCK_INDEX(addr); i <= BLOCK_INDEX(addr + len - 1); i++)
+	{
+		cache->flags[i] |= MEMCACHE_DIRTY;
+	}
+
+	return 0;
+}
+
+//
+// Writes all dirty blocks back to the station.
+//
+int memcache_flush(wsp_device_t *dev)
+{
+	memcache_t *cache = dev->cache;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < MEMCACHE_BLOCKS; i++)
+	{
+		if (!(cache->flags[i] & MEMCACHE_DIRTY))
+			continue;
+
+		debug_printf(2, "Writing back block at %u (0x%x)\n", i * MEMCACHE_BLOCK_SIZE, i * MEMCACHE_BLOCK_SIZE);
+
+		cache->flags[i] &= ~MEMCACHE_DIRTY;
+
+		if (write_weather_32(dev, (unsigned short)(i * MEMCACHE_BLOCK_SIZE), (char *)&cache->data[i * MEMCACHE_BLOCK_SIZE]))
+		{
+			// We don't know what the station has now.
+			cache->flags[i] = 0;
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+//
+// Drops the cached blocks covering the given range, so they are read again.
+//
+void memcache_invalidate(memcache_t *cache, unsigned int addr, unsigned int len)
+{
+	unsigned int i;
+
+	if (len == 0)
+		return;
+
+	for (i = BLOCK_INDEX(addr); (i <= BLOCK_INDEX(addr + len - 1)) && (i < MEMCACHE_BLOCKS); i++)
+	{
+		cache->flags[i] = 0;
+	}
+}
+
+//
+// Drops the cached blocks covering the given range that were read
+// before the current generation. Local changes are kept.
+//
+void memcache_expire(memcache_t *cache, unsigned int addr, unsigned int len)
+{
+	unsigned int i;
+
+	if (len == 0)
+		return;
+
+	for (i = BLOCK_INDEX(addr); (i <= BLOCK_INDEX(addr + len - 1)) && (i < MEMCACHE_BLOCKS); i++)
+	{
+		if ((cache->stamps[i] != cache->generation) && !(cache->flags[i] & MEMCACHE_DIRTY))
+		{
+			cache->flags[i] = 0;
+		}
+	}
+}
+
+//
+// Starts a new generation, this is done before each poll.
+//
+unsigned int memcache_next_generation(memcache_t *cache)
+{
+	return ++cache->generation;
+}
+
+//
+// Prints how well the cache has worked.
+//
+void memcache_print_stats(memcache_t *cache, unsigned int debug_level)
+{
+	debug_printf(debug_level, "Memory cache: %u hits, %u misses (generation %u)\n",
+				cache->hits, cache->misses, cache->generation);
+}
@@ -0,0 +1,53 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __MEMCACHE_H__
+#define __MEMCACHE_H__
+
+#define MEMORY_SIZE				0x10000
+#define MEMCACHE_BLOCK_SIZE		32
+#define MEMCACHE_BLOCKS			(MEMORY_SIZE / MEMCACHE_BLOCK_SIZE)
+
+#define MEMCACHE_VALID			(1 << 0)	// The block has been read from the station.
+#define MEMCACHE_DIRTY			(1 << 1)	// The block has been changed and not yet written back.
+
+typedef struct memcache_s
+{
+	unsigned char data[MEMORY_SIZE];
+	unsigned char flags[MEMCACHE_BLOCKS];
+	unsigned int stamps[MEMCACHE_BLOCKS];	// The generation each block was read in.
+	unsigned int generation;
+	unsigned int hits;
+	unsigned int misses;
+} memcache_t;
+
+memcache_t *memcache_create();
+void memcache_destroy(memcache_t *cache);
+int memcache_contains(memcache_t *cache, unsigned short addr);
+int memcache_lookup(memcache_t *cache, unsigned short addr, char buf[32]);
+void memcache_store(memcache_t *cache, unsigned short addr, const char buf[32]);
+void memcache_update(memcache_t *cache, unsigned short addr, const char *data, unsigned int len);
+int memcache_modify(memcache_t *cache, unsigned short addr, const char *data, unsigned int len);
+int memcache_flush(wsp_device_t *dev);
+void memcache_invalidate(memcache_t *cache, unsigned int addr, unsigned int len);
+void memcache_expire(memcache_t *cache, unsigned int addr, unsigned int len);
+unsigned int memcache_next_generation(memcache_t *cache);
+void memcache_print_stats(memcache_t *cache, unsigned int debug_level);
+
+#endif // __MEMCACHE_H__
@@ -1,145 +1,337 @@
-//
-// Weather Station Poller
-//
-// Copyright (C) 2010 Joakim Sderberg
-//
-// This program is free software: you can redistribute it and/or modify
-// it under the terms of the GNU General Public License as published by
-// the Free Software Foundation, either version 3 of the License, or
-// (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-// GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program.  If not, see <http://www.gnu.org/licenses/>.
-//
-
-#include <stdio.h>
-#include "wsp.h"
-#include "memory.h"
-#include "utils.h"
-
-//
-// Sends a USB message to the device from a given buffer.
-//
-int send_usb_msgbuf(struct usb_dev_handle *h, char *msg, int msgsize)
-{
-	int bytes_written = 0;
-
-	debug_printf(2, "--> ");
-	print_bytes(2, msg, msgsize);
-
-	bytes_written = usb_control_msg(h, USB_TYPE_CLASS + USB_RECIP_INTERFACE,
-									9, 0x200, 0, msg, msgsize, USB_TIMEOUT);
-	//assert(bytes_written == msgsize);
-	
-	return bytes_written;
-}
-
-//
-// All data from the weather station is read in 32 byte chunks.
-//
-int read_weather_msg(struct usb_dev_handle *h, char buf[32])
-{
-	return usb_interrupt_read(h, ENDPOINT_INTERRUPT_ADDRESS, buf, 32, USB_TIMEOUT);
-}
-
-//
-// Reads a weather message from a given address in history.
-//
-int read_weather_address(struct usb_dev_handle *h, unsigned short addr, char buf[32])
-{
-	if (program_settings.from_file)
-	{
-		// Special case if we try to read the next to last history chunk.
-		int bytes_to_read = (addr == (HISTORY_END - HISTORY_CHUNK_SIZE)) ? 16 : 32;
-		FILE *f = program_settings.f;
-		
-		// Only open the file once.
-		if (!f)
-		{
-			f = fopen(program_settings.infile, "r");
-		}
-
-		if (fseek(f, addr, SEEK_SET))
-		{
-			fprintf(stderr, "Failed to seek to position %d (0x%d) in file.\n", addr, addr);
-			return -1;
-		}
-		
-		if (fread(buf, 1, bytes_to_read, f) != bytes_to_read)
-		{
-			if (feof(f))
-			{
-				fprintf(stderr, "Tried to read past the end of file.\n");
-			}
-			else
-			{
-				perror("Error reading from file. ");
-			}
-			
-			return -1;
-		}
-		
-		return 0;
-	}
-	else
-	{
-		char msg[8] = {0xa1, (addr >> 8), (addr & 0xff), 0x20, 0xa1, 0, 0, 0x20};
-		send_usb_msgbuf(h, msg, 8);
-		return (read_weather_msg(h, buf) != 32);
-	}
-}
-
-//
-// Reads weather ack message when writing setting data.
-//
-int read_weather_ack(struct usb_dev_handle *h)
-{
-	unsigned int i;
-	char buf[8];
-
-	read_weather_msg(h, buf);
-
-	// The ack should consist of just 0xa5.
-	for (i = 0; i < 8; i++)
-	{
-		debug_printf(2, "%x ", (buf[i] & 0xff));
-
-		if ((buf[i] & 0xff) != 0xa5)
-			return -1;
-	}
-
-	debug_printf(2, "\n");
-
-	return 0;
-}
-
-//
-// Writes 1 byte of data to the weather station.
-//
-int write_weather_1(struct usb_dev_handle *h, unsigned short addr, char data)
-{
-	char msg[8] = {0xa2, (addr >> 8), (addr & 0xff), 0x20, 0xa2, data, 0, 0x20};
-
-	send_usb_msgbuf(h, msg, 8);	
-
-	return read_weather_ack(h);
-}
-
-//
-// Writes 32 bytes of data to the weather station.
-//
-int write_weather_32(struct usb_dev_handle *h, unsigned short addr, char data[32])
-{
-	char msg[8] = {0xa0, (addr >> 8), (addr & 0xff), 0x20, 0xa0, 0, 0, 0x20};
-
-	send_usb_msgbuf(h, msg, 8);		// Send write command.
-	send_usb_msgbuf(h, data, 32);	// Send data.
-	
-	return read_weather_ack(h);
-}
-
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "wsp.h"
+#include "memory.h"
+#include "utils.h"
+#include "memcache.h"
+#include "metrics.h"
+
+//
+// Reads a weather message from a given address in history, going
+// through the memory cache.
+//
+int read_weather_address(wsp_device_t *dev, unsigned short addr, char buf[32])
+{
+	const char *p;
+	int ret;
+
+	if (dev->transport->map)
+	{
+		if (!(p = dev->transport->map(dev, addr)))
+		{
+			return -1;
+		}
+
+		memcpy(buf, p, 32);
+		return 0;
+	}
+
+	if (!memcache_lookup(dev->cache, addr, buf))
+	{
+		return 0;
+	}
+
+	if (!(ret = fetch_weather_address(dev, addr, buf)))
+	{
+		memcache_store(dev->cache, addr, buf);
+	}
+
+	return ret;
+}
+
+//
+// Reads a weather message from a given address in history, from the
+// weather station through its transport.
+//
+int fetch_weather_address(wsp_device_t *dev, unsigned short addr, char buf[32])
+{
+	int ret = dev->transport->read32(dev, addr, buf);
+
+	metrics_count(dev, METRIC_TRANSFERS, 1);
+
+	if (ret)
+	{
+		metrics_count(dev, METRIC_TRANSFER_ERRORS, 1);
+	}
+	else
+	{
+		metrics_count(dev, METRIC_BYTES_READ, 32);
+	}
+
+	return ret;
+}
+
+//
+// Reads 32 bytes from each of the given addresses from the weather station,
+// retrying each address in turn.
+//
+static int fetch_weather_addresses(wsp_device_t *dev, const unsigned short *addrs, unsigned int count, read_address_cb cb, void *arg)
+{
+	unsigned int i;
+	int trycount;
+	int status;
+	int failed = 0;
+	char buf[32];
+
+	for (i = 0; i < count; i++)
+	{
+		trycount = 0;
+		memset(buf, 0, sizeof(buf));
+
+		do
+		{
+			if (!(status = fetch_weather_address(dev, addrs[i], buf)))
+				break;
+
+			trycount++;
+
+			if (trycount < NUM_TRIES)
+			{
+				metrics_count(dev, METRIC_READ_RETRIES, 1);
+			}
+
+			fprintf(stderr, "Failed to read from weather memory offset %d (0x%x). Try %d of %d\n",
+					addrs[i], addrs[i], trycount, NUM_TRIES);
+		} while (trycount < NUM_TRIES);
+
+		print_bytes(2, buf, 32);
+
+		if (status)
+		{
+			failed++;
+		}
+
+		cb(addrs[i], buf, status, arg);
+	}
+
+	return failed;
+}
+
+typedef struct cached_read_s
+{
+	wsp_device_t *dev;
+	const unsigned short *addrs;
+	unsigned int count;
+	unsigned int next;				// The next address to pass on to the callback.
+	unsigned int *fetch_index;		// The index in addrs of each address fetched.
+	unsigned int fetched;			// The number of addresses fetched so far.
+	read_address_cb cb;
+	void *arg;
+} cached_read_t;
+
+//
+// Passes on the cached addresses up to the given index to the callback.
+//
+static void deliver_cached(cached_read_t *r, unsigned int end)
+{
+	char buf[32];
+
+	for (; r->next < end; r->next++)
+	{
+		memcache_lookup(r->dev->cache, r->addrs[r->next], buf);
+		r->cb(r->addrs[r->next], buf, 0, r->arg);
+	}
+}
+
+//
+// Stores a fetched address in the cache and passes it on to the callback,
+// after any cached addresses before it.
+//
+static void store_fetched(unsigned short addr, const char buf[32], int status, void *arg)
+{
+	cached_read_t *r = (cached_read_t *)arg;
+	unsigned int index = r->fetch_index[r->fetched++];
+
+	deliver_cached(r, index);
+
+	if (!status)
+	{
+		memcache_store(r->dev->cache, addr, buf);
+	}
+
+	r->cb(addr, buf, status, r->arg);
+	r->next = index + 1;
+}
+
+//
+// Passes each of the given addresses to the callback straight out of
+// the memory of a transport that can map it.
+//
+static int map_weather_addresses(wsp_device_t *dev, const unsigned short *addrs, unsigned int count, read_address_cb cb, void *arg)
+{
+	static const char empty[32];
+	const char *p;
+	unsigned int i;
+	int failed = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		if (!(p = dev->transport->map(dev, addrs[i])))
+		{
+			failed++;
+			cb(addrs[i], empty, -1, arg);
+			continue;
+		}
+
+		print_bytes(2, p, 32);
+		cb(addrs[i], p, 0, arg);
+	}
+
+	return failed;
+}
+
+//
+// Reads 32 bytes from each of the given addresses, calling the callback for
+// each one in order. Addresses in the memory cache are not read again.
+// If the transport can, the reads are pipelined, otherwise each address is
+// read and retried in turn. Mapped transports are read without copying.
+//
+// Returns the number of addresses that failed to be read.
+//
+int read_weather_addresses(wsp_device_t *dev, const unsigned short *addrs, unsigned int count, read_address_cb cb, void *arg)
+{
+	static const char empty[32];
+	cached_read_t r;
+	unsigned short *fetch_addrs;
+	unsigned int fetch_count = 0;
+	unsigned int i;
+	int failed;
+
+	if (dev->transport->map)
+	{
+		return map_weather_addresses(dev, addrs, count, cb, arg);
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.dev = dev;
+	r.addrs = addrs;
+	r.count = count;
+	r.cb = cb;
+	r.arg = arg;
+
+	fetch_addrs = (unsigned short *)malloc(max(count, 1) * sizeof(unsigned short));
+	r.fetch_index = (unsigned int *)malloc(max(count, 1) * sizeof(unsigned int));
+
+	if (!fetch_addrs || !r.fetch_index)
+	{
+		fprintf(stderr, "Out of memory\n");
+		free(fetch_addrs);
+		free(r.fetch_index);
+		return count;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (!memcache_contains(dev->cache, addrs[i]))
+		{
+			fetch_addrs[fetch_count] = addrs[i];
+			r.fetch_index[fetch_count] = i;
+			fetch_count++;
+		}
+	}
+
+	debug_printf(2, "Reading %u addresses, %u of them cached\n", count, count - fetch_count);
+
+	if (dev->transport->read_addresses)
+	{
+		failed = dev->transport->read_addresses(dev, fetch_addrs, fetch_count, store_fetched, &r);
+	}
+	else
+	{
+		failed = fetch_weather_addresses(dev, fetch_addrs, fetch_count, store_fetched, &r);
+	}
+
+	// The addresses a transport gave up on are passed on as failed.
+	while (r.fetched < fetch_count)
+	{
+		store_fetched(fetch_addrs[r.fetched], empty, -1, &r);
+	}
+
+	deliver_cached(&r, count);
+
+	free(fetch_addrs);
+	free(r.fetch_index);
+
+	return failed;
+}
+
+//
+// Checks a message read from the weather station after writing to it.
+//
+int check_weather_ack(const char buf[32])
+{
+	unsigned int i;
+
+	// The ack should consist of just 0xa5.
+	for (i = 0; i < 8; i++)
+	{
+		debug_printf(2, "%x ", (buf[i] & 0xff));
+
+		if ((buf[i] & 0xff) != 0xa5)
+			return -1;
+	}
+
+	debug_printf(2, "\n");
+
+	return 0;
+}
+
+//
+// Reads weather ack message when writing setting data.
+//
+int read_weather_ack(wsp_device_t *dev)
+{
+	return dev->transport->ack(dev);
+}
+
+//
+// Writes 1 byte of data to the weather station.
+//
+int write_weather_1(wsp_device_t *dev, unsigned short addr, char data)
+{
+	if (dev->transport->write1(dev, addr, data) || read_weather_ack(dev))
+	{
+		memcache_invalidate(dev->cache, addr, 1);
+		return -1;
+	}
+
+	memcache_update(dev->cache, addr, &data, 1);
+
+	return 0;
+}
+
+//
+// Writes 32 bytes of data to the weather station.
+//
+int write_weather_32(wsp_device_t *dev, unsigned short addr, char data[32])
+{
+	if (dev->transport->write32(dev, addr, data) || read_weather_ack(dev))
+	{
+		memcache_invalidate(dev->cache, addr, 32);
+		return -1;
+	}
+
+	memcache_update(dev->cache, addr, data, 32);
+
+	return 0;
+}
@@ -1,31 +1,34 @@
-//
-// Weather Station Poller
-//
-// Copyright (C) 2010 Joakim Sderberg
-//
-// This program is free software: you can redistribute it and/or modify
-// it under the terms of the GNU General Public License as published by
-// the Free Software Foundation, either version 3 of the License, or
-// (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-// GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program.  If not, see <http://www.gnu.org/licenses/>.
-//
-
-#ifndef __MEMORY_H__
-#define __MEMORY_H__
-
-int send_usb_msgbuf(struct usb_dev_handle *h, char *msg, int msgsize);
-int read_weather_msg(struct usb_dev_handle *h, char buf[32]);
-int read_weather_address(struct usb_dev_handle *h, unsigned short addr, char buf[32]);
-int read_weather_ack(struct usb_dev_handle *h);
-int write_weather_1(struct usb_dev_handle *h, unsigned short addr, char data);
-int write_weather_32(struct usb_dev_handle *h, unsigned short addr, char data[32]);
-
-#endif // __MEMORY_H__
-
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __MEMORY_H__
+#define __MEMORY_H__
+
+#include "transport.h"
+
+int read_weather_address(wsp_device_t *dev, unsigned short addr, char buf[32]);
+int fetch_weather_address(wsp_device_t *dev, unsigned short addr, char buf[32]);
+int read_weather_addresses(wsp_device_t *dev, const unsigned short *addrs, unsigned int count, read_address_cb cb, void *arg);
+int check_weather_ack(const char buf[32]);
+int read_weather_ack(wsp_device_t *dev);
+int write_weather_1(wsp_device_t *dev, unsigned short addr, char data);
+int write_weather_32(wsp_device_t *dev, unsigned short addr, char data[32]);
+
+#endif // __MEMORY_H__
+
@@ -0,0 +1,102 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Merges the history items read from several dump files into one history
+// ordered by time. Dumps taken some time apart overlap, and the items found
+// in more than one of them are only kept once.
+//
+// An item stays at the same address in the station memory until the
+// history wraps around, which takes days even at the shortest read period,
+// so the same item in two dumps has the same address. Its timestamp is only
+// known to within a minute, see BATCH_DUPLICATE_SECONDS. Matching on the
+// raw data alone isn't enough, as a steady reading gives identical items
+// one read period apart.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "wsp.h"
+#include "merge.h"
+
+//
+// The station date only has minute precision, and the item being written
+// when a dump is made only counts whole minutes, so the same history item
+// can get timestamps up to a minute apart in different dumps.
+//
+#define BATCH_DUPLICATE_SECONDS 60
+
+static int compare_records(const void *a, const void *b)
+{
+	const batch_record_t *ra = (const batch_record_t *)a;
+	const batch_record_t *rb = (const batch_record_t *)b;
+
+	if (ra->item.timestamp != rb->item.timestamp)
+		return (ra->item.timestamp < rb->item.timestamp) ? -1 : 1;
+
+	// Keep the order of the files and of the items within them.
+	if (ra->file != rb->file)
+		return (ra->file < rb->file) ? -1 : 1;
+
+	return (ra->position < rb->position) ? -1 : (ra->position > rb->position);
+}
+
+//
+// Checks if a history item has already been kept from an earlier dump.
+// The records before it are sorted by time and the duplicates removed.
+//
+static int is_duplicate(batch_record_t *records, unsigned int count, batch_record_t *r)
+{
+	unsigned int i;
+
+	for (i = count; (i > 0) && ((r->item.timestamp - records[i - 1].item.timestamp) <= BATCH_DUPLICATE_SECONDS); i--)
+	{
+		if ((records[i - 1].file != r->file)
+			&& (records[i - 1].item.address == r->item.address)
+			&& !memcmp(records[i - 1].item.raw_data, r->item.raw_data, HISTORY_CHUNK_SIZE))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+//
+// Sorts the records of all the dump files by time and removes the
+// duplicates in place. Returns the number of records kept.
+//
+unsigned int merge_records(batch_record_t *records, unsigned int count)
+{
+	unsigned int kept = 0;
+	unsigned int i;
+
+	qsort(records, count, sizeof(batch_record_t), compare_records);
+
+	for (i = 0; i < count; i++)
+	{
+		if (is_duplicate(records, kept, &records[i]))
+			continue;
+
+		records[kept++] = records[i];
+	}
+
+	return kept;
+}
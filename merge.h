@@ -0,0 +1,32 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __MERGE_H__
+#define __MERGE_H__
+
+typedef struct batch_record_s
+{
+	weather_item_t item;
+	unsigned int file;			// The index of the dump file the item was read from.
+	unsigned int position;		// The order of the item within the file.
+} batch_record_t;
+
+unsigned int merge_records(batch_record_t *records, unsigned int count);
+
+#endif // __MERGE_H__
@@ -0,0 +1,102 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Checks that merge_records() keeps each history item of two overlapping
+// dumps once. The station logs once a minute and the readings are steady,
+// so the items one read period apart are identical apart from their
+// address. The dates of the later dump are 50 seconds early, which puts
+// each of its items within a minute of the item before it in the first
+// dump.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wsp.h"
+#include "merge.h"
+
+#define TEST_START 1284381060
+
+// The items 0 to 19 are in the first dump, 10 to 29 in the second.
+#define TEST_ITEMS 30
+#define TEST_OVERLAP 10
+#define TEST_DUMP_ITEMS 20
+
+static void make_record(batch_record_t *r, unsigned int file, unsigned int position, unsigned int k, time_t skew)
+{
+	memset(r, 0, sizeof(batch_record_t));
+
+	// A steady reading, except for a rain tip now and then.
+	memset(r->item.raw_data, 0x10, HISTORY_CHUNK_SIZE);
+	r->item.raw_data[0] = 1;
+	r->item.raw_data[13] = (unsigned char)(k / 7);
+
+	r->item.address = (unsigned short)(HISTORY_START + k * HISTORY_CHUNK_SIZE);
+	r->item.timestamp = TEST_START + k * 60 + skew;
+	r->file = file;
+	r->position = position;
+}
+
+int main(int argc, char **argv)
+{
+	batch_record_t records[2 * TEST_DUMP_ITEMS];
+	unsigned int count = 0;
+	unsigned int kept;
+	unsigned int i;
+	int errors = 0;
+
+	for (i = 0; i < TEST_DUMP_ITEMS; i++)
+	{
+		make_record(&records[count++], 0, i, i, 0);
+	}
+
+	for (i = 0; i < TEST_DUMP_ITEMS; i++)
+	{
+		make_record(&records[count++], 1, i, TEST_OVERLAP + i, -50);
+	}
+
+	kept = merge_records(records, count);
+
+	if (kept != TEST_ITEMS)
+	{
+		fprintf(stderr, "Kept %u items, expected %u\n", kept, TEST_ITEMS);
+		errors++;
+	}
+
+	for (i = 0; (i < kept) && (i < TEST_ITEMS); i++)
+	{
+		unsigned short address = (unsigned short)(HISTORY_START + i * HISTORY_CHUNK_SIZE);
+
+		// The overlap is kept from the second dump, its dates are earlier.
+		unsigned int file = (i < TEST_OVERLAP) ? 0 : 1;
+
+		if ((records[i].item.address != address) || (records[i].file != file))
+		{
+			fprintf(stderr, "Item %u: address %u from dump %u, expected address %u from dump %u\n",
+					i, records[i].item.address, records[i].file, address, file);
+			errors++;
+		}
+	}
+
+	printf("two overlapping dumps: %s\n", errors ? "FAILED" : "ok");
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,400 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Counters and the latest values of each station, output in the
+// Prometheus text format. They're served at /metrics with --http, or
+// written to a file after each poll with --metrics-file, for the textfile
+// collector of the node exporter.
+//
+// The counters are kept from when the station was opened. The weather
+// values are those of the item the station was writing at the last poll.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wsp.h"
+#include "utils.h"
+#include "writer.h"
+#include "weather.h"
+#include "transport.h"
+#include "memcache.h"
+#include "metrics.h"
+
+typedef struct metric_info_s
+{
+	const char *name;
+	const char *help;
+} metric_info_t;
+
+static const metric_info_t counter_info[METRIC_COUNTER_COUNT] =
+{
+	{"wsp_transfers_total",				"Reads of 32 bytes sent to the station."},
+	{"wsp_transfer_errors_total",		"Reads from the station that failed."},
+	{"wsp_read_bytes_total",			"Bytes read from the station."},
+	{"wsp_read_retries_total",			"Failed reads that were tried again, when reading the history or dumping the memory."},
+	{"wsp_history_chunk_retries_total",	"History chunks that were read again."},
+	{"wsp_magic_number_failures_total",	"Settings blocks read with an incorrect magic number."},
+	{"wsp_polls_total",					"Times the station was read."},
+	{"wsp_poll_failures_total",			"Times reading the station failed."}
+};
+
+static const char *phase_names[PHASE_COUNT] =
+{
+	"settings",
+	"history",
+	"output"
+};
+
+//
+// The weather values output, from the current history item.
+//
+typedef struct metric_gauge_s
+{
+	const char *name;
+	const char *help;
+	int outdoor;				// Only valid when there's contact with the outdoor sensor.
+	float (*get)(const weather_item_t *item);
+} metric_gauge_t;
+
+static float gauge_in_temp(const weather_item_t *item)		{ return item_in_temp(item) * 0.1f; }
+static float gauge_out_temp(const weather_item_t *item)		{ return item_out_temp(item) * 0.1f; }
+static float gauge_in_humidity(const weather_item_t *item)	{ return item_in_humidity(item); }
+static float gauge_out_humidity(const weather_item_t *item)	{ return item_out_humidity(item); }
+static float gauge_abs_pressure(const weather_item_t *item)	{ return item_abs_pressure(item) * 0.1f; }
+static float gauge_wind_direction(const weather_item_t *item)	{ return item_wind_direction(item) * 22.5f; }
+static float gauge_rain_ticks(const weather_item_t *item)		{ return item_total_rain(item); }
+
+static const metric_gauge_t gauges[] =
+{
+	{"wsp_in_temp_celsius",			"Indoor temperature.",					0, gauge_in_temp},
+	{"wsp_in_humidity_percent",		"Indoor humidity.",						0, gauge_in_humidity},
+	{"wsp_out_temp_celsius",		"Outdoor temperature.",					1, gauge_out_temp},
+	{"wsp_out_humidity_percent",	"Outdoor humidity.",					1, gauge_out_humidity},
+	{"wsp_dewpoint_celsius",		"Outdoor dewpoint.",					1, calculate_dewpoint},
+	{"wsp_abs_pressure_hpa",		"Absolute air pressure.",				0, gauge_abs_pressure},
+	{"wsp_rel_pressure_hpa",		"Relative air pressure.",				1, calculate_rel_pressure},
+	{"wsp_avg_wind_mps",			"Average wind speed.",					1, convert_avg_windspeed},
+	{"wsp_gust_wind_mps",			"Wind gust speed.",						1, convert_gust_windspeed},
+	{"wsp_wind_direction_degrees",	"Wind direction.",						1, gauge_wind_direction},
+	{"wsp_rain_ticks",				"Rain counter, in ticks of 0.3 mm. Wraps at 65536.", 1, gauge_rain_ticks}
+};
+
+metrics_t *metrics_create()
+{
+	metrics_t *metrics;
+
+	if (!(metrics = (metrics_t *)calloc(1, sizeof(metrics_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+
+	mutex_init(&metrics->mutex);
+
+	return metrics;
+}
+
+void metrics_destroy(metrics_t *metrics)
+{
+	if (!metrics)
+		return;
+
+	mutex_destroy(&metrics->mutex);
+	free(metrics);
+}
+
+//
+// Adds to a counter of a station.
+//
+void metrics_count(wsp_device_t *dev, metric_counter_t counter, unsigned long n)
+{
+	metrics_t *metrics = dev->metrics;
+
+	if (!metrics)
+		return;
+
+	mutex_lock(&metrics->mutex);
+	metrics->counters[counter] += n;
+	mutex_unlock(&metrics->mutex);
+}
+
+//
+// Adds the time since start_ms, from get_milliseconds(), to a phase.
+//
+void metrics_phase(wsp_device_t *dev, metric_phase_t phase, unsigned long start_ms)
+{
+	metrics_t *metrics = dev->metrics;
+	unsigned long ms = get_milliseconds() - start_ms;
+
+	if (!metrics)
+		return;
+
+	mutex_lock(&metrics->mutex);
+	metrics->phase_ms[phase] += ms;
+	metrics->phase_count[phase]++;
+	metrics->phase_last_ms[phase] = ms;
+	mutex_unlock(&metrics->mutex);
+}
+
+//
+// Keeps the current history item after a successful poll.
+//
+void metrics_update(wsp_device_t *dev, weather_item_t *item)
+{
+	metrics_t *metrics = dev->metrics;
+
+	if (!metrics)
+		return;
+
+	mutex_lock(&metrics->mutex);
+	metrics->item = *item;
+	metrics->has_item = 1;
+	metrics->last_poll = time(NULL);
+	metrics->cache_hits = dev->cache->hits;
+	metrics->cache_misses = dev->cache->misses;
+	mutex_unlock(&metrics->mutex);
+}
+
+//
+// Outputs a label value, escaped.
+//
+static void print_label(writer_t *w, const char *label)
+{
+	const char *s;
+
+	writer_str(w, "{station=\"");
+
+	for (s = label; *s; s++)
+	{
+		switch (*s)
+		{
+			case '\\': writer_str(w, "\\\\"); break;
+			case '"': writer_str(w, "\\\""); break;
+			case '\n': writer_str(w, "\\n"); break;
+			default: writer_char(w, *s); break;
+		}
+	}
+
+	writer_char(w, '"');
+}
+
+static void print_header(writer_t *w, const char *name, const char *help, const char *type)
+{
+	writer_str(w, "# HELP ");
+	writer_str(w, name);
+	writer_char(w, ' ');
+	writer_str(w, help);
+	writer_str(w, "\n# TYPE ");
+	writer_str(w, name);
+	writer_char(w, ' ');
+	writer_str(w, type);
+	writer_char(w, '\n');
+}
+
+static void print_value(writer_t *w, const char *name, const char *label, const char *phase, unsigned long v)
+{
+	char buf[32];
+
+	writer_str(w, name);
+	print_label(w, label);
+
+	if (phase)
+	{
+		writer_str(w, ",phase=\"");
+		writer_str(w, phase);
+		writer_char(w, '"');
+	}
+
+	snprintf(buf, sizeof(buf), "} %lu\n", v);
+	writer_str(w, buf);
+}
+
+//
+// Outputs the phase times, which are kept in milliseconds, as seconds.
+//
+static void print_seconds(writer_t *w, const char *name, const char *label, const char *phase, unsigned long ms)
+{
+	char buf[48];
+
+	writer_str(w, name);
+	print_label(w, label);
+	writer_str(w, ",phase=\"");
+	writer_str(w, phase);
+	snprintf(buf, sizeof(buf), "\"} %lu.%03lu\n", ms / 1000, ms % 1000);
+	writer_str(w, buf);
+}
+
+//
+// Outputs the metrics of the given stations.
+//
+void print_metrics(writer_t *w, wsp_device_t **devs, unsigned int count)
+{
+	metrics_t snap[MAX_STATIONS];
+	const char *labels[MAX_STATIONS];
+	unsigned int n = 0;
+	unsigned int i;
+	unsigned int j;
+
+	// Copy the metrics, so each station's are from the same moment.
+	for (i = 0; (i < count) && (n < MAX_STATIONS); i++)
+	{
+		if (!devs[i] || !devs[i]->metrics)
+			continue;
+
+		mutex_lock(&devs[i]->metrics->mutex);
+		snap[n] = *devs[i]->metrics;
+		mutex_unlock(&devs[i]->metrics->mutex);
+		labels[n++] = devs[i]->label;
+	}
+
+	for (j = 0; j < METRIC_COUNTER_COUNT; j++)
+	{
+		print_header(w, counter_info[j].name, counter_info[j].help, "counter");
+
+		for (i = 0; i < n; i++)
+		{
+			print_value(w, counter_info[j].name, labels[i], NULL, snap[i].counters[j]);
+		}
+	}
+
+	print_header(w, "wsp_memcache_hits_total", "Reads answered from the memory cache, as of the last poll.", "counter");
+
+	for (i = 0; i < n; i++)
+	{
+		print_value(w, "wsp_memcache_hits_total", labels[i], NULL, snap[i].cache_hits);
+	}
+
+	print_header(w, "wsp_memcache_misses_total", "Reads not in the memory cache, as of the last poll.", "counter");
+
+	for (i = 0; i < n; i++)
+	{
+		print_value(w, "wsp_memcache_misses_total", labels[i], NULL, snap[i].cache_misses);
+	}
+
+	print_header(w, "wsp_phase_seconds", "Time spent in each phase of a poll.", "summary");
+
+	for (i = 0; i < n; i++)
+	{
+		for (j = 0; j < PHASE_COUNT; j++)
+		{
+			print_seconds(w, "wsp_phase_seconds_sum", labels[i], phase_names[j], snap[i].phase_ms[j]);
+			print_value(w, "wsp_phase_seconds_count", labels[i], phase_names[j], snap[i].phase_count[j]);
+		}
+	}
+
+	print_header(w, "wsp_phase_last_seconds", "Time spent in each phase of the last poll.", "gauge");
+
+	for (i = 0; i < n; i++)
+	{
+		for (j = 0; j < PHASE_COUNT; j++)
+		{
+			print_seconds(w, "wsp_phase_last_seconds", labels[i], phase_names[j], snap[i].phase_last_ms[j]);
+		}
+	}
+
+	print_header(w, "wsp_last_poll_timestamp_seconds", "When the station was last read.", "gauge");
+
+	for (i = 0; i < n; i++)
+	{
+		if (snap[i].has_item)
+		{
+			print_value(w, "wsp_last_poll_timestamp_seconds", labels[i], NULL, (unsigned long)snap[i].last_poll);
+		}
+	}
+
+	print_header(w, "wsp_sensor_contact", "1 if the station has contact with the outdoor sensor.", "gauge");
+
+	for (i = 0; i < n; i++)
+	{
+		if (snap[i].has_item)
+		{
+			print_value(w, "wsp_sensor_contact", labels[i], NULL, has_contact_with_sensor(&snap[i].item));
+		}
+	}
+
+	// Without contact the outdoor values are left out rather than made up.
+	for (j = 0; j < (sizeof(gauges) / sizeof(gauges[0])); j++)
+	{
+		print_header(w, gauges[j].name, gauges[j].help, "gauge");
+
+		for (i = 0; i < n; i++)
+		{
+			if (!snap[i].has_item || (gauges[j].outdoor && !has_contact_with_sensor(&snap[i].item)))
+				continue;
+
+			writer_str(w, gauges[j].name);
+			print_label(w, labels[i]);
+			writer_str(w, "} ");
+			writer_fixed(w, gauges[j].get(&snap[i].item), 1, 0);
+			writer_char(w, '\n');
+		}
+	}
+}
+
+//
+// Writes the metrics to a file. A temporary file is written first and
+// renamed, so the collector never reads a half written file.
+//
+int write_metrics_file(const char *path, wsp_device_t **devs, unsigned int count)
+{
+	char tmp_path[2048 + 8];
+	writer_t w;
+	FILE *f;
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))
+	{
+		fprintf(stderr, "The metrics file path \"%s\" is too long, at most %d characters.\n",
+				path, (int)sizeof(tmp_path) - 5);
+		return -1;
+	}
+
+	if (!(f = fopen(tmp_path, "w")))
+	{
+		fprintf(stderr, "Failed to open metrics file \"%s\". ", tmp_path);
+		perror(NULL);
+		return -1;
+	}
+
+	writer_init(&w, f);
+	print_metrics(&w, devs, count);
+	writer_free(&w);
+
+	if (fclose(f))
+	{
+		fprintf(stderr, "Failed to write metrics file \"%s\"\n", tmp_path);
+		return -1;
+	}
+
+	#ifdef WIN32
+	// Rename doesn't replace existing files on Windows.
+	remove(path);
+	#endif
+
+	if (rename(tmp_path, path))
+	{
+		fprintf(stderr, "Failed to replace metrics file \"%s\". ", path);
+		perror(NULL);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,77 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "thread.h"
+
+struct writer_s;
+
+//
+// The counters kept for each station.
+//
+typedef enum metric_counter_e
+{
+	METRIC_TRANSFERS,			// Reads of 32 bytes sent to the station.
+	METRIC_TRANSFER_ERRORS,		// Reads that failed.
+	METRIC_BYTES_READ,
+	METRIC_READ_RETRIES,		// Failed reads that were tried again.
+	METRIC_CHUNK_RETRIES,		// Tries again in get_history_chunk().
+	METRIC_MAGIC_FAILURES,		// Settings blocks read with an incorrect magic number.
+	METRIC_POLLS,
+	METRIC_POLL_FAILURES,
+	METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+//
+// The parts of a poll that are timed.
+//
+typedef enum metric_phase_e
+{
+	PHASE_SETTINGS,				// Reading the settings block.
+	PHASE_HISTORY,				// Reading and decoding the history.
+	PHASE_OUTPUT,				// Formatting and writing the output.
+	PHASE_COUNT
+} metric_phase_t;
+
+typedef struct metrics_s
+{
+	wsp_mutex_t mutex;			// The counters are read from other threads, see http.c.
+	unsigned long counters[METRIC_COUNTER_COUNT];
+	unsigned long phase_ms[PHASE_COUNT];		// The total time spent in each phase.
+	unsigned long phase_count[PHASE_COUNT];
+	unsigned long phase_last_ms[PHASE_COUNT];
+	unsigned int cache_hits;
+	unsigned int cache_misses;
+	time_t last_poll;			// When the station was last read successfully.
+	int has_item;
+	weather_item_t item;		// The current history item at the last poll.
+} metrics_t;
+
+metrics_t *metrics_create();
+void metrics_destroy(metrics_t *metrics);
+void metrics_count(wsp_device_t *dev, metric_counter_t counter, unsigned long n);
+void metrics_phase(wsp_device_t *dev, metric_phase_t phase, unsigned long start_ms);
+void metrics_update(wsp_device_t *dev, weather_item_t *item);
+void print_metrics(struct writer_s *w, wsp_device_t **devs, unsigned int count);
+int write_metrics_file(const char *path, wsp_device_t **devs, unsigned int count);
+
+#endif // __METRICS_H__
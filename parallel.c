@@ -0,0 +1,224 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Formats a range of history items on several threads. The range is split
+// into chunks that are each formatted into memory, and written to the
+// output in order as soon as they're done, so the output is the same as
+// formatting the items one by one.
+//
+// The formatting only reads the history, once the rain index is built.
+// The rain windows of a chunk start at the first item read, like they would
+// if the items before it had been output by the same thread.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wsp.h"
+#include "utils.h"
+#include "writer.h"
+#include "output.h"
+#include "json.h"
+#include "weather.h"
+#include "thread.h"
+#include "parallel.h"
+
+//
+// The number of items formatted by a thread at a time. Smaller ranges
+// aren't worth starting threads for.
+//
+#define PARALLEL_CHUNK_ITEMS 512
+
+typedef struct history_chunk_s
+{
+	unsigned int first;
+	unsigned int end;
+	writer_t w;					// The formatted items, in memory.
+	int done;
+} history_chunk_t;
+
+typedef struct history_job_s
+{
+	history_output_t output;
+	wsp_device_t *dev;
+	weather_settings_t *ws;
+	weather_history_t *history;
+	unsigned int first;
+	const format_t *fmt;
+	history_chunk_t *chunks;
+	unsigned int count;
+	unsigned int next;			// The next chunk to be formatted by a thread.
+	wsp_mutex_t mutex;
+	wsp_cond_t done;
+} history_job_t;
+
+//
+// Formats the items from first up to end in the given format.
+//
+static void print_history_range(writer_t *w, history_output_t output, wsp_device_t *dev, weather_settings_t *ws,
+								weather_history_t *history, unsigned int first, unsigned int end, const format_t *fmt)
+{
+	rain_windows_t rain;
+	unsigned int i;
+
+	if (output == easyweather_output)
+	{
+		init_rain_windows(&rain, history, ws);
+	}
+
+	for (i = first; i < end; i++)
+	{
+		switch (output)
+		{
+			case easyweather_output:
+				print_history_item(w, history, i, &rain);
+				break;
+			case formatted_output:
+				print_history_item_formatstring(w, dev, ws, history, i, fmt);
+				break;
+			case json_output:
+				print_json_item(w, dev, ws, history, i);
+				break;
+		}
+	}
+}
+
+static void history_worker(void *arg)
+{
+	history_job_t *job = (history_job_t *)arg;
+	history_chunk_t *chunk;
+	unsigned int index;
+
+	while (1)
+	{
+		mutex_lock(&job->mutex);
+		index = job->next++;
+		mutex_unlock(&job->mutex);
+
+		if (index >= job->count)
+			break;
+
+		chunk = &job->chunks[index];
+		print_history_range(&chunk->w, job->output, job->dev, job->ws, job->history, chunk->first, chunk->end, job->fmt);
+
+		mutex_lock(&job->mutex);
+		chunk->done = 1;
+		cond_broadcast(&job->done);
+		mutex_unlock(&job->mutex);
+	}
+}
+
+//
+// Outputs the history items from first up to end, formatting them on
+// --threads threads. Small ranges, and quick rain which reads from the
+// station, are formatted on this thread.
+//
+void print_history_parallel(writer_t *w, history_output_t output, wsp_device_t *dev, weather_settings_t *ws,
+							weather_history_t *history, unsigned int first, unsigned int end, const format_t *fmt)
+{
+	history_job_t job;
+	wsp_thread_t *threads = NULL;
+	unsigned int thread_count;
+	unsigned int started = 0;
+	unsigned int i;
+
+	if ((end <= first)
+	|| ((end - first) <= PARALLEL_CHUNK_ITEMS)
+	|| (program_settings.threads <= 1)
+	|| program_settings.quickrain
+	|| prepare_rain_index(history))
+	{
+		print_history_range(w, output, dev, ws, history, first, end, fmt);
+		return;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.output = output;
+	job.dev = dev;
+	job.ws = ws;
+	job.history = history;
+	job.fmt = fmt;
+	job.count = (end - first + PARALLEL_CHUNK_ITEMS - 1) / PARALLEL_CHUNK_ITEMS;
+
+	if (!(job.chunks = (history_chunk_t *)calloc(job.count, sizeof(history_chunk_t))))
+	{
+		print_history_range(w, output, dev, ws, history, first, end, fmt);
+		return;
+	}
+
+	for (i = 0; i < job.count; i++)
+	{
+		job.chunks[i].first = first + i * PARALLEL_CHUNK_ITEMS;
+		job.chunks[i].end = min(job.chunks[i].first + PARALLEL_CHUNK_ITEMS, end);
+		writer_init(&job.chunks[i].w, NULL);
+	}
+
+	mutex_init(&job.mutex);
+	cond_init(&job.done);
+
+	thread_count = min(program_settings.threads, job.count);
+
+	if ((threads = (wsp_thread_t *)malloc(thread_count * sizeof(wsp_thread_t))))
+	{
+		for (started = 0; started < thread_count; started++)
+		{
+			if (thread_create(&threads[started], history_worker, &job))
+			{
+				fprintf(stderr, "Failed to start a thread\n");
+				break;
+			}
+		}
+	}
+
+	// Format everything here if no threads could be started.
+	if (!started)
+	{
+		history_worker(&job);
+	}
+
+	// Output the chunks in order, while the later ones are being formatted.
+	for (i = 0; i < job.count; i++)
+	{
+		history_chunk_t *chunk = &job.chunks[i];
+
+		mutex_lock(&job.mutex);
+
+		while (!chunk->done)
+		{
+			cond_wait(&job.done, &job.mutex);
+		}
+
+		mutex_unlock(&job.mutex);
+
+		writer_bytes(w, chunk->w.data, chunk->w.len);
+		writer_free(&chunk->w);
+	}
+
+	for (i = 0; i < started; i++)
+	{
+		thread_join(threads[i]);
+	}
+
+	free(threads);
+	free(job.chunks);
+	cond_destroy(&job.done);
+	mutex_destroy(&job.mutex);
+}
@@ -0,0 +1,27 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+void print_history_parallel(writer_t *w, history_output_t output, wsp_device_t *dev, weather_settings_t *ws,
+							weather_history_t *history, unsigned int first, unsigned int end, const format_t *fmt);
+
+#endif // __PARALLEL_H__
@@ -0,0 +1,656 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Publishes the history to subscribers as it is recorded, for --publish.
+// The station is polled like in daemon mode, and when the current position
+// in the settings block has moved on the finished records are sent to every
+// subscriber connected to the Unix socket, one JSON Lines object each, see
+// json.c. The item the station is writing to is sent as a "current" object
+// whenever it has changed since the last poll, and to new subscribers as
+// soon as they connect.
+//
+// The sockets are served by an epoll event loop on a thread of its own, so
+// a slow subscriber never holds up the polling. Each subscriber has a
+// buffer of --publish-buffer bytes, and when that is full its policy
+// decides what happens to the records that don't fit:
+//
+//   drop			The records are skipped. A "dropped" object with the
+//					number skipped is sent before the next record that fits.
+//   disconnect		The subscriber is disconnected.
+//   block			The poll waits until the subscriber has read enough.
+//
+// The policy is set with --publish-policy, and a subscriber can change its
+// own by sending "drop", "disconnect" or "block" on a line of its own.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "wsp.h"
+#include "utils.h"
+#include "writer.h"
+#include "weather.h"
+#include "transport.h"
+#include "json.h"
+#include "thread.h"
+#include "unixsock.h"
+#include "publish.h"
+
+// How long the event loop waits before checking if it should stop.
+#define PUBLISH_TIMEOUT_MS 1000
+
+extern volatile sig_atomic_t stop_polling;
+
+typedef struct publish_subscriber_s
+{
+	int fd;
+	publish_policy_t policy;
+	char *buf;					// The records not sent yet, starting at start.
+	size_t start;
+	size_t len;
+	unsigned long dropped;		// The records skipped since the last one sent.
+	int closed;					// Disconnected, freed by the event loop.
+	int writing;				// Waiting for the socket to be writable.
+	char command[PUBLISH_COMMAND_SIZE];
+	size_t command_len;
+} publish_subscriber_t;
+
+//
+// Everything here is guarded by the mutex, which the polling thread takes
+// to hand over records and the event loop takes to send them.
+//
+typedef struct publisher_s
+{
+	wsp_mutex_t mutex;
+	wsp_cond_t room;			// Signalled when subscribers have sent some of their buffers.
+	wsp_thread_t thread;
+	publish_subscriber_t *subs[PUBLISH_MAX_SUBSCRIBERS];
+	unsigned int count;
+	char *current;				// The last current item sent, for new subscribers.
+	size_t current_len;
+	int waiting;				// The poll is waiting for a blocking subscriber.
+	int stop;
+	int started;
+	wsp_device_t *dev;
+	int server;
+	int epoll;
+	int wake;					// An eventfd the polling thread wakes the event loop with.
+	char path[2048];
+} publisher_t;
+
+static publisher_t pub;
+
+static int set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	return (flags < 0) ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void wake_event_loop()
+{
+	uint64_t one = 1;
+
+	if (write(pub.wake, &one, sizeof(one)) < 0)
+	{
+		// The counter is already set, so the loop wakes anyway.
+	}
+}
+
+//
+// Disconnects a subscriber. It is freed later by the event loop, since the
+// polling thread may be waiting for it.
+//
+static void close_subscriber(publish_subscriber_t *s)
+{
+	if (s->closed)
+	{
+		return;
+	}
+
+	debug_printf(1, "Subscriber %d disconnected\n", s->fd);
+
+	epoll_ctl(pub.epoll, EPOLL_CTL_DEL, s->fd, NULL);
+	close(s->fd);
+	s->closed = 1;
+}
+
+static int has_room(publish_subscriber_t *s, size_t len)
+{
+	return (s->len + len) <= program_settings.publish_buffer;
+}
+
+static void append(publish_subscriber_t *s, const char *data, size_t len)
+{
+	if ((s->start + s->len + len) > program_settings.publish_buffer)
+	{
+		memmove(s->buf, s->buf + s->start, s->len);
+		s->start = 0;
+	}
+
+	memcpy(s->buf + s->start + s->len, data, len);
+	s->len += len;
+}
+
+//
+// Tells a subscriber how many records it missed, if it has room for that
+// and the record after it.
+//
+static void append_dropped(publish_subscriber_t *s, size_t len)
+{
+	writer_t w;
+
+	writer_init(&w, NULL);
+	writer_str(&w, "{\"type\":\"dropped\",\"station\":");
+	writer_json_string(&w, pub.dev->label);
+	writer_str(&w, ",\"count\":");
+	writer_uint(&w, (unsigned int)s->dropped, 0, ' ');
+	writer_str(&w, "}\n");
+
+	if (has_room(s, w.len + len))
+	{
+		append(s, w.data, w.len);
+		s->dropped = 0;
+	}
+
+	writer_free(&w);
+}
+
+//
+// Sends what the socket of a subscriber takes without blocking, and only
+// asks to be told when it's writable while something is left.
+//
+static void send_buffered(publish_subscriber_t *s)
+{
+	struct epoll_event ev;
+	ssize_t sent;
+	int writing;
+
+	while (s->len > 0)
+	{
+		if ((sent = send(s->fd, s->buf + s->start, s->len, MSG_NOSIGNAL)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+
+			close_subscriber(s);
+			return;
+		}
+
+		s->start += sent;
+		s->len -= sent;
+	}
+
+	if (s->len == 0)
+	{
+		s->start = 0;
+	}
+
+	writing = (s->len > 0);
+
+	if (writing != s->writing)
+	{
+		ev.events = EPOLLIN | (writing ? EPOLLOUT : 0);
+		ev.data.ptr = s;
+		epoll_ctl(pub.epoll, EPOLL_CTL_MOD, s->fd, &ev);
+		s->writing = writing;
+	}
+}
+
+//
+// Adds a record to the buffer of every subscriber, or does what their
+// policy says if it doesn't fit. The mutex is held.
+//
+static void deliver(const char *data, size_t len)
+{
+	publish_subscriber_t *s;
+	unsigned int i;
+
+	// New subscribers are only added to the end while waiting, and the
+	// closed ones are not freed, so the indices stay the same.
+	for (i = 0; i < pub.count; i++)
+	{
+		s = pub.subs[i];
+
+		// Whatever the socket takes right away makes room.
+		if (!s->closed && !has_room(s, len))
+		{
+			send_buffered(s);
+		}
+
+		while ((s->policy == publish_block) && !s->closed && !pub.stop && !stop_polling
+			&& (len <= program_settings.publish_buffer) && !has_room(s, len))
+		{
+			pub.waiting++;
+			wake_event_loop();
+			cond_wait(&pub.room, &pub.mutex);
+			pub.waiting--;
+		}
+
+		if (s->closed)
+		{
+			continue;
+		}
+
+		if (s->dropped)
+		{
+			append_dropped(s, len);
+		}
+
+		if (!s->dropped && has_room(s, len))
+		{
+			append(s, data, len);
+		}
+		else if (s->policy == publish_disconnect)
+		{
+			debug_printf(1, "Subscriber %d fell behind\n", s->fd);
+			close_subscriber(s);
+		}
+		else
+		{
+			s->dropped++;
+		}
+	}
+}
+
+static void run_command(publish_subscriber_t *s)
+{
+	s->command[s->command_len] = '\0';
+
+	if (!strcmp(s->command, "drop"))
+	{
+		s->policy = publish_drop;
+	}
+	else if (!strcmp(s->command, "disconnect"))
+	{
+		s->policy = publish_disconnect;
+	}
+	else if (!strcmp(s->command, "block"))
+	{
+		s->policy = publish_block;
+	}
+	else
+	{
+		debug_printf(1, "Subscriber %d sent an unknown command \"%s\"\n", s->fd, s->command);
+		return;
+	}
+
+	debug_printf(1, "Subscriber %d set the policy %s\n", s->fd, s->command);
+}
+
+//
+// Reads the commands a subscriber has sent, one per line.
+//
+static void receive_commands(publish_subscriber_t *s)
+{
+	char buf[256];
+	ssize_t got;
+	ssize_t i;
+
+	for (;;)
+	{
+		if ((got = recv(s->fd, buf, sizeof(buf), 0)) <= 0)
+		{
+			if ((got < 0) && (errno == EINTR))
+				continue;
+
+			if ((got < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+				return;
+
+			close_subscriber(s);
+			return;
+		}
+
+		for (i = 0; i < got; i++)
+		{
+			if (buf[i] == '\n')
+			{
+				run_command(s);
+				s->command_len = 0;
+			}
+			else if ((buf[i] != '\r') && (s->command_len < (PUBLISH_COMMAND_SIZE - 1)))
+			{
+				s->command[s->command_len++] = buf[i];
+			}
+		}
+	}
+}
+
+static void accept_subscribers()
+{
+	struct epoll_event ev;
+	publish_subscriber_t *s;
+	int fd;
+
+	while ((fd = accept(pub.server, NULL, NULL)) >= 0)
+	{
+		if (pub.count >= PUBLISH_MAX_SUBSCRIBERS)
+		{
+			fprintf(stderr, "Too many subscribers, at most %d can connect.\n", PUBLISH_MAX_SUBSCRIBERS);
+			close(fd);
+			continue;
+		}
+
+		if (!(s = (publish_subscriber_t *)calloc(1, sizeof(publish_subscriber_t)))
+			|| !(s->buf = (char *)malloc(program_settings.publish_buffer)))
+		{
+			fprintf(stderr, "Out of memory\n");
+			free(s);
+			close(fd);
+			continue;
+		}
+
+		s->fd = fd;
+		s->policy = program_settings.publish_policy;
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = s;
+
+		if (set_nonblocking(fd) || epoll_ctl(pub.epoll, EPOLL_CTL_ADD, fd, &ev))
+		{
+			perror("Failed to add a subscriber. ");
+			free(s->buf);
+			free(s);
+			close(fd);
+			continue;
+		}
+
+		debug_printf(1, "Subscriber %d connected\n", fd);
+
+		// Don't make it wait for the current item to change.
+		if (pub.current)
+		{
+			append(s, pub.current, pub.current_len);
+		}
+
+		pub.subs[pub.count++] = s;
+	}
+}
+
+//
+// Frees the subscribers that have been disconnected, unless the polling
+// thread is waiting for one of them.
+//
+static void free_closed_subscribers()
+{
+	unsigned int i;
+
+	if (pub.waiting)
+	{
+		return;
+	}
+
+	for (i = 0; i < pub.count; i++)
+	{
+		if (pub.subs[i]->closed)
+		{
+			free(pub.subs[i]->buf);
+			free(pub.subs[i]);
+			pub.subs[i--] = pub.subs[--pub.count];
+		}
+	}
+}
+
+static void publisher_main(void *arg)
+{
+	struct epoll_event events[PUBLISH_MAX_SUBSCRIBERS + 2];
+	publish_subscriber_t *s;
+	uint64_t count;
+	unsigned int i;
+	int n;
+
+	for (;;)
+	{
+		if ((n = epoll_wait(pub.epoll, events, PUBLISH_MAX_SUBSCRIBERS + 2, PUBLISH_TIMEOUT_MS)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			perror("Publisher epoll_wait failed. ");
+			break;
+		}
+
+		mutex_lock(&pub.mutex);
+
+		if (pub.stop)
+		{
+			mutex_unlock(&pub.mutex);
+			break;
+		}
+
+		for (i = 0; i < (unsigned int)n; i++)
+		{
+			if (events[i].data.ptr == &pub.server)
+			{
+				accept_subscribers();
+			}
+			else if (events[i].data.ptr == &pub.wake)
+			{
+				if (read(pub.wake, &count, sizeof(count)) < 0)
+				{
+					// Already reset by an earlier wake up.
+				}
+			}
+			else
+			{
+				s = (publish_subscriber_t *)events[i].data.ptr;
+
+				if (!s->closed && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+				{
+					receive_commands(s);
+				}
+			}
+		}
+
+		for (i = 0; i < pub.count; i++)
+		{
+			if (!pub.subs[i]->closed)
+			{
+				send_buffered(pub.subs[i]);
+			}
+		}
+
+		free_closed_subscribers();
+		cond_broadcast(&pub.room);
+		mutex_unlock(&pub.mutex);
+	}
+}
+
+//
+// Starts listening for subscribers on the Unix socket at path.
+//
+int start_publisher(wsp_device_t *dev, const char *path)
+{
+	struct epoll_event ev;
+
+	snprintf(pub.path, sizeof(pub.path), "%s", path);
+	pub.dev = dev;
+	pub.epoll = -1;
+	pub.wake = -1;
+
+	if ((pub.server = listen_socket(path, "publisher")) < 0)
+	{
+		return -1;
+	}
+
+	if (set_nonblocking(pub.server)
+		|| ((pub.epoll = epoll_create1(0)) < 0)
+		|| ((pub.wake = eventfd(0, EFD_NONBLOCK)) < 0))
+	{
+		perror("Failed to set up the publisher. ");
+		goto fail;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &pub.server;
+
+	if (epoll_ctl(pub.epoll, EPOLL_CTL_ADD, pub.server, &ev))
+	{
+		perror("Failed to set up the publisher. ");
+		goto fail;
+	}
+
+	ev.data.ptr = &pub.wake;
+
+	if (epoll_ctl(pub.epoll, EPOLL_CTL_ADD, pub.wake, &ev))
+	{
+		perror("Failed to set up the publisher. ");
+		goto fail;
+	}
+
+	mutex_init(&pub.mutex);
+	cond_init(&pub.room);
+	pub.stop = 0;
+
+	if (thread_create(&pub.thread, publisher_main, NULL))
+	{
+		fprintf(stderr, "Failed to start the publisher thread\n");
+		cond_destroy(&pub.room);
+		mutex_destroy(&pub.mutex);
+		goto fail;
+	}
+
+	pub.started = 1;
+	debug_printf(1, "Publishing \"%s\" on \"%s\"\n", dev->path, path);
+
+	return 0;
+
+fail:
+	if (pub.wake >= 0)
+	{
+		close(pub.wake);
+		pub.wake = -1;
+	}
+
+	if (pub.epoll >= 0)
+	{
+		close(pub.epoll);
+		pub.epoll = -1;
+	}
+
+	close(pub.server);
+	pub.server = -1;
+	unlink(path);
+
+	return -1;
+}
+
+//
+// Hands the records finished since the last poll to the subscribers, and
+// the current item if it has changed. Called after each poll.
+//
+void publish_weather_data(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int first, unsigned int end)
+{
+	writer_t w;
+	unsigned int i;
+
+	if (!pub.started)
+	{
+		return;
+	}
+
+	for (i = first; i < end; i++)
+	{
+		writer_init(&w, NULL);
+		print_json_item(&w, dev, ws, history, i);
+
+		mutex_lock(&pub.mutex);
+		deliver(w.data, w.len);
+		mutex_unlock(&pub.mutex);
+
+		writer_free(&w);
+	}
+
+	writer_init(&w, NULL);
+	print_json_current(&w, dev, ws, history, HISTORY_MAX - 1);
+
+	mutex_lock(&pub.mutex);
+
+	if (!pub.current || (pub.current_len != w.len) || memcmp(pub.current, w.data, w.len))
+	{
+		deliver(w.data, w.len);
+
+		free(pub.current);
+
+		if ((pub.current = (char *)malloc(w.len)))
+		{
+			memcpy(pub.current, w.data, w.len);
+			pub.current_len = w.len;
+		}
+	}
+
+	mutex_unlock(&pub.mutex);
+	writer_free(&w);
+
+	wake_event_loop();
+}
+
+//
+// Disconnects the subscribers and removes the socket.
+//
+void stop_publisher()
+{
+	unsigned int i;
+
+	if (!pub.started)
+	{
+		return;
+	}
+
+	mutex_lock(&pub.mutex);
+	pub.stop = 1;
+	cond_broadcast(&pub.room);
+	mutex_unlock(&pub.mutex);
+
+	wake_event_loop();
+	thread_join(pub.thread);
+
+	for (i = 0; i < pub.count; i++)
+	{
+		close_subscriber(pub.subs[i]);
+		free(pub.subs[i]->buf);
+		free(pub.subs[i]);
+	}
+
+	pub.count = 0;
+	free(pub.current);
+	pub.current = NULL;
+
+	close(pub.wake);
+	close(pub.epoll);
+	close(pub.server);
+	unlink(pub.path);
+	pub.started = 0;
+
+	cond_destroy(&pub.room);
+	mutex_destroy(&pub.mutex);
+}
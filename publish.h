@@ -0,0 +1,31 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __PUBLISH_H__
+#define __PUBLISH_H__
+
+#define PUBLISH_MAX_SUBSCRIBERS 64
+#define PUBLISH_COMMAND_SIZE 64
+
+int start_publisher(wsp_device_t *dev, const char *path);
+void publish_weather_data(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int first, unsigned int end);
+void stop_publisher();
+
+#endif // __PUBLISH_H__
@@ -0,0 +1,288 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// A simulated weather station serving a memory dump made with --dumpmem.
+// Each transfer takes a configurable time and can fail at random, and the
+// station keeps writing history as time passes, moving the current
+// position and data count forward like a real station would.
+// This makes it possible to try different ways of polling without
+// having a station connected.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "wsp.h"
+#include "utils.h"
+#include "memory.h"
+#include "memcache.h"
+
+typedef struct sim_station_s
+{
+	unsigned char memory[MEMORY_SIZE];
+	bcd_date_t start_date;			// The station date when the simulation started.
+	unsigned long start_ms;			// The clock when the simulation started.
+	unsigned int minutes;			// Simulated minutes passed.
+	unsigned int record_minutes;	// Simulated minutes when the current item was started.
+	unsigned int random;			// State of the random generator.
+	unsigned int transfers;
+	unsigned int failures;
+} sim_station_t;
+
+//
+// Gets a pseudo random number from 0 to 32767. The simulator has its own
+// fixed seed so that runs can be repeated.
+//
+static unsigned int sim_random(sim_station_t *sim)
+{
+	sim->random = sim->random * 1103515245 + 12345;
+	return (sim->random >> 16) & 0x7fff;
+}
+
+static unsigned short sim_get_short(sim_station_t *sim, unsigned int addr)
+{
+	return sim->memory[addr] | (sim->memory[addr + 1] << 8);
+}
+
+static void sim_set_short(sim_station_t *sim, unsigned int addr, unsigned short value)
+{
+	sim->memory[addr] = value & 0xff;
+	sim->memory[addr + 1] = (value >> 8) & 0xff;
+}
+
+//
+// Sets the station date to the given number of minutes after the start.
+//
+static void sim_set_datetime(sim_station_t *sim, unsigned int minutes)
+{
+	struct tm timeinfo;
+
+	memset(&timeinfo, 0, sizeof(timeinfo));
+	timeinfo.tm_year	= sim->start_date.year - 1900;
+	timeinfo.tm_mon		= sim->start_date.month - 1;
+	timeinfo.tm_mday	= sim->start_date.day;
+	timeinfo.tm_hour	= sim->start_date.hour;
+	timeinfo.tm_min		= sim->start_date.minute + minutes;
+	timeinfo.tm_isdst	= -1;
+
+	unix_to_bcd_date(mktime(&timeinfo), &sim->memory[43]);
+}
+
+//
+// Finishes the history item being written and starts a new one, the
+// same way the station does each read period.
+//
+static void sim_write_history(sim_station_t *sim)
+{
+	unsigned int current_pos = sim_get_short(sim, 30);
+	unsigned int data_count = sim_get_short(sim, 27);
+	unsigned int next_pos = current_pos + HISTORY_CHUNK_SIZE;
+
+	if ((current_pos < HISTORY_START) || (current_pos >= HISTORY_END))
+	{
+		// Not a valid position, start over at the beginning of the history.
+		memset(&sim->memory[HISTORY_START], 0, HISTORY_CHUNK_SIZE);
+		sim_set_short(sim, 30, HISTORY_START);
+		sim_set_short(sim, 27, 1);
+		return;
+	}
+
+	if (next_pos >= HISTORY_END)
+	{
+		next_pos = HISTORY_START;
+	}
+
+	// The finished item keeps the minutes since the previous one, and the
+	// new item starts out with the same readings.
+	sim->memory[current_pos] = sim->memory[16];
+	memcpy(&sim->memory[next_pos], &sim->memory[current_pos], HISTORY_CHUNK_SIZE);
+	sim->memory[next_pos] = 0;
+
+	sim_set_short(sim, 30, (unsigned short)next_pos);
+	sim_set_short(sim, 27, (unsigned short)min(data_count + 1, HISTORY_MAX));
+}
+
+//
+// Moves the simulated time forward to match the clock.
+//
+static void sim_advance(sim_station_t *sim)
+{
+	unsigned int minutes = (unsigned int)((get_milliseconds() - sim->start_ms) * program_settings.sim_speed / 60000.0);
+	unsigned int read_period;
+
+	if (minutes == sim->minutes)
+		return;
+
+	sim->minutes = minutes;
+	sim_set_datetime(sim, minutes);
+
+	// The read period can be changed while the simulation runs.
+	read_period = max(sim->memory[16], 1);
+
+	while ((minutes - sim->record_minutes) >= read_period)
+	{
+		sim->record_minutes += read_period;
+		sim_write_history(sim);
+	}
+
+	// The item being written keeps track of the time since it was started.
+	sim->memory[sim_get_short(sim, 30)] = (unsigned char)(minutes - sim->record_minutes);
+}
+
+//
+// Waits for the time a transfer takes. Returns non-zero if it should fail.
+//
+static int sim_transfer(sim_station_t *sim)
+{
+	unsigned int delay = program_settings.sim_latency;
+
+	sim->transfers++;
+
+	if (program_settings.sim_jitter > 0)
+	{
+		delay += sim_random(sim) % (program_settings.sim_jitter + 1);
+	}
+
+	if (delay > 0)
+	{
+		sleep_milliseconds(delay);
+	}
+
+	sim_advance(sim);
+
+	if ((program_settings.sim_failrate > 0.0f)
+	&& ((sim_random(sim) / 32768.0f) < (program_settings.sim_failrate / 100.0f)))
+	{
+		sim->failures++;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sim_transport_open(wsp_device_t *dev)
+{
+	sim_station_t *sim;
+	FILE *f;
+
+	if (!(sim = (sim_station_t *)calloc(1, sizeof(sim_station_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	// Each simulated station can be given its own dump file.
+	if (!*dev->path
+	&& (snprintf(dev->path, sizeof(dev->path), "%s", program_settings.simfile) >= (int)sizeof(dev->path)))
+	{
+		fprintf(stderr, "The path \"%s\" is too long, at most %d characters.\n",
+				program_settings.simfile, STATION_PATH_LEN - 1);
+		free(sim);
+		return -1;
+	}
+
+	if (!(f = fopen(dev->path, "rb")))
+	{
+		fprintf(stderr, "Failed to open file \"%s\". ", dev->path);
+		perror(NULL);
+		free(sim);
+		return -1;
+	}
+
+	// Dumps don't include the last 32 bytes of the memory.
+	debug_printf(1, "Simulating a weather station with %u bytes from \"%s\"\n",
+				(unsigned int)fread(sim->memory, 1, sizeof(sim->memory), f), dev->path);
+
+	fclose(f);
+
+	sim->start_date = parse_bcd_date(&sim->memory[43]);
+	sim->start_ms = get_milliseconds();
+	sim->random = 1;
+
+	dev->data = sim;
+
+	return 0;
+}
+
+static void sim_transport_close(wsp_device_t *dev)
+{
+	sim_station_t *sim = (sim_station_t *)dev->data;
+
+	debug_printf(1, "Simulated %u transfers, %u failed, %u minutes passed\n",
+				sim->transfers, sim->failures, sim->minutes);
+
+	free(sim);
+}
+
+static int sim_transport_read32(wsp_device_t *dev, unsigned short addr, char buf[32])
+{
+	sim_station_t *sim = (sim_station_t *)dev->data;
+
+	if (sim_transfer(sim))
+		return -1;
+
+	memcpy(buf, &sim->memory[addr], min(32, MEMORY_SIZE - addr));
+
+	return 0;
+}
+
+static int sim_transport_write1(wsp_device_t *dev, unsigned short addr, char data)
+{
+	sim_station_t *sim = (sim_station_t *)dev->data;
+
+	if (sim_transfer(sim))
+		return -1;
+
+	sim->memory[addr] = data;
+
+	return 0;
+}
+
+static int sim_transport_write32(wsp_device_t *dev, unsigned short addr, char data[32])
+{
+	sim_station_t *sim = (sim_station_t *)dev->data;
+
+	if (sim_transfer(sim))
+		return -1;
+
+	memcpy(&sim->memory[addr], data, min(32, MEMORY_SIZE - addr));
+
+	return 0;
+}
+
+static int sim_transport_ack(wsp_device_t *dev)
+{
+	return sim_transfer((sim_station_t *)dev->data);
+}
+
+const wsp_transport_t sim_transport =
+{
+	"simulator",
+	sim_transport_open,
+	sim_transport_close,
+	sim_transport_read32,
+	sim_transport_write1,
+	sim_transport_write32,
+	sim_transport_ack,
+	NULL,
+	NULL,
+	NULL
+};
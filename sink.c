@@ -0,0 +1,391 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Outputs given with --output kind:destination. The history read in each
+// poll is handed to all of them as one batch, so a station is only read
+// once however many outputs there are. Each output formats and writes the
+// batches on a thread of its own, from a queue of its own, so a slow file
+// doesn't hold up the others. Only when a queue is full does the poll wait.
+//
+// The kinds are:
+//   easyweather:<path>			The EasyWeather format, see -e.
+//   format:<format string>:<path>	A format string, see --format. The format
+//								string can be put within double quotes.
+//   json:<path>				JSON Lines, see --json.
+//
+// The path - is stdout, files are appended to. Only one output can go to
+// stdout, and it writes its batches while holding the output lock so they
+// aren't mixed up with what the poll prints.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wsp.h"
+#include "utils.h"
+#include "writer.h"
+#include "weather.h"
+#include "thread.h"
+#include "format.h"
+#include "parallel.h"
+#include "sink.h"
+
+//
+// The history read in a poll. It is shared by all the outputs and isn't
+// changed by any of them, the last one done with it frees it.
+//
+typedef struct sink_batch_s
+{
+	wsp_device_t *dev;
+	weather_settings_t ws;
+	weather_history_t history;
+	unsigned int first;
+	unsigned int end;
+	unsigned int refs;
+} sink_batch_t;
+
+typedef struct sink_s
+{
+	history_output_t output;
+	format_t format;
+	FILE *f;
+	wsp_thread_t thread;
+	int started;
+	wsp_mutex_t mutex;
+	wsp_cond_t not_empty;
+	wsp_cond_t not_full;
+	sink_batch_t *queue[SINK_QUEUE_DEPTH];
+	unsigned int head;
+	unsigned int count;
+	int closing;
+} sink_t;
+
+static sink_t sinks[MAX_OUTPUTS];
+static unsigned int sink_count = 0;
+static wsp_mutex_t refs_mutex;
+
+// Held while writing to stdout, see wsp.c.
+extern wsp_mutex_t output_mutex;
+
+//
+// Lets go of a batch, freeing it if no output needs it anymore.
+//
+static void release_batch(sink_batch_t *batch)
+{
+	unsigned int refs;
+
+	mutex_lock(&refs_mutex);
+	refs = --batch->refs;
+	mutex_unlock(&refs_mutex);
+
+	if (refs == 0)
+	{
+		free_history(&batch->history);
+		free(batch);
+	}
+}
+
+//
+// Writes the batches queued for an output, until it's closed and the
+// queue is empty.
+//
+static void sink_thread(void *arg)
+{
+	sink_t *sink = (sink_t *)arg;
+	sink_batch_t *batch;
+	writer_t w;
+
+	writer_init(&w, sink->f);
+
+	while (1)
+	{
+		mutex_lock(&sink->mutex);
+
+		while (!sink->count && !sink->closing)
+		{
+			cond_wait(&sink->not_empty, &sink->mutex);
+		}
+
+		if (!sink->count)
+		{
+			mutex_unlock(&sink->mutex);
+			break;
+		}
+
+		batch = sink->queue[sink->head];
+		sink->head = (sink->head + 1) % SINK_QUEUE_DEPTH;
+		sink->count--;
+		cond_signal(&sink->not_full);
+		mutex_unlock(&sink->mutex);
+
+		if (sink->f == stdout)
+		{
+			mutex_lock(&output_mutex);
+		}
+
+		print_history_parallel(&w, sink->output, batch->dev, &batch->ws, &batch->history, batch->first, batch->end, &sink->format);
+		writer_flush(&w);
+		fflush(sink->f);
+
+		if (sink->f == stdout)
+		{
+			mutex_unlock(&output_mutex);
+		}
+
+		release_batch(batch);
+	}
+
+	writer_free(&w);
+}
+
+//
+// Parses an output given as kind:destination.
+//
+static int parse_sink(sink_t *sink, const char *spec)
+{
+	char format_str[OUTPUT_ARG_LEN];
+	const char *path;
+
+	memset(sink, 0, sizeof(sink_t));
+
+	if (!strncmp(spec, "easyweather:", 12))
+	{
+		sink->output = easyweather_output;
+		path = spec + 12;
+	}
+	else if (!strncmp(spec, "json:", 5))
+	{
+		sink->output = json_output;
+		path = spec + 5;
+	}
+	else if (!strncmp(spec, "format:", 7))
+	{
+		const char *s = spec + 7;
+		const char *end;
+
+		sink->output = formatted_output;
+
+		// The format string is either quoted, or runs up to the last colon.
+		if ((*s == '"') && (end = strchr(s + 1, '"')) && (end[1] == ':'))
+		{
+			s++;
+			path = end + 2;
+		}
+		else if ((end = strrchr(s, ':')))
+		{
+			path = end + 1;
+		}
+		else
+		{
+			fprintf(stderr, "The output %s has no destination, use format:<format string>:<path>.\n", spec);
+			return -1;
+		}
+
+		snprintf(format_str, sizeof(format_str), "%.*s", (int)(end - s), s);
+
+		if (compile_format(&sink->format, format_str))
+		{
+			return -1;
+		}
+	}
+	else
+	{
+		fprintf(stderr, "Unknown output %s, use easyweather:<path>, format:<format string>:<path> or json:<path>.\n", spec);
+		return -1;
+	}
+
+	if (!*path)
+	{
+		fprintf(stderr, "The output %s has no destination.\n", spec);
+		free_format(&sink->format);
+		return -1;
+	}
+
+	if (!strcmp(path, "-"))
+	{
+		unsigned int i;
+
+		for (i = 0; i < sink_count; i++)
+		{
+			if (sinks[i].f == stdout)
+			{
+				fprintf(stderr, "The output %s goes to stdout, but so does %s. Only one output can use -.\n", spec, program_settings.outputs[i]);
+				free_format(&sink->format);
+				return -1;
+			}
+		}
+
+		sink->f = stdout;
+	}
+	else if (!(sink->f = fopen(path, "ab")))
+	{
+		fprintf(stderr, "Failed to open %s for writing\n", path);
+		free_format(&sink->format);
+		return -1;
+	}
+
+	return 0;
+}
+
+//
+// Opens the outputs given with --output and starts their threads.
+//
+int open_sinks()
+{
+	unsigned int i;
+
+	mutex_init(&refs_mutex);
+
+	for (i = 0; i < program_settings.output_count; i++)
+	{
+		sink_t *sink = &sinks[i];
+
+		if (parse_sink(sink, program_settings.outputs[i]))
+		{
+			close_sinks();
+			return -1;
+		}
+
+		mutex_init(&sink->mutex);
+		cond_init(&sink->not_empty);
+		cond_init(&sink->not_full);
+		sink_count++;
+
+		if (thread_create(&sink->thread, sink_thread, sink))
+		{
+			close_sinks();
+			return -1;
+		}
+
+		sink->started = 1;
+	}
+
+	return 0;
+}
+
+//
+// Hands the history read in a poll to all the outputs. The history is taken
+// over and freed once all of them have written it. Waits if the queue of an
+// output is full.
+//
+void publish_to_sinks(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int first, unsigned int end)
+{
+	sink_batch_t *batch;
+	unsigned int i;
+
+	if (!sink_count)
+	{
+		return;
+	}
+
+	if (!(batch = (sink_batch_t *)malloc(sizeof(sink_batch_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return;
+	}
+
+	batch->dev = dev;
+	batch->ws = *ws;
+	batch->history = *history;
+	batch->first = first;
+	batch->end = end;
+	batch->refs = sink_count;
+	memset(history, 0, sizeof(weather_history_t));
+
+	// The outputs only read the history from here on.
+	if (prepare_rain_index(&batch->history))
+	{
+		free_history(&batch->history);
+		free(batch);
+		return;
+	}
+
+	for (i = 0; i < sink_count; i++)
+	{
+		sink_t *sink = &sinks[i];
+
+		mutex_lock(&sink->mutex);
+
+		while (sink->count == SINK_QUEUE_DEPTH)
+		{
+			cond_wait(&sink->not_full, &sink->mutex);
+		}
+
+		sink->queue[(sink->head + sink->count) % SINK_QUEUE_DEPTH] = batch;
+		sink->count++;
+		cond_signal(&sink->not_empty);
+		mutex_unlock(&sink->mutex);
+	}
+}
+
+//
+// Waits for the outputs to write what is queued, and closes them.
+//
+void close_sinks()
+{
+	unsigned int i;
+
+	for (i = 0; i < sink_count; i++)
+	{
+		sink_t *sink = &sinks[i];
+
+		if (sink->started)
+		{
+			mutex_lock(&sink->mutex);
+			sink->closing = 1;
+			cond_signal(&sink->not_empty);
+			mutex_unlock(&sink->mutex);
+
+			thread_join(sink->thread);
+		}
+
+		if (sink->f && (sink->f != stdout))
+		{
+			fclose(sink->f);
+		}
+
+		free_format(&sink->format);
+		cond_destroy(&sink->not_empty);
+		cond_destroy(&sink->not_full);
+		mutex_destroy(&sink->mutex);
+	}
+
+	sink_count = 0;
+	mutex_destroy(&refs_mutex);
+}
+
+//
+// Does any of the outputs write the given format?
+//
+int sinks_have_output(history_output_t output)
+{
+	unsigned int i;
+
+	for (i = 0; i < sink_count; i++)
+	{
+		if (sinks[i].output == output)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
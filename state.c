@@ -0,0 +1,168 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// The state file keeps the history cursor between runs, so that only
+// the history written since the last run has to be read. It's a plain
+// text file with one "key=value" pair per line.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "wsp.h"
+#include "utils.h"
+#include "state.h"
+
+//
+// Reads the history cursor from the state file. If the file doesn't exist
+// or is invalid, the cursor is left invalid so that everything is read.
+//
+int read_state_file(const char *path, history_cursor_t *cursor)
+{
+	FILE *f;
+	char line[256];
+	char date[32];
+	unsigned int value;
+	unsigned int fields = 0;
+
+	memset(cursor, 0, sizeof(*cursor));
+
+	if (!(f = fopen(path, "r")))
+	{
+		debug_printf(1, "No state file \"%s\", reading history as usual\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf(line, "current_pos=%u", &value) == 1)
+		{
+			cursor->current_pos = (unsigned short)value;
+			fields++;
+		}
+		else if (sscanf(line, "data_count=%u", &value) == 1)
+		{
+			cursor->data_count = (unsigned short)value;
+			fields++;
+		}
+		else if (!strncmp(line, "datetime=", 9))
+		{
+			unsigned int d[5];
+
+			if (sscanf(&line[9], "%2x%2x%2x%2x%2x", &d[0], &d[1], &d[2], &d[3], &d[4]) == 5)
+			{
+				int i;
+
+				for (i = 0; i < 5; i++)
+					cursor->datetime[i] = (unsigned char)d[i];
+
+				fields++;
+			}
+		}
+		else if (sscanf(line, "last_hash=%x", &value) == 1)
+		{
+			cursor->last_hash = value;
+			cursor->has_last_hash = 1;
+		}
+	}
+
+	fclose(f);
+
+	if ((fields != 3)
+	|| (cursor->current_pos < HISTORY_START)
+	|| (((cursor->current_pos - HISTORY_START) % HISTORY_CHUNK_SIZE) != 0))
+	{
+		fprintf(stderr, "Invalid state file \"%s\", reading history as usual\n", path);
+		memset(cursor, 0, sizeof(*cursor));
+		return -1;
+	}
+
+	cursor->valid = 1;
+
+	debug_printf(1, "Last run: current position %u (0x%x), data count %u, station time %s\n",
+				cursor->current_pos, cursor->current_pos, cursor->data_count,
+				get_bcd_date_string(cursor->datetime, date, sizeof(date)));
+
+	return 0;
+}
+
+//
+// Writes the history cursor to the state file. A temporary file is
+// written first and renamed, so a crash never leaves a half written state.
+//
+int write_state_file(const char *path, history_cursor_t *cursor)
+{
+	FILE *f;
+	char tmp_path[2048 + 8];
+
+	if (!cursor->valid)
+	{
+		return -1;
+	}
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))
+	{
+		fprintf(stderr, "The state file path \"%s\" is too long, at most %d characters.\n",
+				path, (int)sizeof(tmp_path) - 5);
+		return -1;
+	}
+
+	if (!(f = fopen(tmp_path, "w")))
+	{
+		fprintf(stderr, "Failed to open state file \"%s\". ", tmp_path);
+		perror(NULL);
+		return -1;
+	}
+
+	fprintf(f, "# Weather Station Poller history state. Do not edit.\n");
+	fprintf(f, "current_pos=%u\n", cursor->current_pos);
+	fprintf(f, "data_count=%u\n", cursor->data_count);
+	fprintf(f, "datetime=%02x%02x%02x%02x%02x\n",
+			cursor->datetime[0], cursor->datetime[1], cursor->datetime[2],
+			cursor->datetime[3], cursor->datetime[4]);
+
+	if (cursor->has_last_hash)
+	{
+		fprintf(f, "last_hash=%08x\n", cursor->last_hash);
+	}
+
+	if (fclose(f))
+	{
+		fprintf(stderr, "Failed to write state file \"%s\"\n", tmp_path);
+		return -1;
+	}
+
+	#ifdef WIN32
+	// Rename doesn't replace existing files on Windows.
+	remove(path);
+	#endif
+
+	if (rename(tmp_path, path))
+	{
+		fprintf(stderr, "Failed to replace state file \"%s\". ", path);
+		perror(NULL);
+		return -1;
+	}
+
+	return 0;
+}
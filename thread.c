@@ -0,0 +1,178 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Threads, mutexes and condition variables, using the Win32 API on Windows
+// and pthreads everywhere else.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "thread.h"
+
+typedef struct thread_start_s
+{
+	wsp_thread_func func;
+	void *arg;
+} thread_start_t;
+
+#ifdef WIN32
+static DWORD WINAPI thread_main(LPVOID param)
+#else
+static void *thread_main(void *param)
+#endif
+{
+	thread_start_t start = *(thread_start_t *)param;
+
+	free(param);
+	start.func(start.arg);
+
+	return 0;
+}
+
+//
+// Starts a new thread running the given function. Returns 0 on success.
+//
+int thread_create(wsp_thread_t *thread, wsp_thread_func func, void *arg)
+{
+	thread_start_t *start;
+
+	if (!(start = (thread_start_t *)malloc(sizeof(thread_start_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	start->func = func;
+	start->arg = arg;
+
+	#ifdef WIN32
+	if (!(*thread = CreateThread(NULL, 0, thread_main, start, 0, NULL)))
+	#else
+	if (pthread_create(thread, NULL, thread_main, start))
+	#endif
+	{
+		fprintf(stderr, "Failed to start thread\n");
+		free(start);
+		return -1;
+	}
+
+	return 0;
+}
+
+//
+// Waits for a thread to finish.
+//
+void thread_join(wsp_thread_t thread)
+{
+	#ifdef WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	#else
+	pthread_join(thread, NULL);
+	#endif
+}
+
+void mutex_init(wsp_mutex_t *mutex)
+{
+	#ifdef WIN32
+	InitializeCriticalSection(mutex);
+	#else
+	pthread_mutex_init(mutex, NULL);
+	#endif
+}
+
+void mutex_destroy(wsp_mutex_t *mutex)
+{
+	#ifdef WIN32
+	DeleteCriticalSection(mutex);
+	#else
+	pthread_mutex_destroy(mutex);
+	#endif
+}
+
+void mutex_lock(wsp_mutex_t *mutex)
+{
+	#ifdef WIN32
+	EnterCriticalSection(mutex);
+	#else
+	pthread_mutex_lock(mutex);
+	#endif
+}
+
+void mutex_unlock(wsp_mutex_t *mutex)
+{
+	#ifdef WIN32
+	LeaveCriticalSection(mutex);
+	#else
+	pthread_mutex_unlock(mutex);
+	#endif
+}
+
+void cond_init(wsp_cond_t *cond)
+{
+	#ifdef WIN32
+	InitializeConditionVariable(cond);
+	#else
+	pthread_cond_init(cond, NULL);
+	#endif
+}
+
+void cond_destroy(wsp_cond_t *cond)
+{
+	#ifdef WIN32
+	// Win32 condition variables don't need to be destroyed.
+	(void)cond;
+	#else
+	pthread_cond_destroy(cond);
+	#endif
+}
+
+//
+// Unlocks the mutex and waits for the condition to be signaled, the mutex
+// is locked again before returning. Always check the condition waited for
+// again afterwards, the wait can end without a signal.
+//
+void cond_wait(wsp_cond_t *cond, wsp_mutex_t *mutex)
+{
+	#ifdef WIN32
+	SleepConditionVariableCS(cond, mutex, INFINITE);
+	#else
+	pthread_cond_wait(cond, mutex);
+	#endif
+}
+
+void cond_signal(wsp_cond_t *cond)
+{
+	#ifdef WIN32
+	WakeConditionVariable(cond);
+	#else
+	pthread_cond_signal(cond);
+	#endif
+}
+
+void cond_broadcast(wsp_cond_t *cond)
+{
+	#ifdef WIN32
+	WakeAllConditionVariable(cond);
+	#else
+	pthread_cond_broadcast(cond);
+	#endif
+}
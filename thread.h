@@ -0,0 +1,49 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __THREAD_H__
+#define __THREAD_H__
+
+#ifdef WIN32
+#include <windows.h>
+typedef HANDLE wsp_thread_t;
+typedef CRITICAL_SECTION wsp_mutex_t;
+typedef CONDITION_VARIABLE wsp_cond_t;
+#else
+#include <pthread.h>
+typedef pthread_t wsp_thread_t;
+typedef pthread_mutex_t wsp_mutex_t;
+typedef pthread_cond_t wsp_cond_t;
+#endif
+
+typedef void (*wsp_thread_func)(void *arg);
+
+int thread_create(wsp_thread_t *thread, wsp_thread_func func, void *arg);
+void thread_join(wsp_thread_t thread);
+void mutex_init(wsp_mutex_t *mutex);
+void mutex_destroy(wsp_mutex_t *mutex);
+void mutex_lock(wsp_mutex_t *mutex);
+void mutex_unlock(wsp_mutex_t *mutex);
+void cond_init(wsp_cond_t *cond);
+void cond_destroy(wsp_cond_t *cond);
+void cond_wait(wsp_cond_t *cond, wsp_mutex_t *mutex);
+void cond_signal(wsp_cond_t *cond);
+void cond_broadcast(wsp_cond_t *cond);
+
+#endif // __THREAD_H__
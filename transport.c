@@ -0,0 +1,140 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Picks the transport used to talk to the weather station.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "wsp.h"
+#include "utils.h"
+#include "memory.h"
+#include "memcache.h"
+#include "metrics.h"
+
+//
+// Gets the transport given by the program settings.
+//
+static const wsp_transport_t *get_transport()
+{
+	#ifndef WIN32
+	if (program_settings.connect)
+	{
+		return &broker_transport;
+	}
+	#endif // WIN32
+
+	if (program_settings.simulate)
+	{
+		return &sim_transport;
+	}
+	else if (program_settings.from_file)
+	{
+		return &file_transport;
+	}
+	#ifdef WSP_LIBUSB1
+	else if (program_settings.async)
+	{
+		return &usbasync_transport;
+	}
+	#endif // WSP_LIBUSB1
+
+	return &usb_transport;
+}
+
+//
+// Opens a weather station using the transport given by the program
+// settings. The path identifies the station to the transport, if it
+// is empty the first station found is opened. The label defaults to
+// the path. Returns NULL on failure.
+//
+wsp_device_t *open_transport(const char *path, const char *label)
+{
+	wsp_device_t *dev;
+
+	if (!(dev = (wsp_device_t *)calloc(1, sizeof(wsp_device_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+
+	if (!(dev->cache = memcache_create()))
+	{
+		free(dev);
+		return NULL;
+	}
+
+	if (!(dev->metrics = metrics_create()))
+	{
+		memcache_destroy(dev->cache);
+		free(dev);
+		return NULL;
+	}
+
+	dev->transport = get_transport();
+	snprintf(dev->path, sizeof(dev->path), "%s", path ? path : "");
+
+	debug_printf(1, "Using the %s transport\n", dev->transport->name);
+
+	if (dev->transport->open(dev))
+	{
+		metrics_destroy(dev->metrics);
+		memcache_destroy(dev->cache);
+		free(dev);
+		return NULL;
+	}
+
+	// The transport fills in the path of the station it opened.
+	snprintf(dev->label, sizeof(dev->label), "%s", (label && *label) ? label : dev->path);
+
+	return dev;
+}
+
+//
+// Closes the weather station.
+//
+void close_transport(wsp_device_t *dev)
+{
+	if (!dev)
+		return;
+
+	dev->transport->close(dev);
+	metrics_destroy(dev->metrics);
+	memcache_destroy(dev->cache);
+	free(dev);
+}
+
+//
+// Finds all the stations that can be opened with the transport given by
+// the program settings. Returns -1 if the transport can't do that.
+//
+int enumerate_stations(station_found_cb cb, void *arg)
+{
+	const wsp_transport_t *transport = get_transport();
+
+	if (!transport->enumerate)
+	{
+		fprintf(stderr, "The %s transport can't list stations.\n", transport->name);
+		return -1;
+	}
+
+	return transport->enumerate(cb, arg);
+}
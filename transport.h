@@ -0,0 +1,87 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+//
+// Called for each address read with read_weather_addresses(), in the
+// same order as the addresses were given. status is 0 on success.
+//
+typedef void (*read_address_cb)(unsigned short addr, const char buf[32], int status, void *arg);
+
+//
+// Called for each weather station found with enumerate_stations().
+//
+typedef void (*station_found_cb)(const char *path, void *arg);
+
+#define STATION_PATH_LEN 128
+
+//
+// The operations a weather station can be accessed through.
+// Everything returns 0 on success.
+//
+typedef struct wsp_transport_s
+{
+	const char *name;
+	int (*open)(wsp_device_t *dev);
+	void (*close)(wsp_device_t *dev);
+	int (*read32)(wsp_device_t *dev, unsigned short addr, char buf[32]);
+	int (*write1)(wsp_device_t *dev, unsigned short addr, char data);
+	int (*write32)(wsp_device_t *dev, unsigned short addr, char data[32]);
+	int (*ack)(wsp_device_t *dev);
+
+	// Optional, reads several addresses at once. Returns the number of
+	// addresses that failed. If not set read32 is used for each address.
+	int (*read_addresses)(wsp_device_t *dev, const unsigned short *addrs, unsigned int count, read_address_cb cb, void *arg);
+
+	// Optional, finds all stations that can be opened.
+	int (*enumerate)(station_found_cb cb, void *arg);
+
+	// Optional, returns a pointer to the 32 bytes at an address without
+	// copying them, or NULL on failure. The pointer is valid until the
+	// next call. Mapped reads bypass the memory cache.
+	const char *(*map)(wsp_device_t *dev, unsigned short addr);
+} wsp_transport_t;
+
+struct wsp_device_s
+{
+	const wsp_transport_t *transport;
+	void *data;						// State of the transport.
+	struct memcache_s *cache;		// The memory cache for this station.
+	struct metrics_s *metrics;		// The counters for this station, see metrics.c.
+	char path[STATION_PATH_LEN];	// Identifies the station to the transport. Empty opens the first one found.
+	char label[STATION_PATH_LEN];	// Tags the output of the station.
+};
+
+extern const wsp_transport_t usb_transport;
+extern const wsp_transport_t file_transport;
+extern const wsp_transport_t sim_transport;
+#ifdef WSP_LIBUSB1
+extern const wsp_transport_t usbasync_transport;
+#endif // WSP_LIBUSB1
+#ifndef WIN32
+extern const wsp_transport_t broker_transport;
+#endif // WIN32
+
+wsp_device_t *open_transport(const char *path, const char *label);
+void close_transport(wsp_device_t *dev);
+int enumerate_stations(station_found_cb cb, void *arg);
+
+#endif // __TRANSPORT_H__
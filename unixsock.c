@@ -0,0 +1,137 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// The Unix domain sockets the broker and the publisher listen on.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "unixsock.h"
+
+//
+// Fills in the address of a socket path.
+//
+int get_socket_address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr->sun_path))
+	{
+		fprintf(stderr, "The socket path \"%s\" is too long.\n", path);
+		return -1;
+	}
+
+	strcpy(addr->sun_path, path);
+
+	return 0;
+}
+
+//
+// Removes a socket left behind at path by a program that didn't exit
+// cleanly. If something is still listening on it, the socket is in use
+// and is left alone.
+//
+static int remove_stale_socket(const char *path, struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd;
+	int err;
+
+	if (stat(path, &st) || !S_ISSOCK(st.st_mode))
+	{
+		return 0;
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		return -1;
+	}
+
+	err = connect(fd, (struct sockaddr *)addr, sizeof(*addr)) ? errno : 0;
+	close(fd);
+
+	if (!err)
+	{
+		fprintf(stderr, "\"%s\" is already in use.\n", path);
+		return -1;
+	}
+
+	if (err == ECONNREFUSED)
+	{
+		unlink(path);
+	}
+
+	return 0;
+}
+
+//
+// Creates a socket listening at path. what names it in the error messages.
+// Returns the socket, or -1 on failure.
+//
+int listen_socket(const char *path, const char *what)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (get_socket_address(path, &addr))
+	{
+		return -1;
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		fprintf(stderr, "Failed to create the %s socket. ", what);
+		perror(NULL);
+		return -1;
+	}
+
+	if (remove_stale_socket(path, &addr))
+	{
+		close(fd);
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+	{
+		fprintf(stderr, "Failed to listen on \"%s\". ", path);
+		perror(NULL);
+		close(fd);
+		return -1;
+	}
+
+	if (listen(fd, 16))
+	{
+		fprintf(stderr, "Failed to listen on \"%s\". ", path);
+		perror(NULL);
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	return fd;
+}
@@ -0,0 +1,755 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// Transport on top of libusb-1.0. Reads of the history and memory are
+// pipelined using asynchronous transfers, so that the next read is
+// already on its way while the previous one is being decoded.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libusb.h>
+#include "wsp.h"
+#include "utils.h"
+#include "memory.h"
+#include "metrics.h"
+#include "usbasync.h"
+
+#define USBASYNC_INTERFACE 0
+
+// How long to wait for answers the station still has queued after the
+// reads in flight have been cancelled.
+#define USBASYNC_DRAIN_TIMEOUT 100
+
+typedef enum request_state_s
+{
+	request_idle,
+	request_command,	// The read command has been sent.
+	request_read,		// Waiting for the 32 bytes of data.
+	request_retry,		// Failed, waiting for the reads before it to be restarted.
+	request_done
+} request_state_t;
+
+//
+// An open device. Each device has its own libusb context, so several
+// devices can be polled from different threads.
+//
+typedef struct usbasync_device_s
+{
+	libusb_context *ctx;
+	libusb_device_handle *devh;
+	wsp_device_t *dev;			// The station, for its metrics.
+	int restart;				// A read failed, see restart_requests().
+	int cancelling;				// The reads in flight are being cancelled.
+} usbasync_device_t;
+
+//
+// A single address read. Each read is a control transfer with the read
+// command, followed by an interrupt transfer returning the data.
+//
+typedef struct usbasync_request_s
+{
+	usbasync_device_t *ud;
+	request_state_t state;
+	unsigned short addr;
+	int trycount;
+	int status;
+	unsigned char command_buf[LIBUSB_CONTROL_SETUP_SIZE + 8];
+	unsigned char data[32];
+	struct libusb_transfer *command;
+	struct libusb_transfer *read;
+} usbasync_request_t;
+
+//
+// Gets the path identifying a device, made up of the bus number and the
+// ports leading to it (for example 1-1.4). It stays the same as long as
+// the station is plugged into the same port.
+//
+static void get_port_path(libusb_device *device, char *path, unsigned int len)
+{
+	unsigned char ports[8];
+	int count = libusb_get_port_numbers(device, ports, sizeof(ports));
+	unsigned int pos;
+	int i;
+
+	pos = snprintf(path, len, "%u", libusb_get_bus_number(device));
+
+	for (i = 0; (i < count) && (pos < len); i++)
+	{
+		pos += snprintf(&path[pos], len - pos, "%c%u", (i == 0) ? '-' : '.', ports[i]);
+	}
+}
+
+//
+// Calls the callback with the path of each device with the given vendor
+// and product id. If the callback returns non-zero the search stops and
+// the device is returned with a reference held.
+//
+static libusb_device *find_devices(libusb_context *ctx, int vendor, int product,
+								int (*cb)(const char *path, void *arg), void *arg)
+{
+	libusb_device **list;
+	libusb_device *found = NULL;
+	struct libusb_device_descriptor desc;
+	char path[STATION_PATH_LEN];
+	ssize_t count;
+	ssize_t i;
+
+	if ((count = libusb_get_device_list(ctx, &list)) < 0)
+	{
+		fprintf(stderr, "Failed to list USB devices: %s\n", libusb_error_name((int)count));
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (libusb_get_device_descriptor(list[i], &desc)
+		|| (desc.idVendor != vendor) || (desc.idProduct != product))
+		{
+			continue;
+		}
+
+		get_port_path(list[i], path, sizeof(path));
+
+		if (cb(path, arg))
+		{
+			found = libusb_ref_device(list[i]);
+			break;
+		}
+	}
+
+	libusb_free_device_list(list, 1);
+
+	return found;
+}
+
+//
+// Matches the wanted path, or the first device if no path is wanted.
+// The path of the device found is copied to the wanted path.
+//
+static int match_path(const char *path, void *arg)
+{
+	char *wanted = (char *)arg;
+
+	if (*wanted && strcmp(wanted, path))
+		return 0;
+
+	snprintf(wanted, STATION_PATH_LEN, "%s", path);
+	return 1;
+}
+
+//
+// Opens and claims the device using libusb-1.0. If a path is given the
+// device must be at that path, otherwise the first one is used. The path
+// of the device opened is copied to path.
+//
+static int usbasync_open(usbasync_device_t *ud, int vendor, int product, char path[STATION_PATH_LEN])
+{
+	libusb_device *device;
+	int ret;
+
+	if ((ret = libusb_init(&ud->ctx)) != 0)
+	{
+		fprintf(stderr, "Failed to initialize libusb-1.0: %s\n", libusb_error_name(ret));
+		return -1;
+	}
+
+	if (!(device = find_devices(ud->ctx, vendor, product, match_path, path)))
+	{
+		fprintf(stderr, "No device with vendor id: 0x%x (%d) and product id: %x (%d) was found%s%s\n",
+			vendor, vendor, product, product, (*path ? " at " : ""), path);
+		libusb_exit(ud->ctx);
+		return -1;
+	}
+
+	ret = libusb_open(device, &ud->devh);
+	libusb_unref_device(device);
+
+	if (ret != 0)
+	{
+		fprintf(stderr, "Could not open usb device, errorcode: %s\n", libusb_error_name(ret));
+		libusb_exit(ud->ctx);
+		return -1;
+	}
+
+	if (libusb_kernel_driver_active(ud->devh, USBASYNC_INTERFACE) == 1)
+	{
+		if ((ret = libusb_detach_kernel_driver(ud->devh, USBASYNC_INTERFACE)) != 0)
+		{
+			fprintf(stderr, "Could not open usb device. Failed to detach from driver: %s\n", libusb_error_name(ret));
+			goto fail;
+		}
+	}
+
+	libusb_set_configuration(ud->devh, 1);
+
+	if ((ret = libusb_claim_interface(ud->devh, USBASYNC_INTERFACE)) != 0)
+	{
+		fprintf(stderr, "Could not open usb device, errorcode: %s\n", libusb_error_name(ret));
+		goto fail;
+	}
+
+	if ((ret = libusb_set_interface_alt_setting(ud->devh, USBASYNC_INTERFACE, 0)) != 0)
+	{
+		fprintf(stderr, "Failed to open USB device, errorcode: %s\n", libusb_error_name(ret));
+		goto fail;
+	}
+
+	// HID set idle, same as done by init_device_descriptors().
+	libusb_control_transfer(ud->devh, LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE,
+							0xa, 0, 0, NULL, 0, USB_TIMEOUT);
+
+	return 0;
+
+fail:
+	libusb_close(ud->devh);
+	libusb_exit(ud->ctx);
+	ud->devh = NULL;
+	return -1;
+}
+
+//
+// Releases and closes the device.
+//
+static void usbasync_close(usbasync_device_t *ud)
+{
+	int ret;
+
+	if (!ud->devh)
+		return;
+
+	if ((ret = libusb_release_interface(ud->devh, USBASYNC_INTERFACE)) != 0)
+		fprintf(stderr, "Could not release interface: %s\n", libusb_error_name(ret));
+
+	libusb_close(ud->devh);
+	libusb_exit(ud->ctx);
+	ud->devh = NULL;
+}
+
+//
+// Sends a USB message to the device from a given buffer.
+//
+static int usbasync_send_msgbuf(usbasync_device_t *ud, char *msg, int msgsize)
+{
+	debug_printf(2, "--> ");
+	print_bytes(2, msg, msgsize);
+
+	return libusb_control_transfer(ud->devh, LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE,
+									9, 0x200, 0, (unsigned char *)msg, (unsigned short)msgsize, USB_TIMEOUT);
+}
+
+//
+// Reads a message from the interrupt endpoint. Returns the number of bytes read.
+//
+static int usbasync_read_msg(usbasync_device_t *ud, char *buf, int len)
+{
+	int transferred = 0;
+	int ret = libusb_interrupt_transfer(ud->devh, ENDPOINT_INTERRUPT_ADDRESS, (unsigned char *)buf, len, &transferred, USB_TIMEOUT);
+
+	return (ret == 0) ? transferred : ret;
+}
+
+//
+// Sends a message for an address. Returns 0 if all of it was sent.
+//
+static int usbasync_send_for(usbasync_device_t *ud, char *msg, int msgsize, const char *what, unsigned short addr)
+{
+	int ret = usbasync_send_msgbuf(ud, msg, msgsize);
+
+	if (ret != msgsize)
+	{
+		metrics_count(ud->dev, METRIC_TRANSFER_ERRORS, 1);
+		fprintf(stderr, "Failed %s for address %d (0x%x): %d\n", what, addr, addr, ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void submit_request(usbasync_request_t *req);
+
+//
+// Marks a request as failed, or resends it if it has tries left.
+//
+// The answer to a read that timed out can still come in, and would be
+// taken as the answer to the next one. So instead of resending it right
+// away, the reads in flight are cancelled and restarted in order by the
+// caller.
+//
+static void request_failed(usbasync_request_t *req, const char *what, int status)
+{
+	req->trycount++;
+	metrics_count(req->ud->dev, METRIC_TRANSFER_ERRORS, 1);
+
+	fprintf(stderr, "Failed %s for address %d (0x%x): %d. Try %d of %d\n",
+			what, req->addr, req->addr, status, req->trycount, NUM_TRIES);
+
+	req->ud->restart = 1;
+
+	if (req->trycount < NUM_TRIES)
+	{
+		metrics_count(req->ud->dev, METRIC_READ_RETRIES, 1);
+		req->state = request_retry;
+		return;
+	}
+
+	req->status = -1;
+	req->state = request_done;
+}
+
+static void LIBUSB_CALL read_done(struct libusb_transfer *transfer)
+{
+	usbasync_request_t *req = (usbasync_request_t *)transfer->user_data;
+
+	// Whatever was read is thrown away, the read is restarted.
+	if (req->ud->cancelling)
+	{
+		req->state = request_idle;
+		return;
+	}
+
+	if ((transfer->status != LIBUSB_TRANSFER_COMPLETED) || (transfer->actual_length != 32))
+	{
+		request_failed(req, "reading data", transfer->status);
+		return;
+	}
+
+	metrics_count(req->ud->dev, METRIC_BYTES_READ, 32);
+	req->status = 0;
+	req->state = request_done;
+}
+
+static void LIBUSB_CALL command_done(struct libusb_transfer *transfer)
+{
+	usbasync_request_t *req = (usbasync_request_t *)transfer->user_data;
+	int ret;
+
+	if (req->ud->cancelling)
+	{
+		req->state = request_idle;
+		return;
+	}
+
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+	{
+		request_failed(req, "sending read command", transfer->status);
+		return;
+	}
+
+	// The station answers on the interrupt endpoint. Since the control
+	// transfers complete in order, so are the reads submitted, which is
+	// how the data is matched back to the address.
+	req->state = request_read;
+	libusb_fill_interrupt_transfer(req->read, req->ud->devh, ENDPOINT_INTERRUPT_ADDRESS,
+									req->data, sizeof(req->data), read_done, req, USB_TIMEOUT);
+
+	if ((ret = libusb_submit_transfer(req->read)) != 0)
+	{
+		request_failed(req, "submitting read", ret);
+	}
+}
+
+//
+// Sends the read command for the address of the request.
+//
+static void submit_request(usbasync_request_t *req)
+{
+	unsigned char *msg = &req->command_buf[LIBUSB_CONTROL_SETUP_SIZE];
+	int ret;
+
+	metrics_count(req->ud->dev, METRIC_TRANSFERS, 1);
+
+	msg[0] = 0xa1;
+	msg[1] = (req->addr >> 8);
+	msg[2] = (req->addr & 0xff);
+	msg[3] = 0x20;
+	msg[4] = 0xa1;
+	msg[5] = 0;
+	msg[6] = 0;
+	msg[7] = 0x20;
+
+	debug_printf(2, "--> ");
+	print_bytes(2, (char *)msg, 8);
+
+	libusb_fill_control_setup(req->command_buf, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+								9, 0x200, 0, 8);
+	libusb_fill_control_transfer(req->command, req->ud->devh, req->command_buf, command_done, req, USB_TIMEOUT);
+
+	req->state = request_command;
+
+	if ((ret = libusb_submit_transfer(req->command)) != 0)
+	{
+		request_failed(req, "submitting read command", ret);
+	}
+}
+
+//
+// Cancels the reads in flight and waits for their callbacks, so the
+// transfers can be reused or freed. Fails if the events can't be handled,
+// then the transfers are still owned by libusb.
+//
+static int cancel_requests(usbasync_device_t *ud, usbasync_request_t *reqs, unsigned int queue_depth)
+{
+	unsigned int i;
+	int pending;
+	int errors = 0;
+
+	ud->cancelling = 1;
+
+	for (i = 0; i < queue_depth; i++)
+	{
+		if (reqs[i].state == request_command)
+			libusb_cancel_transfer(reqs[i].command);
+		else if (reqs[i].state == request_read)
+			libusb_cancel_transfer(reqs[i].read);
+	}
+
+	do
+	{
+		pending = 0;
+
+		for (i = 0; i < queue_depth; i++)
+		{
+			if ((reqs[i].state == request_command) || (reqs[i].state == request_read))
+				pending = 1;
+		}
+
+		if (pending && (libusb_handle_events(ud->ctx) != 0) && (++errors >= NUM_TRIES))
+		{
+			fprintf(stderr, "Failed to handle USB events while cancelling reads\n");
+			ud->cancelling = 0;
+			return -1;
+		}
+	}
+	while (pending);
+
+	ud->cancelling = 0;
+
+	return 0;
+}
+
+//
+// Restarts the reads after one of them failed. The
+// reads that finished before it are kept, and the rest are cancelled and
+// sent again in order, once the answers the station still has queued for
+// them have been thrown away.
+//
+static int restart_requests(usbasync_device_t *ud, usbasync_request_t *reqs, unsigned int queue_depth,
+							unsigned int delivered, unsigned int submitted)
+{
+	usbasync_request_t *req;
+	unsigned int from;
+	unsigned int i;
+	int transferred;
+	char buf[32];
+
+	ud->restart = 0;
+
+	if (cancel_requests(ud, reqs, queue_depth))
+	{
+		return -1;
+	}
+
+	// The reads after one that failed for good may have got its answer.
+	for (from = delivered; from < submitted; from++)
+	{
+		req = &reqs[from % queue_depth];
+
+		if (req->state != request_done)
+			break;
+
+		if (req->status)
+		{
+			from++;
+			break;
+		}
+	}
+
+	for (i = 0; i < queue_depth; i++)
+	{
+		if (libusb_interrupt_transfer(ud->devh, ENDPOINT_INTERRUPT_ADDRESS, (unsigned char *)buf,
+									sizeof(buf), &transferred, USBASYNC_DRAIN_TIMEOUT) != 0)
+			break;
+
+		debug_printf(2, "Threw away a late answer\n");
+	}
+
+	// Each address stays in the same request, so its tries are kept.
+	for (; from < submitted; from++)
+	{
+		submit_request(&reqs[from % queue_depth]);
+	}
+
+	return 0;
+}
+
+//
+// Reads 32 bytes from each of the given addresses, keeping up to queue_depth
+// reads in flight. The callback is called for each address in the given order.
+// As soon as a read is done the next one is submitted before calling the
+// callback, so decoding the data overlaps with the next transfer.
+//
+// Returns the number of addresses that failed to be read.
+//
+static int usbasync_read_addresses(usbasync_device_t *ud, const unsigned short *addrs, unsigned int count, unsigned int queue_depth, read_address_cb cb, void *arg)
+{
+	usbasync_request_t *reqs;
+	unsigned int submitted = 0;
+	unsigned int delivered = 0;
+	unsigned int i;
+	int failed = 0;
+	char buf[32];
+
+	queue_depth = max(1, min(queue_depth, USBASYNC_MAX_QUEUE));
+
+	// Kept off the stack, in case libusb can't be made to let go of them.
+	if (!(reqs = (usbasync_request_t *)calloc(queue_depth, sizeof(usbasync_request_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return count;
+	}
+
+	ud->restart = 0;
+	ud->cancelling = 0;
+
+	for (i = 0; i < queue_depth; i++)
+	{
+		reqs[i].ud = ud;
+		reqs[i].command = libusb_alloc_transfer(0);
+		reqs[i].read = libusb_alloc_transfer(0);
+
+		if (!reqs[i].command || !reqs[i].read)
+		{
+			fprintf(stderr, "Failed to allocate USB transfers\n");
+			failed = count;
+			goto cleanup;
+		}
+	}
+
+	// Fill the queue.
+	for (; (submitted < count) && (submitted < queue_depth); submitted++)
+	{
+		usbasync_request_t *req = &reqs[submitted % queue_depth];
+		req->addr = addrs[submitted];
+		req->trycount = 0;
+		submit_request(req);
+	}
+
+	while (delivered < count)
+	{
+		usbasync_request_t *req = &reqs[delivered % queue_depth];
+
+		if (ud->restart && restart_requests(ud, reqs, queue_depth, delivered, submitted))
+		{
+			failed += count - delivered;
+			goto leak;
+		}
+
+		if (req->state != request_done)
+		{
+			if (libusb_handle_events(ud->ctx) != 0)
+			{
+				fprintf(stderr, "Failed to handle USB events\n");
+				failed += count - delivered;
+				break;
+			}
+
+			continue;
+		}
+
+		// Keep a copy so the request can be reused for the next address
+		// while the callback decodes this one.
+		{
+			unsigned short addr = req->addr;
+			int status = req->status;
+
+			memcpy(buf, req->data, sizeof(buf));
+			print_bytes(2, buf, 32);
+
+			req->state = request_idle;
+
+			if (submitted < count)
+			{
+				req->addr = addrs[submitted++];
+				req->trycount = 0;
+				submit_request(req);
+			}
+
+			if (status)
+			{
+				failed++;
+			}
+
+			cb(addr, buf, status, arg);
+			delivered++;
+		}
+	}
+
+cleanup:
+	// Transfers still in flight can only be freed once libusb is done with them.
+	if (cancel_requests(ud, reqs, queue_depth))
+	{
+		goto leak;
+	}
+
+	for (i = 0; i < queue_depth; i++)
+	{
+		if (reqs[i].command)
+			libusb_free_transfer(reqs[i].command);
+
+		if (reqs[i].read)
+			libusb_free_transfer(reqs[i].read);
+	}
+
+	free(reqs);
+
+	return failed;
+
+leak:
+	// libusb may still call back with the requests, so they are left as is.
+	fprintf(stderr, "USB transfers could not be cancelled\n");
+	return failed;
+}
+
+static int usbasync_transport_open(wsp_device_t *dev)
+{
+	usbasync_device_t *ud;
+
+	if (!(ud = (usbasync_device_t *)calloc(1, sizeof(usbasync_device_t))))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	if (usbasync_open(ud, program_settings.vendor_id, program_settings.product_id, dev->path))
+	{
+		free(ud);
+		return -1;
+	}
+
+	ud->dev = dev;
+	dev->data = ud;
+
+	return 0;
+}
+
+static void usbasync_transport_close(wsp_device_t *dev)
+{
+	usbasync_close((usbasync_device_t *)dev->data);
+	free(dev->data);
+}
+
+static int usbasync_transport_read32(wsp_device_t *dev, unsigned short addr, char buf[32])
+{
+	usbasync_device_t *ud = (usbasync_device_t *)dev->data;
+	char msg[8] = {0xa1, (addr >> 8), (addr & 0xff), 0x20, 0xa1, 0, 0, 0x20};
+
+	if (usbasync_send_for(ud, msg, 8, "sending read command", addr))
+	{
+		return -1;
+	}
+
+	return (usbasync_read_msg(ud, buf, 32) != 32);
+}
+
+static int usbasync_transport_write1(wsp_device_t *dev, unsigned short addr, char data)
+{
+	char msg[8] = {0xa2, (addr >> 8), (addr & 0xff), 0x20, 0xa2, data, 0, 0x20};
+
+	return usbasync_send_for((usbasync_device_t *)dev->data, msg, 8, "sending write command", addr);
+}
+
+static int usbasync_transport_write32(wsp_device_t *dev, unsigned short addr, char data[32])
+{
+	usbasync_device_t *ud = (usbasync_device_t *)dev->data;
+	char msg[8] = {0xa0, (addr >> 8), (addr & 0xff), 0x20, 0xa0, 0, 0, 0x20};
+
+	if (usbasync_send_for(ud, msg, 8, "sending write command", addr))
+	{
+		return -1;
+	}
+
+	return usbasync_send_for(ud, data, 32, "sending data", addr);
+}
+
+static int usbasync_transport_ack(wsp_device_t *dev)
+{
+	char buf[32];
+
+	memset(buf, 0, sizeof(buf));
+	usbasync_read_msg((usbasync_device_t *)dev->data, buf, 32);
+
+	return check_weather_ack(buf);
+}
+
+static int usbasync_transport_read_addresses(wsp_device_t *dev, const unsigned short *addrs, unsigned int count, read_address_cb cb, void *arg)
+{
+	return usbasync_read_addresses((usbasync_device_t *)dev->data, addrs, count, program_settings.queue_depth, cb, arg);
+}
+
+typedef struct station_search_s
+{
+	station_found_cb cb;
+	void *arg;
+} station_search_t;
+
+static int report_station(const char *path, void *arg)
+{
+	station_search_t *search = (station_search_t *)arg;
+	search->cb(path, search->arg);
+	return 0;
+}
+
+static int usbasync_transport_enumerate(station_found_cb cb, void *arg)
+{
+	libusb_context *ctx;
+	station_search_t search;
+	int ret;
+
+	if ((ret = libusb_init(&ctx)) != 0)
+	{
+		fprintf(stderr, "Failed to initialize libusb-1.0: %s\n", libusb_error_name(ret));
+		return -1;
+	}
+
+	search.cb = cb;
+	search.arg = arg;
+	find_devices(ctx, program_settings.vendor_id, program_settings.product_id, report_station, &search);
+
+	libusb_exit(ctx);
+
+	return 0;
+}
+
+const wsp_transport_t usbasync_transport =
+{
+	"libusb-1.0",
+	usbasync_transport_open,
+	usbasync_transport_close,
+	usbasync_transport_read32,
+	usbasync_transport_write1,
+	usbasync_transport_write32,
+	usbasync_transport_ack,
+	usbasync_transport_read_addresses,
+	usbasync_transport_enumerate,
+	NULL
+};
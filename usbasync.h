@@ -0,0 +1,30 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __USBASYNC_H__
+#define __USBASYNC_H__
+
+#ifdef WSP_LIBUSB1
+
+#define USBASYNC_MAX_QUEUE 16
+#define USBASYNC_DEFAULT_QUEUE 4
+
+#endif // WSP_LIBUSB1
+
+#endif // __USBASYNC_H__
@@ -1,188 +1,334 @@
-//
-// Weather Station Poller
-//
-// Copyright (C) 2010 Joakim Sderberg
-//
-// This program is free software: you can redistribute it and/or modify
-// it under the terms of the GNU General Public License as published by
-// the Free Software Foundation, either version 3 of the License, or
-// (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-// GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program.  If not, see <http://www.gnu.org/licenses/>.
-//
-
-#include <stdio.h>
-#include <stdarg.h>
-#include <stdlib.h>
-#include <time.h>
-
-#include "wsp.h"
-#include "utils.h"
-
-int svn_revision()
-{
-	char *s = BUILD_NUM;
-
-	while (*s)
-	{
-		if (*s == ':')
-		{
-			s++;
-			return atoi(s);
-		}
-
-		s++;
-	}
-
-	return 0;
-}
-
-void debug_printf(unsigned int debug_level, const char* format, ... ) 
-{
-	if (debug >= debug_level)
-	{
-		va_list args;
-		va_start(args, format);
-		vprintf(format, args);
-		va_end(args);
-	}
-}
-
-//
-// Parses a date in BCD format (http://en.wikipedia.org/wiki/Binary-coded_decimal).
-// Each nibble of each byte corresponds to one number. The first byte contains the year.
-//
-bcd_date_t parse_bcd_date(unsigned char date[5])
-{
-	bcd_date_t d;
-	d.year		= 2000 + (((date[0] >> 4) & 0xf) * 10) + (date[0] & 0xf);
-	d.month 	= (((date[1] >> 4) & 0xf) * 10) + (date[1] & 0xf);
-	d.day 		= (((date[2] >> 4) & 0xf) * 10) + (date[2] & 0xf);
-	d.hour 		= (((date[3] >> 4) & 0xf) * 10) + (date[3] & 0xf);
-	d.minute 	= (((date[4] >> 4) & 0xf) * 10) + (date[4] & 0xf);
-	return d;
-}
-
-//
-// Prints a BCD date.
-//
-void print_bcd_date(unsigned char date[5])
-{
-	bcd_date_t d = parse_bcd_date(date);
-	printf("%u-%02u-%02u %02u:%02u:00", d.year, d.month, d.day, d.hour, d.minute);
-}
-
-const char *get_bcd_date_string(unsigned char date[5])
-{
-	static char str[1024];
-	bcd_date_t d = parse_bcd_date(date);
-	sprintf(str, "%u-%02u-%02u %02u:%02u:00", d.year, d.month, d.day, d.hour, d.minute);
-	return str;
-}
-
-//
-// Gets a string for the wind direction from the settings byte.
-//
-const char *get_wind_direction(const char data)
-{
-	switch (data)
-	{
-		default:
-		case 0: return "N";
-		case 1: return "NNE";
-		case 2: return "NE";
-		case 3: return "NEE";
-		case 4: return "E";
-		case 5: return "SEE";
-		case 6: return "SE";
-		case 7: return "SSE";
-		case 8: return "S";
-		case 9: return "SSW";
-		case 10: return "SW";
-		case 11: return "WSW";
-		case 12: return "W";
-		case 13: return "WNW";
-		case 14: return "NW";
-		case 15: return "NNW";
-	}
-}
-
-//
-// Prints bytes for debug purposes.
-//
-void print_bytes(unsigned int debug_level, char *bytes, unsigned int len)
-{
-    if ((debug >= debug_level) && (len > 0))
-	{
-		unsigned int i;
-
-		for (i = 0; i < len; i++)
-		{
-			printf("%02x ", (int)((unsigned char)bytes[i]));
-		}
-		
-		debug_printf(debug_level, "\n");
-    }
-}
-
-int file_exists(const char *filename)
-{
-	FILE *f;
-	
-	if ((f = fopen(program_settings.dumpfile, "r")) == NULL)
-	{
-		return 0;
-	}
-	
-	fclose(f);
-	
-	return 1;
-}
-
-char prompt_user()
-{
-	char c;
-	fflush(stdin);
-	scanf("%c", &c);
-	return c;
-}
-
-char *get_timestamp(time_t t)
-{
-	static char tbuf[128];
-	strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:00", localtime(&t));
-	return tbuf;
-}
-
-char *get_local_timestamp()
-{
-	static char tbuf[128];
-	time_t now = time(NULL);
-	strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:00", localtime(&now));
-	return tbuf;
-}
-
-time_t bcd_to_unix_date(bcd_date_t date)
-{
-	time_t rawtime;
-	struct tm timeinfo;
-
-	memset(&timeinfo, 0, sizeof(timeinfo));
-	timeinfo.tm_year	= date.year - 1900;
-	timeinfo.tm_mon		= date.month - 1;
-	timeinfo.tm_mday	= date.day;
-	timeinfo.tm_hour	= date.hour;
-	timeinfo.tm_min		= date.minute;
-	timeinfo.tm_isdst	= 1;
-
-	rawtime = mktime(&timeinfo);
-
-	return rawtime;
-}
-
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
+#include "wsp.h"
+#include "utils.h"
+
+int svn_revision()
+{
+	char *s = BUILD_NUM;
+
+	while (*s)
+	{
+		if (*s == ':')
+		{
+			s++;
+			return atoi(s);
+		}
+
+		s++;
+	}
+
+	return 0;
+}
+
+void debug_printf(unsigned int debug_level, const char* format, ... ) 
+{
+	if (debug >= debug_level)
+	{
+		va_list args;
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+	}
+}
+
+//
+// Parses a date in BCD format (http://en.wikipedia.org/wiki/Binary-coded_decimal).
+// Each nibble of each byte corresponds to one number. The first byte contains the year.
+//
+bcd_date_t parse_bcd_date(unsigned char date[5])
+{
+	bcd_date_t d;
+	d.year		= 2000 + (((date[0] >> 4) & 0xf) * 10) + (date[0] & 0xf);
+	d.month 	= (((date[1] >> 4) & 0xf) * 10) + (date[1] & 0xf);
+	d.day 		= (((date[2] >> 4) & 0xf) * 10) + (date[2] & 0xf);
+	d.hour 		= (((date[3] >> 4) & 0xf) * 10) + (date[3] & 0xf);
+	d.minute 	= (((date[4] >> 4) & 0xf) * 10) + (date[4] & 0xf);
+	return d;
+}
+
+//
+// Prints a BCD date.
+//
+void print_bcd_date(unsigned char date[5])
+{
+	bcd_date_t d = parse_bcd_date(date);
+	printf("%u-%02u-%02u %02u:%02u:00", d.year, d.month, d.day, d.hour, d.minute);
+}
+
+//
+// Formats a BCD date into the given buffer.
+//
+const char *get_bcd_date_string(unsigned char date[5], char *buf, unsigned int len)
+{
+	bcd_date_t d = parse_bcd_date(date);
+	snprintf(buf, len, "%u-%02u-%02u %02u:%02u:00", d.year, d.month, d.day, d.hour, d.minute);
+	return buf;
+}
+
+//
+// Gets a string for the wind direction from the settings byte.
+//
+const char *get_wind_direction(const char data)
+{
+	switch (data)
+	{
+		default:
+		case 0: return "N";
+		case 1: return "NNE";
+		case 2: return "NE";
+		case 3: return "NEE";
+		case 4: return "E";
+		case 5: return "SEE";
+		case 6: return "SE";
+		case 7: return "SSE";
+		case 8: return "S";
+		case 9: return "SSW";
+		case 10: return "SW";
+		case 11: return "WSW";
+		case 12: return "W";
+		case 13: return "WNW";
+		case 14: return "NW";
+		case 15: return "NNW";
+	}
+}
+
+//
+// Prints bytes for debug purposes.
+//
+void print_bytes(unsigned int debug_level, const char *bytes, unsigned int len)
+{
+    if ((debug >= debug_level) && (len > 0))
+	{
+		unsigned int i;
+
+		for (i = 0; i < len; i++)
+		{
+			printf("%02x ", (int)((unsigned char)bytes[i]));
+		}
+		
+		debug_printf(debug_level, "\n");
+    }
+}
+
+int file_exists(const char *filename)
+{
+	FILE *f;
+	
+	if ((f = fopen(program_settings.dumpfile, "r")) == NULL)
+	{
+		return 0;
+	}
+	
+	fclose(f);
+	
+	return 1;
+}
+
+char prompt_user()
+{
+	char c;
+	fflush(stdin);
+	scanf("%c", &c);
+	return c;
+}
+
+//
+// Converts a unix date to local time, can be called from several threads.
+//
+static void get_local_time(time_t t, struct tm *timeinfo)
+{
+	#ifdef WIN32
+	localtime_s(timeinfo, &t);
+	#else
+	localtime_r(&t, timeinfo);
+	#endif
+}
+
+//
+// Formats a timestamp into the given buffer.
+//
+char *format_timestamp(time_t t, char *buf, unsigned int len)
+{
+	struct tm timeinfo;
+	get_local_time(t, &timeinfo);
+	strftime(buf, len, "%Y-%m-%d %H:%M:00", &timeinfo);
+	return buf;
+}
+
+//
+// Formats a timestamp the same way as format_timestamp(), remembering the
+// local day it was in. The timezone and daylight saving time are only
+// looked up again when a timestamp from another day is formatted, within
+// the day the time is counted from midnight. Days when daylight saving
+// time starts or ends aren't remembered, since they don't have 24 hours.
+//
+char *format_timestamp_cached(timestamp_cache_t *cache, time_t t, char *buf, unsigned int len)
+{
+	struct tm timeinfo;
+	struct tm midnight;
+	struct tm next;
+	unsigned int seconds;
+	size_t date_len;
+	char *s;
+
+	if ((t < cache->day_start) || (t >= cache->day_end))
+	{
+		get_local_time(t, &timeinfo);
+
+		cache->day_start = t - ((timeinfo.tm_hour * 60 + timeinfo.tm_min) * 60 + timeinfo.tm_sec);
+		cache->day_end = cache->day_start + (24 * 60 * 60);
+		get_local_time(cache->day_start, &midnight);
+		get_local_time(cache->day_end, &next);
+
+		if ((midnight.tm_mday != timeinfo.tm_mday)
+		|| midnight.tm_hour || midnight.tm_min || midnight.tm_sec
+		|| next.tm_hour || next.tm_min || next.tm_sec)
+		{
+			cache->day_start = cache->day_end = 0;
+			strftime(buf, len, "%Y-%m-%d %H:%M:00", &timeinfo);
+			return buf;
+		}
+
+		strftime(cache->date, sizeof(cache->date), "%Y-%m-%d ", &timeinfo);
+	}
+
+	date_len = strlen(cache->date);
+
+	if (len < (date_len + 9))
+	{
+		return format_timestamp(t, buf, len);
+	}
+
+	seconds = (unsigned int)(t - cache->day_start);
+	s = buf + date_len;
+	memcpy(buf, cache->date, date_len);
+	s[0] = (char)('0' + (seconds / 3600) / 10);
+	s[1] = (char)('0' + (seconds / 3600) % 10);
+	s[2] = ':';
+	s[3] = (char)('0' + ((seconds / 60) % 60) / 10);
+	s[4] = (char)('0' + ((seconds / 60) % 60) % 10);
+	strcpy(s + 5, ":00");
+
+	return buf;
+}
+
+//
+// Converts a unix date to a BCD date as stored by the weather station.
+//
+void unix_to_bcd_date(time_t t, unsigned char date[5])
+{
+	struct tm timeinfo;
+	int values[5];
+	int i;
+
+	get_local_time(t, &timeinfo);
+
+	values[0] = timeinfo.tm_year % 100;
+	values[1] = timeinfo.tm_mon + 1;
+	values[2] = timeinfo.tm_mday;
+	values[3] = timeinfo.tm_hour;
+	values[4] = timeinfo.tm_min;
+
+	for (i = 0; i < 5; i++)
+	{
+		date[i] = (unsigned char)(((values[i] / 10) << 4) | (values[i] % 10));
+	}
+}
+
+time_t bcd_to_unix_date(bcd_date_t date)
+{
+	time_t rawtime;
+	struct tm timeinfo;
+
+	memset(&timeinfo, 0, sizeof(timeinfo));
+	timeinfo.tm_year	= date.year - 1900;
+	timeinfo.tm_mon		= date.month - 1;
+	timeinfo.tm_mday	= date.day;
+	timeinfo.tm_hour	= date.hour;
+	timeinfo.tm_min		= date.minute;
+	timeinfo.tm_isdst	= 1;
+
+	rawtime = mktime(&timeinfo);
+
+	return rawtime;
+}
+
+void sleep_seconds(unsigned int seconds)
+{
+	#ifdef WIN32
+	Sleep(seconds * 1000);
+	#else
+	sleep(seconds);
+	#endif
+}
+
+void sleep_milliseconds(unsigned int milliseconds)
+{
+	#ifdef WIN32
+	Sleep(milliseconds);
+	#else
+	usleep(milliseconds * 1000);
+	#endif
+}
+
+//
+// Gets a millisecond clock, used to measure elapsed time.
+//
+unsigned long get_milliseconds()
+{
+	#ifdef WIN32
+	return GetTickCount();
+	#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+	#endif
+}
+
+//
+// FNV-1a hash of a number of bytes.
+//
+unsigned int hash_bytes(const unsigned char *bytes, unsigned int len)
+{
+	unsigned int hash = 2166136261u;
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
@@ -1,56 +1,72 @@
-//
-// Weather Station Poller
-//
-// Copyright (C) 2010 Joakim Sderberg
-//
-// This program is free software: you can redistribute it and/or modify
-// it under the terms of the GNU General Public License as published by
-// the Free Software Foundation, either version 3 of the License, or
-// (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-// GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program.  If not, see <http://www.gnu.org/licenses/>.
-//
-
-#ifndef __UTILS_H__
-#define __UTILS_H__
-
-#include <stdio.h>
-#include <stdarg.h>
-#include <string.h>
-#include <stdlib.h>
-#include <string.h>
-#include <assert.h>
-#include <signal.h>
-#include <ctype.h>
-#include <time.h>
-#include <math.h>
-
-typedef struct bcd_date_s
-{
-	unsigned short year;
-	unsigned short month;
-	unsigned short day;
-	unsigned short hour;
-	unsigned short minute;
-} bcd_date_t;
-
-int svn_revision();
-void debug_printf(unsigned int debug_level, const char* format, ... );
-bcd_date_t parse_bcd_date(unsigned char date[5]);
-void print_bcd_date(unsigned char date[5]);
-const char *get_bcd_date_string(unsigned char date[5]);
-const char *get_wind_direction(const char data);
-void print_bytes(unsigned int debug_level, char *bytes, unsigned int len);
-int file_exists(const char *filename);
-char prompt_user();
-char *get_timestamp(time_t t);
-char *get_local_timestamp();
-time_t bcd_to_unix_date(bcd_date_t date);
-
-#endif // __UTILS_H__
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __UTILS_H__
+#define __UTILS_H__
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <ctype.h>
+#include <time.h>
+#include <math.h>
+
+typedef struct bcd_date_s
+{
+	unsigned short year;
+	unsigned short month;
+	unsigned short day;
+	unsigned short hour;
+	unsigned short minute;
+} bcd_date_t;
+
+//
+// The local day the last timestamp formatted was in, see
+// format_timestamp_cached().
+//
+typedef struct timestamp_cache_s
+{
+	time_t day_start;			// Local midnight.
+	time_t day_end;				// The next local midnight.
+	char date[16];				// The date as "YYYY-MM-DD ".
+} timestamp_cache_t;
+
+int svn_revision();
+void debug_printf(unsigned int debug_level, const char* format, ... );
+bcd_date_t parse_bcd_date(unsigned char date[5]);
+void print_bcd_date(unsigned char date[5]);
+const char *get_bcd_date_string(unsigned char date[5], char *buf, unsigned int len);
+const char *get_wind_direction(const char data);
+void print_bytes(unsigned int debug_level, const char *bytes, unsigned int len);
+int file_exists(const char *filename);
+char prompt_user();
+char *format_timestamp(time_t t, char *buf, unsigned int len);
+char *format_timestamp_cached(timestamp_cache_t *cache, time_t t, char *buf, unsigned int len);
+time_t bcd_to_unix_date(bcd_date_t date);
+void unix_to_bcd_date(time_t t, unsigned char date[5]);
+void sleep_seconds(unsigned int seconds);
+void sleep_milliseconds(unsigned int milliseconds);
+unsigned long get_milliseconds();
+unsigned int hash_bytes(const unsigned char *bytes, unsigned int len);
+
+#endif // __UTILS_H__
@@ -1,197 +1,502 @@
-//
-// Weather Station Poller
-//
-// Copyright (C) 2010 Joakim Sderberg
-//
-// This program is free software: you can redistribute it and/or modify
-// it under the terms of the GNU General Public License as published by
-// the Free Software Foundation, either version 3 of the License, or
-// (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-// GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program.  If not, see <http://www.gnu.org/licenses/>.
-//
-
-#include <stdio.h>
-#include "wsp.h"
-#include "utils.h"
-#include "weather.h"
-
-int has_contact_with_sensor(weather_data_t *wdp)
-{
-	return !((wdp->status >> LOST_SENSOR_CONTACT_BIT) & 0x1);
-}
-
-float convert_avg_windspeed(weather_data_t *wdp)
-{
-	return (((wdp->wind_highbyte & 0xf) << 8) | (wdp->avg_wind_lowbyte & 0xff)) * 0.1f;
-}
-
-float convert_gust_windspeed(weather_data_t *wdp)
-{
-	return ((((wdp->wind_highbyte >> 4) & 0xf) << 8) | (wdp->gust_wind_lowbyte & 0xff)) * 0.1f;
-}
-
-float calculate_dewpoint(weather_data_t *wd)
-{
-	#define DEW_A 17.27
-	#define DEW_B 237.7
-	float temp = wd->out_temp * 0.1f;
-	float gamma = (DEW_A * temp / (DEW_B + temp)) + log(wd->out_humidity / 100.0f);
-	float dew_point = DEW_B * gamma / (DEW_A - gamma);
-	return dew_point;
-}
-
-//
-// Court's formula for Heat Loss.
-//
-float calculate_windchill(weather_data_t *wd)
-{
-	float wc;
-	float avg_windspeed = convert_avg_windspeed(wd);
-	float t = wd->out_temp * 0.1f;
-
-	if ((t < 33.0f) && (avg_windspeed >= 1.79f))
-	{
-		wc = 33.0f + ((t - 33.0f) * (0.55f + (0.417f * (float)sqrt(avg_windspeed)) - (0.0454f * avg_windspeed)));
-	}
-	else
-	{
-		wc = t;
-	}
-
-	return wc;
-}
-
-unsigned int calculate_beaufort(float windspeed)
-{
-	float k = 0.8365;
-	return (int)(pow((windspeed / k), (2.0 / 3.0)) + 0.5);
-}
-
-float calculate_rel_pressure(weather_data_t *wd)
-{
-	float p = wd->abs_pressure * 0.1f;
-	float m = program_settings.altitude / (18429.1 + 67.53 * wd->out_temp + 0.003 * program_settings.altitude);
-	p = p * (float)pow(10, m);
-	return p;
-}
-
-//
-// Gets the closest history item to the amount of seconds either forward or backwards in time from the given index.
-//
-weather_item_t *get_history_item_seconds_delta(struct usb_dev_handle *h, weather_settings_t *ws, weather_item_t *history, unsigned int index, int seconds_delta)
-{
-	unsigned int i;
-	int seconds = 0;
-	int delay_seconds = 0;
-
-	if (program_settings.quickrain)
-	{
-		// This is meant for when a small number of items are read, but we still
-		// want accurate weather data.
-		//
-		// We cheat and assume that the delay between each item has always
-		// been weather_settings_t.read_period instead of checking the time between
-		// each history item. This might be inaccurate.
-
-		// The number of items we need to go back to go seconds_delta seconds into the past.
-		int index_delta = (seconds_delta / (ws->read_period * 60));
-		//time_t station_date = bcd_to_unix_date(parse_bcd_date(ws->datetime));
-
-		assert(abs(index_delta) < ws->data_count);
-
-		i = index + index_delta;
-
-		// If we're outside the range of available items we'll
-		// just return the current item instead, so we don't get
-		// inaccurate data (like calculating over 5 hours when we
-		// were asked for 24h).
-		if (i < (unsigned int)(HISTORY_MAX - ws->data_count))
-		{
-			return &history[index];
-		}
-
-		// Fetch the data if it doesn't already exist in the history.
-		if ((history[i].timestamp == 0))
-		{
-			int new_address;
-			int new_index;
-			//unsigned int history_begin = (ws->current_pos + HISTORY_CHUNK_SIZE);
-
-			new_index = history[index].history_index + index_delta;
-			new_address = HISTORY_START + (new_index * HISTORY_CHUNK_SIZE);
-
-			// Read history chunk.
-			history[i].history_index = new_index;
-			history[i].address = new_address;
-			history[i].data = get_history_chunk(h, ws, new_address);
-			history[i].timestamp = (time_t)(history[index].timestamp + seconds_delta);
-			
-			return &history[i];
-		}
-
-		return &history[i];
-	}
-	else
-	{
-		// Go through enough previous (or future) history items relative to the current index
-		// until we find the closest item which is "seconds_delta" seconds from the current history item.
-		for (i = (index - 1); (i > (unsigned int)(HISTORY_MAX - ws->data_count)) && (i < HISTORY_MAX); i--)
-		{
-			// We don't have enough history items to go any further.
-			if (history[i].timestamp == 0)
-				return &history[i-1];
-
-			// TODO: if (has_contact_with_sensor(&history[i].data)) ...
-			delay_seconds = (history[i].data.delay * 60);
-			seconds += delay_seconds;
-
-			if (seconds >= abs(seconds_delta))
-				return &history[i];
-		}
-
-		return &history[i];
-	}
-
-	// If everything failed, just return the current item.
-	return &history[index];
-}
-
-//
-// Calculates the rain since x hours ago.
-//
-float calculate_rain_hours_ago(struct usb_dev_handle *h, weather_settings_t *ws, weather_item_t *history, unsigned int index, unsigned int hours_ago)
-{
-	int seconds_to_go_back	= hours_ago * 60 * 60;
-	weather_item_t *cur		= &history[index];
-	weather_item_t *prev	= get_history_item_seconds_delta(h, ws, history, index, -seconds_to_go_back);
-	float total_rain 		= cur->data.total_rain * 0.3f;
-	float prev_total_rain	= prev->data.total_rain * 0.3f;
-
-	if ((prev->timestamp == 0)
-	|| (abs(cur->timestamp - prev->timestamp) < seconds_to_go_back))
-	{
-		return 0.0;
-	}
-	
-	//printf("< %0.1f - %0.1f = %0.1f >", total_rain, prev_total_rain, (total_rain - prev_total_rain));
-
-	return (total_rain - prev_total_rain);
-}
-
-float calculate_rain_1h(struct usb_dev_handle *h, weather_settings_t *ws, weather_item_t *history, unsigned int index)
-{
-	return calculate_rain_hours_ago(h, ws, history, index, 1);
-}
-
-float calculate_rain_24h(struct usb_dev_handle *h, weather_settings_t *ws, weather_item_t *history, unsigned int index)
-{
-	return calculate_rain_hours_ago(h, ws, history, index, 24);
-}
-
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "wsp.h"
+#include "utils.h"
+#include "weather.h"
+
+//
+// Accessors decoding the readings of a history item.
+//
+unsigned char item_delay(const weather_item_t *item)
+{
+	return item->raw_data[0];
+}
+
+unsigned char item_in_humidity(const weather_item_t *item)
+{
+	return item->raw_data[1];
+}
+
+short item_in_temp(const weather_item_t *item)
+{
+	return FIX_SIGN(item->raw_data[2] | (item->raw_data[3] << 8));
+}
+
+unsigned char item_out_humidity(const weather_item_t *item)
+{
+	return item->raw_data[4];
+}
+
+short item_out_temp(const weather_item_t *item)
+{
+	return FIX_SIGN(item->raw_data[5] | (item->raw_data[6] << 8));
+}
+
+unsigned short item_abs_pressure(const weather_item_t *item)
+{
+	return item->raw_data[7] | (item->raw_data[8] << 8);
+}
+
+unsigned char item_wind_direction(const weather_item_t *item)
+{
+	return item->raw_data[12];
+}
+
+unsigned short item_total_rain(const weather_item_t *item)
+{
+	return item->raw_data[13] | (item->raw_data[14] << 8);
+}
+
+unsigned char item_status(const weather_item_t *item)
+{
+	return item->raw_data[15];
+}
+
+int has_contact_with_sensor(const weather_item_t *item)
+{
+	return !((item_status(item) >> LOST_SENSOR_CONTACT_BIT) & 0x1);
+}
+
+float convert_avg_windspeed(const weather_item_t *item)
+{
+	return (((item->raw_data[11] & 0xf) << 8) | item->raw_data[9]) * 0.1f;
+}
+
+float convert_gust_windspeed(const weather_item_t *item)
+{
+	return (((item->raw_data[11] >> 4) << 8) | item->raw_data[10]) * 0.1f;
+}
+
+//
+// Calculates the dew point from the outdoor temperature and humidity.
+//
+float compute_dewpoint(float temp, unsigned int humidity)
+{
+	#define DEW_A 17.27
+	#define DEW_B 237.7
+	float gamma = (DEW_A * temp / (DEW_B + temp)) + log(humidity / 100.0f);
+	float dew_point = DEW_B * gamma / (DEW_A - gamma);
+	return dew_point;
+}
+
+float calculate_dewpoint(const weather_item_t *item)
+{
+	return compute_dewpoint(item_out_temp(item) * 0.1f, item_out_humidity(item));
+}
+
+//
+// Court's formula for Heat Loss.
+//
+float compute_windchill(float t, float avg_windspeed)
+{
+	float wc;
+
+	if ((t < 33.0f) && (avg_windspeed >= 1.79f))
+	{
+		wc = 33.0f + ((t - 33.0f) * (0.55f + (0.417f * (float)sqrt(avg_windspeed)) - (0.0454f * avg_windspeed)));
+	}
+	else
+	{
+		wc = t;
+	}
+
+	return wc;
+}
+
+float calculate_windchill(const weather_item_t *item)
+{
+	return compute_windchill(item_out_temp(item) * 0.1f, convert_avg_windspeed(item));
+}
+
+unsigned int calculate_beaufort(float windspeed)
+{
+	float k = 0.8365;
+	return (int)(pow((windspeed / k), (2.0 / 3.0)) + 0.5);
+}
+
+//
+// Calculates the relative pressure from the absolute pressure, the outdoor
+// temperature as read from the station, and the altitude.
+//
+float compute_rel_pressure(unsigned short abs_pressure, short out_temp)
+{
+	float p = abs_pressure * 0.1f;
+	float m = program_settings.altitude / (18429.1 + 67.53 * out_temp + 0.003 * program_settings.altitude);
+	p = p * (float)pow(10, m);
+	return p;
+}
+
+float calculate_rel_pressure(const weather_item_t *item)
+{
+	return compute_rel_pressure(item_abs_pressure(item), item_out_temp(item));
+}
+
+static const weather_item_t empty_item;
+
+//
+// Gets a history item by its index. Items that haven't been read are empty,
+// with a zero timestamp. The empty item is only cleared if it has been
+// changed, so threads sharing the history don't write to it.
+//
+weather_item_t *get_history_item(weather_history_t *history, unsigned int index)
+{
+	if ((index < history->first) || (index >= HISTORY_MAX) || !history->items)
+	{
+		if (memcmp(&history->empty, &empty_item, sizeof(history->empty)))
+		{
+			memset(&history->empty, 0, sizeof(history->empty));
+		}
+
+		return &history->empty;
+	}
+
+	return &history->items[index - history->first];
+}
+
+//
+// Checks if the rain counter wrapped around between two consecutive history
+// items. The counter is 16 bits, and the station sets the overflow bit when
+// it wraps. If it goes backwards otherwise it has been reset.
+//
+static int has_rain_wrapped(const weather_item_t *prev, const weather_item_t *item)
+{
+	return (item_total_rain(item) < item_total_rain(prev))
+		&& ((item_status(item) >> RAIN_COUNTER_OVERFLOW_BIT) & 0x1);
+}
+
+//
+// Builds the running totals of the delays, and of the times the rain
+// counter has wrapped, for the items read. So that the rain over a period
+// is found without walking through all the items in it.
+//
+static int build_rain_index(weather_history_t *history)
+{
+	unsigned int count = HISTORY_MAX - history->first;
+	unsigned int k;
+
+	history->elapsed = (unsigned int *)malloc(max(count, 1) * sizeof(unsigned int));
+	history->rain_wraps = (unsigned int *)malloc(max(count, 1) * sizeof(unsigned int));
+
+	if (!history->elapsed || !history->rain_wraps)
+	{
+		fprintf(stderr, "Out of memory\n");
+		free(history->elapsed);
+		free(history->rain_wraps);
+		history->elapsed = NULL;
+		history->rain_wraps = NULL;
+		return -1;
+	}
+
+	for (k = 0; k < count; k++)
+	{
+		history->elapsed[k] = item_delay(&history->items[k]) * 60;
+		history->rain_wraps[k] = 0;
+
+		if (k > 0)
+		{
+			history->elapsed[k] += history->elapsed[k - 1];
+			history->rain_wraps[k] = history->rain_wraps[k - 1] + has_rain_wrapped(&history->items[k - 1], &history->items[k]);
+		}
+	}
+
+	return 0;
+}
+
+//
+// Builds the rain index up front. After that the rain calculations don't
+// change the history, so it can be shared between threads.
+//
+int prepare_rain_index(weather_history_t *history)
+{
+	return history->elapsed ? 0 : build_rain_index(history);
+}
+
+//
+// Gets the total of the delays of the items up to and including the given
+// index, counted from the first item read.
+//
+static unsigned int get_elapsed(weather_history_t *history, int index)
+{
+	return (index < (int)history->first) ? 0 : history->elapsed[index - history->first];
+}
+
+//
+// Gets the closest item before the given index where the delays of the
+// items from it up to the one before the index add up to the given number
+// of seconds. Items before the lower index, which is the oldest item in the
+// station, aren't looked at. If there are not enough items read, an empty
+// item is returned, and if the lower index is reached that item is.
+//
+static weather_item_t *find_history_item_seconds_back(weather_history_t *history, unsigned int index, unsigned int seconds, unsigned int lower)
+{
+	int high = (int)index - 1;
+	int low = max((int)lower + 1, (int)history->first);
+	int found = -1;
+	unsigned int end;
+
+	if (!history->elapsed && build_rain_index(history))
+	{
+		return get_history_item(history, index);
+	}
+
+	if (high < low)
+	{
+		return get_history_item(history, high);
+	}
+
+	end = get_elapsed(history, high);
+
+	while (low <= high)
+	{
+		int mid = low + (high - low) / 2;
+
+		if ((end - get_elapsed(history, mid - 1)) >= seconds)
+		{
+			found = mid;
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid - 1;
+		}
+	}
+
+	if (found < 0)
+	{
+		// Either the oldest item or an empty one.
+		found = max((int)lower + 1, (int)history->first) - 1;
+	}
+
+	return get_history_item(history, found);
+}
+
+//
+// Gets the closest history item to the amount of seconds either forward or backwards in time from the given index.
+//
+weather_item_t *get_history_item_seconds_delta(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index, int seconds_delta)
+{
+	unsigned int i;
+	weather_item_t *item;
+
+	if (program_settings.quickrain)
+	{
+		// This is meant for when a small number of items are read, but we still
+		// want accurate weather data.
+		//
+		// We cheat and assume that the delay between each item has always
+		// been weather_settings_t.read_period instead of checking the time between
+		// each history item. This might be inaccurate.
+
+		// The number of items we need to go back to go seconds_delta seconds into the past.
+		int index_delta = (seconds_delta / (ws->read_period * 60));
+		//time_t station_date = bcd_to_unix_date(parse_bcd_date(ws->datetime));
+
+		assert(abs(index_delta) < ws->data_count);
+
+		i = index + index_delta;
+
+		// If we're outside the range of available items we'll
+		// just return the current item instead, so we don't get
+		// inaccurate data (like calculating over 5 hours when we
+		// were asked for 24h). The same goes if there's no room
+		// for the item, see read_weather_data().
+		if ((i < (unsigned int)(HISTORY_MAX - ws->data_count))
+			|| (i < history->first))
+		{
+			return get_history_item(history, index);
+		}
+
+		item = get_history_item(history, i);
+
+		// Fetch the data if it doesn't already exist in the history.
+		if ((item->timestamp == 0))
+		{
+			int new_address;
+			int new_index;
+			//unsigned int history_begin = (ws->current_pos + HISTORY_CHUNK_SIZE);
+
+			new_index = get_history_item(history, index)->history_index + index_delta;
+			new_address = HISTORY_START + (new_index * HISTORY_CHUNK_SIZE);
+
+			// Read history chunk.
+			item->history_index = new_index;
+			item->address = new_address;
+			get_history_chunk(dev, ws, new_address, item->raw_data);
+			item->timestamp = (time_t)(get_history_item(history, index)->timestamp + seconds_delta);
+		}
+
+		return item;
+	}
+	else
+	{
+		// Find the closest item before the current one which is "seconds_delta"
+		// seconds from it, the same as walking back through the items and adding
+		// up their delays, but with a binary search in the running total.
+		return find_history_item_seconds_back(history, index, abs(seconds_delta), HISTORY_MAX - ws->data_count);
+	}
+
+	// If everything failed, just return the current item.
+	return get_history_item(history, index);
+}
+
+//
+// Calculates the rain since x hours ago.
+//
+float calculate_rain_hours_ago(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index, unsigned int hours_ago)
+{
+	int seconds_to_go_back	= hours_ago * 60 * 60;
+	weather_item_t *cur		= get_history_item(history, index);
+	weather_item_t *prev	= get_history_item_seconds_delta(dev, ws, history, index, -seconds_to_go_back);
+	float total_rain 		= item_total_rain(cur) * 0.3f;
+	float prev_total_rain	= item_total_rain(prev) * 0.3f;
+
+	if ((prev->timestamp == 0)
+	|| (abs(cur->timestamp - prev->timestamp) < seconds_to_go_back))
+	{
+		return 0.0;
+	}
+
+	// Add the rain that went by each time the counter wrapped around.
+	if (history->rain_wraps && (prev >= history->items) && (prev < cur))
+	{
+		total_rain += (history->rain_wraps[index - history->first] - history->rain_wraps[prev - history->items]) * (0x10000 * 0.3f);
+	}
+	
+	//printf("< %0.1f - %0.1f = %0.1f >", total_rain, prev_total_rain, (total_rain - prev_total_rain));
+
+	return (total_rain - prev_total_rain);
+}
+
+float calculate_rain_1h(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index)
+{
+	return calculate_rain_hours_ago(dev, ws, history, index, 1);
+}
+
+float calculate_rain_24h(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index)
+{
+	return calculate_rain_hours_ago(dev, ws, history, index, 24);
+}
+
+//
+// The length of the rain windows in the EasyWeather output. The last hour,
+// 24 hours, 7 days, 30 days and year.
+//
+static const unsigned int rain_window_seconds[RAIN_WINDOW_COUNT] =
+{
+	60 * 60,
+	24 * 60 * 60,
+	7 * 24 * 60 * 60,
+	30 * 24 * 60 * 60,
+	365 * 24 * 60 * 60
+};
+
+//
+// Gets the rain counter of an item, including the times it has wrapped
+// around since the first item read.
+//
+static long get_rain_ticks(weather_history_t *history, unsigned int index)
+{
+	unsigned int k = index - history->first;
+
+	return item_total_rain(&history->items[k]) + (long)history->rain_wraps[k] * 0x10000;
+}
+
+//
+// Starts the rain windows at the first item read. That can be before the
+// first item output, see read_weather_data().
+//
+void init_rain_windows(rain_windows_t *rain, weather_history_t *history, weather_settings_t *ws)
+{
+	int i;
+
+	rain->history = history;
+	rain->stored_seconds = HISTORY_MAX * max(ws->read_period, 1) * 60;
+
+	for (i = 0; i < RAIN_WINDOW_COUNT; i++)
+	{
+		rain->tails[i] = history->first;
+	}
+}
+
+//
+// Gets the rain since the previous item, and in each of the rain windows,
+// for the item at index. A window starts at the latest item that is at least
+// the length of the window older than this one. If the history read doesn't
+// go back that far the rain in the window isn't known, and is 0 like in
+// calculate_rain_hours_ago().
+//
+// A window longer than the station's whole history, like the year, or 30
+// days at the default 5 minute period, can never be covered. For those the
+// rain since the first item read is given instead, the EasyWeather output
+// reads all of the history for them, see read_weather_data().
+//
+// The items must be passed in chronological order. That way the windows only
+// ever move forward, and the rain for all the items is found in one pass
+// instead of going back through the whole window for each of them.
+//
+void advance_rain_windows(rain_windows_t *rain, unsigned int index, float rain_mm[RAIN_WINDOW_COUNT + 1])
+{
+	weather_history_t *history = rain->history;
+	unsigned int *tail;
+	time_t now;
+	long ticks;
+	int i;
+
+	memset(rain_mm, 0, (RAIN_WINDOW_COUNT + 1) * sizeof(float));
+
+	if ((index < history->first) || (index >= HISTORY_MAX))
+	{
+		return;
+	}
+
+	if (!history->rain_wraps && build_rain_index(history))
+	{
+		return;
+	}
+
+	ticks = get_rain_ticks(history, index);
+	now = get_history_item(history, index)->timestamp;
+
+	if ((index > history->first) && get_history_item(history, index - 1)->timestamp)
+	{
+		rain_mm[0] = (ticks - get_rain_ticks(history, index - 1)) * 0.3f;
+	}
+
+	for (i = 0; i < RAIN_WINDOW_COUNT; i++)
+	{
+		tail = &rain->tails[i];
+
+		while ((*tail < index)
+			&& ((now - get_history_item(history, *tail + 1)->timestamp) >= (time_t)rain_window_seconds[i]))
+		{
+			(*tail)++;
+		}
+
+		// Items that haven't been read have no timestamp.
+		if (get_history_item(history, *tail)->timestamp
+			&& (((now - get_history_item(history, *tail)->timestamp) >= (time_t)rain_window_seconds[i])
+				|| ((rain_window_seconds[i] > rain->stored_seconds) && (*tail < index))))
+		{
+			rain_mm[i + 1] = (ticks - get_rain_ticks(history, *tail)) * 0.3f;
+		}
+	}
+}
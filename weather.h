@@ -1,35 +1,51 @@
-//
-// Weather Station Poller
-//
-// Copyright (C) 2010 Joakim Sderberg
-//
-// This program is free software: you can redistribute it and/or modify
-// it under the terms of the GNU General Public License as published by
-// the Free Software Foundation, either version 3 of the License, or
-// (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-// GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program.  If not, see <http://www.gnu.org/licenses/>.
-//
-
-#ifndef __WEATHER_H__
-#define __WEATHER_H__
-
-int has_contact_with_sensor(weather_data_t *wdp);
-float convert_avg_windspeed(weather_data_t *wdp);
-float convert_gust_windspeed(weather_data_t *wdp);
-float calculate_dewpoint(weather_data_t *wd);
-float calculate_windchill(weather_data_t *wd);
-unsigned int calculate_beaufort(float windspeed);
-float calculate_rel_pressure(weather_data_t *wd);
-weather_item_t *get_history_item_seconds_delta(struct usb_dev_handle *h, weather_settings_t *ws, weather_item_t *history, unsigned int index, int seconds_delta);
-float calculate_rain_hours_ago(struct usb_dev_handle *h, weather_settings_t *ws, weather_item_t *history, unsigned int index, unsigned int hours_ago);
-float calculate_rain_1h(struct usb_dev_handle *h, weather_settings_t *ws, weather_item_t *history, unsigned int index);
-float calculate_rain_24h(struct usb_dev_handle *h, weather_settings_t *ws, weather_item_t *history, unsigned int index);
-
-#endif // __WEATHER_H__
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __WEATHER_H__
+#define __WEATHER_H__
+
+unsigned char item_delay(const weather_item_t *item);
+unsigned char item_in_humidity(const weather_item_t *item);
+short item_in_temp(const weather_item_t *item);
+unsigned char item_out_humidity(const weather_item_t *item);
+short item_out_temp(const weather_item_t *item);
+unsigned short item_abs_pressure(const weather_item_t *item);
+unsigned char item_wind_direction(const weather_item_t *item);
+unsigned short item_total_rain(const weather_item_t *item);
+unsigned char item_status(const weather_item_t *item);
+int has_contact_with_sensor(const weather_item_t *item);
+float convert_avg_windspeed(const weather_item_t *item);
+float convert_gust_windspeed(const weather_item_t *item);
+float compute_dewpoint(float temp, unsigned int humidity);
+float calculate_dewpoint(const weather_item_t *item);
+float compute_windchill(float t, float avg_windspeed);
+float calculate_windchill(const weather_item_t *item);
+unsigned int calculate_beaufort(float windspeed);
+float compute_rel_pressure(unsigned short abs_pressure, short out_temp);
+float calculate_rel_pressure(const weather_item_t *item);
+weather_item_t *get_history_item(weather_history_t *history, unsigned int index);
+int prepare_rain_index(weather_history_t *history);
+weather_item_t *get_history_item_seconds_delta(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index, int seconds_delta);
+float calculate_rain_hours_ago(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index, unsigned int hours_ago);
+float calculate_rain_1h(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index);
+float calculate_rain_24h(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int index);
+void init_rain_windows(rain_windows_t *rain, weather_history_t *history, weather_settings_t *ws);
+void advance_rain_windows(rain_windows_t *rain, unsigned int index, float rain_mm[RAIN_WINDOW_COUNT + 1]);
+
+#endif // __WEATHER_H__
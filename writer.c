@@ -0,0 +1,367 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// ------------------------------------------------------------------------
+//
+// The history is output through a writer, which formats the numbers itself
+// into a buffer. So no printf is done for each field, and the output is
+// written in a few large blocks.
+//
+// The writer writes to a FILE, so anything printed to it before is output
+// in the right order. Large writes go straight through to the file.
+// Without a file the writer keeps everything in memory instead, so parts
+// of the output can be formatted separately and put together afterwards.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "utils.h"
+#include "writer.h"
+
+static const char hex_upper[] = "0123456789ABCDEF";
+static const char hex_lower[] = "0123456789abcdef";
+
+//
+// Starts a writer for a file, or for memory if the file is NULL. If there's
+// no memory for the buffer everything is written straight to the file instead.
+//
+void writer_init(writer_t *w, FILE *f)
+{
+	w->f = f;
+	w->len = 0;
+	w->total = 0;
+	memset(w->dates, 0, sizeof(w->dates));
+
+	if ((w->data = (char *)malloc(WRITER_BUFFER_SIZE)))
+	{
+		w->size = WRITER_BUFFER_SIZE;
+	}
+	else
+	{
+		w->size = 0;
+	}
+}
+
+//
+// Flushes and frees a writer.
+//
+void writer_free(writer_t *w)
+{
+	writer_flush(w);
+	free(w->data);
+	w->data = NULL;
+	w->size = 0;
+}
+
+//
+// Writes what is in the buffer to the file.
+//
+void writer_flush(writer_t *w)
+{
+	if (w->f && (w->len > 0))
+	{
+		fwrite(w->data, 1, w->len, w->f);
+		w->len = 0;
+	}
+}
+
+//
+// Makes room for at least n more bytes in a writer without a file.
+//
+static int writer_grow(writer_t *w, size_t n)
+{
+	size_t size = w->size ? w->size : WRITER_BUFFER_SIZE;
+	char *data;
+
+	while ((w->len + n) > size)
+	{
+		size *= 2;
+	}
+
+	if (!(data = (char *)realloc(w->data, size)))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	w->data = data;
+	w->size = size;
+
+	return 0;
+}
+
+//
+// Adds bytes to the buffer.
+//
+void writer_bytes(writer_t *w, const char *s, size_t n)
+{
+	w->total += (long)n;
+
+	if (!w->f)
+	{
+		if (((w->len + n) > w->size) && writer_grow(w, n))
+		{
+			return;
+		}
+	}
+	else if ((w->len + n) > w->size)
+	{
+		writer_flush(w);
+
+		if (n > w->size)
+		{
+			fwrite(s, 1, n, w->f);
+			return;
+		}
+	}
+
+	memcpy(w->data + w->len, s, n);
+	w->len += n;
+}
+
+void writer_str(writer_t *w, const char *s)
+{
+	writer_bytes(w, s, strlen(s));
+}
+
+void writer_char(writer_t *w, char c)
+{
+	writer_bytes(w, &c, 1);
+}
+
+//
+// Formats an unsigned number, padded to at least width characters.
+// The same as printf "%u", "%2u" or "%02u".
+//
+void writer_uint(writer_t *w, unsigned int v, unsigned int width, char pad)
+{
+	char buf[16];
+	char *s = buf + sizeof(buf);
+
+	do
+	{
+		*--s = (char)('0' + (v % 10));
+		v /= 10;
+	} while (v);
+
+	while ((unsigned int)((buf + sizeof(buf)) - s) < width)
+	{
+		*--s = pad;
+	}
+
+	writer_bytes(w, s, (buf + sizeof(buf)) - s);
+}
+
+//
+// Formats a signed number, the same as printf "%d".
+//
+void writer_int(writer_t *w, int v)
+{
+	if (v < 0)
+	{
+		writer_char(w, '-');
+		writer_uint(w, 0U - (unsigned int)v, 0, ' ');
+	}
+	else
+	{
+		writer_uint(w, (unsigned int)v, 0, ' ');
+	}
+}
+
+//
+// Formats a hexadecimal number, zero padded to at least width digits.
+// The same as printf "%X", "%02X" or "%06x".
+//
+void writer_hex(writer_t *w, unsigned int v, unsigned int width, int upper)
+{
+	const char *digits = upper ? hex_upper : hex_lower;
+	char buf[16];
+	char *s = buf + sizeof(buf);
+
+	do
+	{
+		*--s = digits[v & 0xf];
+		v >>= 4;
+	} while (v);
+
+	while ((unsigned int)((buf + sizeof(buf)) - s) < width)
+	{
+		*--s = '0';
+	}
+
+	writer_bytes(w, s, (buf + sizeof(buf)) - s);
+}
+
+//
+// Formats a number with 0 or 1 decimals, padded with spaces to at least
+// width characters. The same as printf "%0.1f", "%4.1f" or "%0.0f".
+//
+// A float times 10 fits exactly in a double, so rounding that to the
+// nearest integer, with ties to even, gives the same digits as printf.
+// Anything that isn't an ordinary number is left to printf.
+//
+void writer_fixed(writer_t *w, float v, unsigned int decimals, unsigned int width)
+{
+	double scaled = (double)v * ((decimals > 0) ? 10.0 : 1.0);
+	char buf[64];
+	char *s = buf + sizeof(buf);
+	int negative = (v < 0) || ((v == 0) && ((1.0 / v) < 0));
+	unsigned int n;
+
+	if (!(fabs(scaled) < 1e9))
+	{
+		char fmt[16];
+		int len;
+
+		snprintf(fmt, sizeof(fmt), "%%%u.%uf", width, decimals);
+		len = snprintf(buf, sizeof(buf), fmt, v);
+		writer_bytes(w, buf, (len > 0) ? (size_t)len : 0);
+		return;
+	}
+
+	n = (unsigned int)fabs(nearbyint(scaled));
+
+	if (decimals > 0)
+	{
+		*--s = (char)('0' + (n % 10));
+		*--s = '.';
+		n /= 10;
+	}
+
+	do
+	{
+		*--s = (char)('0' + (n % 10));
+		n /= 10;
+	} while (n);
+
+	if (negative)
+	{
+		*--s = '-';
+	}
+
+	while ((unsigned int)((buf + sizeof(buf)) - s) < width)
+	{
+		*--s = ' ';
+	}
+
+	writer_bytes(w, s, (buf + sizeof(buf)) - s);
+}
+
+//
+// Formats a timestamp as a local date and time, the same as
+// format_timestamp(). Two days are remembered, since the time the history
+// was read is usually on another day than the history items.
+//
+void writer_timestamp(writer_t *w, time_t t)
+{
+	timestamp_cache_t *cache = &w->dates[0];
+	char buf[32];
+
+	if ((t < cache->day_start) || (t >= cache->day_end))
+	{
+		cache = &w->dates[1];
+
+		if ((t < cache->day_start) || (t >= cache->day_end))
+		{
+			w->dates[1] = w->dates[0];
+			cache = &w->dates[0];
+		}
+	}
+
+	writer_str(w, format_timestamp_cached(cache, t, buf, sizeof(buf)));
+}
+
+//
+// Formats a timestamp as the number of seconds since the epoch.
+//
+void writer_time(writer_t *w, time_t t)
+{
+	char buf[32];
+	char *s = buf + sizeof(buf);
+	int negative = (t < 0);
+
+	do
+	{
+		*--s = (char)('0' + (negative ? -(t % 10) : (t % 10)));
+		t /= 10;
+	} while (t);
+
+	if (negative)
+	{
+		*--s = '-';
+	}
+
+	writer_bytes(w, s, (buf + sizeof(buf)) - s);
+}
+
+//
+// Formats a string as a quoted JSON string.
+//
+void writer_json_string(writer_t *w, const char *s)
+{
+	const char *start;
+
+	writer_char(w, '"');
+
+	while (*s)
+	{
+		// Copy everything that doesn't need escaping in one go.
+		for (start = s; *s && (*s != '"') && (*s != '\\') && ((unsigned char)*s >= 0x20); s++);
+		writer_bytes(w, start, s - start);
+
+		if (!*s)
+		{
+			break;
+		}
+
+		writer_char(w, '\\');
+
+		switch (*s)
+		{
+			case '"':	writer_char(w, '"'); break;
+			case '\\':	writer_char(w, '\\'); break;
+			case '\n':	writer_char(w, 'n'); break;
+			case '\r':	writer_char(w, 'r'); break;
+			case '\t':	writer_char(w, 't'); break;
+			default:	writer_str(w, "u00"); writer_hex(w, (unsigned char)*s, 2, 0); break;
+		}
+
+		s++;
+	}
+
+	writer_char(w, '"');
+}
+
+//
+// Formats a number for JSON. JSON has no infinity or NaN, those are
+// output as null.
+//
+void writer_json_fixed(writer_t *w, float v, unsigned int decimals)
+{
+	if (!(fabs(v) <= FLT_MAX))
+	{
+		writer_str(w, "null");
+		return;
+	}
+
+	writer_fixed(w, v, decimals, 0);
+}
@@ -0,0 +1,55 @@
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+#define WRITER_BUFFER_SIZE (64 * 1024)
+
+//
+// Formats output into a buffer, which is written to the file in large
+// blocks instead of a field at a time.
+//
+typedef struct writer_s
+{
+	FILE *f;
+	char *data;
+	size_t size;
+	size_t len;
+	long total;					// The number of bytes output so far, flushed or not.
+	timestamp_cache_t dates[2];	// The last two days timestamps were formatted for.
+} writer_t;
+
+void writer_init(writer_t *w, FILE *f);
+void writer_free(writer_t *w);
+void writer_flush(writer_t *w);
+void writer_bytes(writer_t *w, const char *s, size_t n);
+void writer_str(writer_t *w, const char *s);
+void writer_char(writer_t *w, char c);
+void writer_uint(writer_t *w, unsigned int v, unsigned int width, char pad);
+void writer_int(writer_t *w, int v);
+void writer_hex(writer_t *w, unsigned int v, unsigned int width, int upper);
+void writer_fixed(writer_t *w, float v, unsigned int decimals, unsigned int width);
+void writer_timestamp(writer_t *w, time_t t);
+void writer_time(writer_t *w, time_t t);
+void writer_json_string(writer_t *w, const char *s);
+void writer_json_fixed(writer_t *w, float v, unsigned int decimals);
+
+#endif // __WRITER_H__
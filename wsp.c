@@ -1,914 +1,2093 @@
-//
-// Weather Station Poller
-//
-// Copyright (C) 2010 Joakim Sderberg
-//
-// This program is free software: you can redistribute it and/or modify
-// it under the terms of the GNU General Public License as published by
-// the Free Software Foundation, either version 3 of the License, or
-// (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-// GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program.  If not, see <http://www.gnu.org/licenses/>.
-//
-// ------------------------------------------------------------------------
-//
-// This program is designed to interface with the Fineoffset line
-// of weather stations (WP1400, WH1080, WH1081, W-8681, etc).
-//
-// The information about how the data is stored on the device is
-// based on information from Jim Easterbrooks webpage
-// (http://www.jim-easterbrook.me.uk/weather/mm/)
-// including the EasyWeather.dat layout
-// (http://www.jim-easterbrook.me.uk/weather/ew/).
-//
-
-#include <stdio.h>
-#include <stdarg.h>
-#include <string.h>
-#include <stdlib.h>
-#include <string.h>
-#include <assert.h>
-#include <signal.h>
-#include <ctype.h>
-#include <time.h>
-#include <math.h>
-#include <getopt.h>
-#include "wsp.h"
-#include "wspusb.h"
-#include "memory.h"
-#include "utils.h"
-#include "output.h"
-#include "weather.h"
-
-program_settings_t program_settings;
-
-typedef unsigned char byte;
-
-struct usb_dev_handle *devh;
-unsigned int debug = 0;
-
-//
-// Shows usage.
-//
-void show_usage(char *program_name)
-{
-	printf("Weather Station Poller v%u.%u build %d\n", MAJOR_VERSION, MINOR_VERSION, svn_revision());
-	printf("Copyright (C) Joakim Sderberg.\n");
-	printf("  Usage: %s [option]... \n", program_name);
-	printf("\n");
-	printf("  -e, --easyweather     Outputs the weather data in the\n");
-	printf("                        easyweather.dat csv format.\n");
-	printf("  -s, --status          Shows status of the device, such\n");
-	printf("                        as data count, date/time.\n");
-	printf("  --settings            Prints the weather display's settings.\n");
-	printf("  --maxmin              Outputs the max/min weather data\n");
-	printf("                        recorded by the station.\n");
-	printf("  --alarms              Displays all alarms set on the device\n");
-	printf("                        and if they're enabled.\n");
-	printf("  -c, --count #	        The number of history items to read (1-4080).\n");
-	printf("                        Default is 1.\n");
-	printf("  -a, --all             Gets all available history items.\n");
-	printf("  -v[v..]               Shows extra debug information. For more\n");
-	printf("                        detailed info, add more v's.\n");
-	printf("  -t, --timezone #      Sets the timezone offset from CET\n");
-	printf("                        from -12 to 12.\n");
-	printf("  -d, --delay #         Sets the read update delay between\n");
-	printf("                        weather data readings.\n");
-	printf("  -A, --altitude #      Sets the altitude in m over sea level in meters.\n");
-	printf("                        This is not saved anywhere, so it must be\n");
-	printf("                        specified on each call. Used to calculate\n");
-	printf("                        relative pressure.\n");
-	printf("  --quickrain           Enables faster, and potentially inaccurate rain\n");
-	printf("                        calculations. Instead of checking the time between\n");
-	printf("                        each history item to get the accurate timestamp\n");
-	printf("                        the delay is used. This will result in incorrect\n");
-	printf("                        values if you changed the delay without resetting\n");
-	printf("                        the memory. Notice that rain over 1h, 24h and so on\n");
-	printf("                        might be calculated incorrectly.\n");
-	printf("  --vendorid #          Changes the vendor id, should be in hex format.\n");
-    printf("                        Default is %x.\n", VENDOR_ID);
-	printf("  --productid #         Changes the product id, should be in hex format.\n");
-	printf("                        Default is %x.\n", PRODUCT_ID);
-	printf("  --format <string>     Writes the output in the given format.\n");
-	printf("  --formatlist          Lists available format string variables.\n");
-	printf("  --dumpmem <path>      Dumps the entire weather station memory to a file.\n");
-	printf("  --infile <path>       Uses a file as input instead of reading from the\n");
-	printf("                        weather station memory. Use output from --dumpmem.\n");
-	printf("  --reset               Resets all the data on the weather station.\n");
-	printf("  --write #             Write a byte to a given address\n");
-	printf("  --summary             Shows a small summary of the last recorded weather.\n");
-	printf("  -h, --help            Shows this help text.\n");
-	printf("\n");
-}
-
-//
-// Handles SIGTERM.
-//
-void sigterm_handler(int signum)
-{
-	fprintf(stderr, "SIGTERM: Closing device\n");
-	close_device(devh);
-	exit(1);
-}
-
-void set_wind_direction(char *winddir, const char data)
-{
-	strcpy(winddir, get_wind_direction(data));
-}
-
-//
-// Gets the raw bytes of the weather settings block.
-//
-void get_settings_block_raw(struct usb_dev_handle *h, char *buf, unsigned int len)
-{
-	unsigned int offset;
-
-	assert(len <= WEATHER_SETTINGS_CHUNK_SIZE);
-	assert((len % 32) == 0);
-
-	memset(buf, 0, len);
-
-	// Read 256 bytes in 32-byte chunks.
-	for (offset = 0; (offset < WEATHER_SETTINGS_CHUNK_SIZE) && (offset < len); offset += 32)
-	{
-		// TODO: Check for error here.
-		read_weather_address(h, offset, &buf[offset]);
-		
-		print_bytes(2, &buf[offset], 32);
-	}
-}
-
-//
-// Gets the weather settings block (the first 256 bytes in the weather display memory).
-//
-weather_settings_t get_settings_block(struct usb_dev_handle *h)
-{
-	weather_settings_t ws;
-	char buf[WEATHER_SETTINGS_CHUNK_SIZE];
-
-	memset(&ws, 0, sizeof(ws));
-
-	get_settings_block_raw(h, buf, sizeof(buf));
-
-	ws.magic_number[0]				= buf[0];
-	ws.magic_number[1]				= buf[1];
-	ws.read_period					= buf[16];
-	ws.unit_settings1				= buf[17];
-	ws.unit_settings2				= buf[18];
-	ws.display_options1 			= buf[19];
-	ws.display_options2 			= buf[20];
-	ws.alarm_enable1				= buf[21];
-	ws.alarm_enable2				= buf[22];
-	ws.alarm_enable3				= buf[23];
-	ws.timezone						= buf[24];
-	ws.data_refreshed				= buf[26];
-	ws.data_count					= (buf[27] & 0xff) | (buf[28] << 8);
-	ws.current_pos					= (buf[30] & 0xff) | (buf[31] << 8);
-	ws.relative_pressure			= (buf[32] & 0xff) | (buf[33] << 8);
-	ws.absolute_pressure			= (buf[34] & 0xff) | (buf[35] << 8);
-	memcpy(&ws.unknown, &buf[36], 7);
-	memcpy(&ws.datetime, &buf[43], 5);
-	ws.alarm_inhumid_high			= buf[48];
-	ws.alarm_inhumid_low			= buf[49];
-	ws.alarm_intemp_high			= FIX_SIGN((buf[50] & 0xff) | (buf[51] << 8));
-	ws.alarm_intemp_low				= FIX_SIGN((buf[52] & 0xff) | (buf[53] << 8));
-	ws.alarm_outhumid_high			= buf[54];
-	ws.alarm_outhumid_low			= buf[55];
-	ws.alarm_outtemp_high			= FIX_SIGN((buf[56] & 0xff) | (buf[57] << 8));
-	ws.alarm_outtemp_low			= FIX_SIGN((buf[58] & 0xff) | (buf[59] << 8));
-	ws.alarm_windchill_high			= FIX_SIGN((buf[60] & 0xff) | (buf[61] << 8));
-	ws.alarm_windchill_low			= FIX_SIGN((buf[62] & 0xff) | (buf[63] << 8));
-	ws.alarm_dewpoint_high			= FIX_SIGN((buf[64] & 0xff) | (buf[65] << 8));
-	ws.alarm_dewpoint_low			= FIX_SIGN((buf[66] & 0xff) | (buf[67] << 8));
-	ws.alarm_abs_pressure_high		= (buf[68] & 0xff) | (buf[69] << 8);
-	ws.alarm_abs_pressure_low		= (buf[70] & 0xff) | (buf[71] << 8);
-	ws.alarm_rel_pressure_high		= (buf[72] & 0xff) | (buf[73] << 8);
-	ws.alarm_rel_pressure_low		= (buf[74] & 0xff) | (buf[75] << 8);
-	ws.alarm_avg_wspeed_beaufort	= buf[76];
-	ws.alarm_avg_wspeed_ms			= buf[77];
-	ws.alarm_gust_wspeed_beaufort 	= buf[79];
-	ws.alarm_gust_wspeed_ms			= buf[80];
-	ws.alarm_wind_direction			= buf[82];
-	ws.alarm_rain_hourly			= (buf[83] & 0xff) | (buf[84] << 8);
-	ws.alarm_rain_daily				= (buf[85] & 0xff) | (buf[86] << 8);
-	ws.alarm_time					= (buf[87] & 0xff) | (buf[88] << 8);
-	ws.max_inhumid					= buf[98];
-	ws.min_inhumid					= buf[99];
-	ws.max_outhumid					= buf[100];
-	ws.min_outhumid					= buf[101];
-	ws.max_intemp					= FIX_SIGN((buf[102] & 0xff) | (buf[103] << 8));
-	ws.min_intemp					= FIX_SIGN((buf[104] & 0xff) | (buf[105] << 8));
-	ws.max_outtemp					= FIX_SIGN((buf[106] & 0xff) | (buf[107] << 8));
-	ws.min_outtemp					= FIX_SIGN((buf[108] & 0xff) | (buf[109] << 8));
-	ws.max_windchill				= FIX_SIGN((buf[110] & 0xff) | (buf[111] << 8));
-	ws.min_windchill				= FIX_SIGN((buf[112] & 0xff) | (buf[113] << 8));
-	ws.max_dewpoint					= FIX_SIGN((buf[114] & 0xff) | (buf[115] << 8));
-	ws.min_dewpoint					= FIX_SIGN((buf[116] & 0xff) | (buf[117] << 8));
-	ws.max_abs_pressure				= (buf[118] & 0xff) | (buf[119] << 8);
-	ws.min_abs_pressure				= (buf[120] & 0xff) | (buf[121] << 8);
-	ws.max_rel_pressure				= (buf[122] & 0xff) | (buf[123] << 8);
-	ws.min_rel_pressure				= (buf[124] & 0xff) | (buf[125] << 8);
-	ws.max_avg_wspeed				= (buf[126] & 0xff) | (buf[127] << 8);
-	ws.max_gust_wspeed				= (buf[128] & 0xff) | (buf[129] << 8);
-	ws.max_rain_hourly				= (buf[130] & 0xff) | (buf[131] << 8);
-	ws.max_rain_daily				= (buf[132] & 0xff) | (buf[133] << 8);
-	ws.max_rain_weekly				= (buf[134] & 0xff) | (buf[135] << 8);
-	ws.max_rain_monthly				= (buf[136] & 0xff) | (buf[137] << 8);
-	ws.max_rain_total				= (buf[138] & 0xff) | (buf[139] << 8);
-	memcpy(&ws.max_inhumid_date, &buf[141], sizeof(ws.max_inhumid_date));
-	memcpy(&ws.min_inhumid_date, &buf[146], sizeof(ws.min_inhumid_date));
-	memcpy(&ws.max_outhumid_date, &buf[151], sizeof(ws.max_outhumid_date));
-	memcpy(&ws.min_outhumid_date, &buf[156], sizeof(ws.min_outhumid_date));
-	memcpy(&ws.max_intemp_date, &buf[161], sizeof(ws.max_intemp_date));
-	memcpy(&ws.min_intemp_date, &buf[166], sizeof(ws.min_intemp_date));
-	memcpy(&ws.max_outtemp_date, &buf[171], sizeof(ws.max_outtemp_date));
-	memcpy(&ws.min_outtemp_date, &buf[176], sizeof(ws.min_outtemp_date));
-	memcpy(&ws.max_windchill_date, &buf[181], sizeof(ws.max_windchill_date));
-	memcpy(&ws.min_windchill_date, &buf[186], sizeof(ws.min_windchill_date));
-	memcpy(&ws.max_dewpoint_date, &buf[191], sizeof(ws.max_dewpoint_date));
-	memcpy(&ws.min_dewpoint_date, &buf[196], sizeof(ws.min_dewpoint_date));
-	memcpy(&ws.max_abs_pressure_date, &buf[201], sizeof(ws.max_abs_pressure_date));
-	memcpy(&ws.min_abs_pressure_date, &buf[206], sizeof(ws.min_abs_pressure_date));
-	memcpy(&ws.max_rel_pressure_date, &buf[211], sizeof(ws.max_rel_pressure_date));
-	memcpy(&ws.min_rel_pressure_date, &buf[216], sizeof(ws.min_rel_pressure_date));
-	memcpy(&ws.max_avg_wspeed_date, &buf[221], sizeof(ws.max_avg_wspeed_date));
-	memcpy(&ws.max_gust_wspeed_date, &buf[226], sizeof(ws.max_gust_wspeed_date));
-	memcpy(&ws.max_rain_hourly_date, &buf[231], sizeof(ws.max_rain_hourly_date));
-	memcpy(&ws.max_rain_daily_date, &buf[236], sizeof(ws.max_rain_daily_date));
-	memcpy(&ws.max_rain_weekly_date, &buf[241], sizeof(ws.max_rain_weekly_date));
-	memcpy(&ws.max_rain_monthly_date, &buf[246], sizeof(ws.max_rain_monthly_date));
-	memcpy(&ws.max_rain_total_date, &buf[251], sizeof(ws.max_rain_total_date));
-
-	return ws;
-}
-
-//
-// Sets a single byte at a specified offset in the fixed weather settings chunk.
-//
-int set_weather_setting_byte(struct usb_dev_handle *h, unsigned int offset, char data)
-{
-	assert(offset < WEATHER_SETTINGS_CHUNK_SIZE);
-	return write_weather_1(h, offset, data);
-}
-
-//
-// Writes a notify byte so the weather station knows a setting has changed.
-//
-int notify_weather_setting_change(struct usb_dev_handle *h)
-{
-	// Write 0xAA to address 0x1a to indicate a change of settings.
-	return set_weather_setting_byte(h, 0x1a, 0xaa);
-}
-
-//
-// Sets a weather setting at a given offset in the weather settings chunk.
-//
-int set_weather_setting(struct usb_dev_handle *h, unsigned int offset, char *data, unsigned int len)
-{
-	unsigned int i;
-	for (i = 0; i < len; i++)
-	{
-		if (set_weather_setting_byte(h, offset, data[i]) != 0)
-		{
-			return -1;
-		}
-	}
-
-	notify_weather_setting_change(h);
-	return 0;
-}
-
-// TODO: Remake this to weather_settings_t structure and write all changes in that to the device.
-int set_weather_settings_bulk(struct usb_dev_handle *h, unsigned int change_offset, char *data, unsigned int len)
-{
-	unsigned offset;
-	//unsigned int i;
-	char buf[WEATHER_SETTINGS_CHUNK_SIZE];
-
-	// Make sure we're not trying to write outside the settings buffer.
-	assert((change_offset + len) < WEATHER_SETTINGS_CHUNK_SIZE);
-
-	get_settings_block_raw(h, buf, sizeof(buf));
-
-	// Change the settings.
-	memcpy(&buf[change_offset], data, len);
-
-	// Send back the settings in 3 32-bit chunks.
-	for (offset = 0; offset < (32 * 3); offset += 32)
-	{		
-		write_weather_32(h, offset, &buf[offset]);
-
-		if (read_weather_ack(h) != 0)
-		{
-			return -1;
-		}
-	}
-
-	notify_weather_setting_change(h);
-
-	return 0;
-}
-
-int set_timezone(struct usb_dev_handle *h, signed char timezone)
-{
-	return set_weather_setting(h, 24, (char *)&timezone, 1);
-}
-
-int set_delay(struct usb_dev_handle *h, unsigned char delay)
-{
-	return set_weather_setting(h, 16, (char *)&delay, 1);
-}
-
-//
-// Gets weather data from a memory address in the history.
-//
-weather_data_t get_history_chunk(struct usb_dev_handle *h, weather_settings_t *ws, unsigned short history_pos)
-{
-	static unsigned short prev_history_pos = -1;
-	static char buf[32];
-	char *b;
-	int trycount = 0;
-	weather_data_t d;
-
-	// Try reading the chunk 3 times.
-	do
-	{
-		// We read two chunks at a time. Since we always read 32 bytes at a time. 1 chunk = 16 bytes.
-		if (!read_weather_address(h, history_pos, buf))
-		{
-			print_bytes(2, buf, 32);
-			break;
-		}
-		
-		print_bytes(2, buf, 32);
-		
-		fprintf(stderr, "Failed to read history chunk. Try %d of %d\n", trycount, NUM_TRIES);
-		
-		trycount++;		
-	} while (trycount < NUM_TRIES);
-
-	b = buf;
-
-	memset(&d, 0, sizeof(d));
-
-	d.delay  			= b[0];
-	d.in_humidity	 	= b[1];
-	d.in_temp 			= FIX_SIGN((b[2] & 0xff) | (b[3] << 8));
-	d.out_humidity		= b[4];
-	d.out_temp			= FIX_SIGN((b[5] & 0xff) | (b[6] << 8));
-	d.abs_pressure		= (b[7] & 0xff) | (b[8] << 8);
-	d.avg_wind_lowbyte	= b[9];
-	d.gust_wind_lowbyte = b[10];
-	d.wind_highbyte		= b[11];
-	d.wind_direction	= b[12];
-	d.total_rain		= (b[13] & 0xff) | (b[14] << 8);
-	d.status			= b[15];
-
-	memcpy(&d.raw_data, b, sizeof(d.raw_data));
-
-	prev_history_pos = history_pos;
-
-	return d;
-}
-
-void get_weather_data(struct usb_dev_handle *h)
-{
-	int i = 0;
-	int history_address;
-	weather_item_t history[HISTORY_MAX];
-	weather_settings_t ws;
-	unsigned int items_to_read = 0;
-
-	// Try 3 times until the magic number is correct, otherwise abort.
-	do
-	{
-		if (i >= NUM_TRIES)
-		{
-			fprintf(stderr, "Incorrect magic number!\n");
-			return;
-		}
-
-		debug_printf(1, "Start Reading status block\n");
-		ws = get_settings_block(h);
-		debug_printf(1, "End Reading status block\n\n");
-
-		i++;
-	} while ((ws.magic_number[0] != 0x55) && (ws.magic_number[1] != 0xaa));
-
-	if (program_settings.show_status)
-	{
-		print_status(&ws);
-	}
-
-	if (program_settings.show_alarms)
-	{
-		print_alarms(&ws);
-	}
-
-	if (program_settings.show_settings)
-	{
-		print_settings(&ws);
-	}
-
-	if (program_settings.show_maxmin)
-	{
-		print_maxmin(&ws);
-	}
-
-	items_to_read = (program_settings.count == 0) ? ws.data_count : program_settings.count;
-
-	// Read all events.
-	// Loop through the events in reverse order, starting with the last recorded one
-	// and calculate the timestamp for each event. We only know the current
-	// weather station date/time + the delay in minutes between each event, so
-	// we can only get the timestamps by doing it this way.
-	{
-		// Convert the weather station date from a BCD date to unix date.
-		time_t station_date = bcd_to_unix_date(parse_bcd_date(ws.datetime));
-		unsigned int total_seconds = 0;
-		unsigned int seconds = 0;
-		unsigned int history_begin = (ws.current_pos + HISTORY_CHUNK_SIZE);
-		int history_index;
-		unsigned int j;
-
-		memset(&history, 0, sizeof(history));
-
-		debug_printf(2, "Start reading history blocks\n");
-		debug_printf(2, "Index\tTimestamp\t\tDelay\n");
-
-		for (history_address = ws.current_pos, i = (HISTORY_MAX - 1), j = 0;
-			(j < items_to_read);
-			history_address -= HISTORY_CHUNK_SIZE, i--, j++)
-		{
-			// The buffer is full so it acts as a circular buffer, so we need to
-			// wrap to the end to get the next item.
-			if (history_address < HISTORY_START)
-			{
-				history_address = HISTORY_END - (HISTORY_START - history_address);
-			}
-
-			// Calculate the index we're at in the history, from 0-4080.
-			if (ws.data_count < HISTORY_MAX)
-			{
-				history_index = 1 + (history_address - HISTORY_START) / HISTORY_CHUNK_SIZE; // Normal.
-			}
-			else
-			{
-				history_index = 1 + ((history_address - HISTORY_START) + (HISTORY_END - history_begin)) / HISTORY_CHUNK_SIZE; // Circular buffer.
-			}
-
-			// Read history chunk.
-			history[i].history_index = history_index;
-			history[i].address = history_address;
-			history[i].data = get_history_chunk(h, &ws, history_address);
-
-			// Calculate timestamp.
-			history[i].timestamp = (time_t)(station_date - total_seconds);
-			seconds = history[i].data.delay * 60;
-			total_seconds += seconds;
-
-			// Debug print.	
-			debug_printf(2, "DEBUG: Seconds before current event = %d\n", total_seconds);
-			debug_printf(2, "DEBUG: Temp = %2.1fC\n", history[i].data.in_temp * 0.1f);
-			debug_printf(2, "DEBUG: %d,\t%s,\t%u minutes\n",
-				i,
-				get_timestamp(history[i].timestamp),
-				history[i].data.delay);
-		
-		}
-
-		debug_printf(1, "End reading history blocks\n\n");
-	}
-
-	if (program_settings.show_summary)
-	{
-		debug_printf(1, "Show summary:\n");
-		print_summary(&ws, &history[HISTORY_MAX - 1]);
-	}
-
-	if (program_settings.show_formatted)
-	{
-		debug_printf(1, "Show formatted:\n");
-
-		for (i = (HISTORY_MAX - items_to_read); i < HISTORY_MAX; i++)
-		{
-			print_history_item_formatstring(h, &ws, history, i, program_settings.format_str);
-		}
-	}
-	// Prints output in the Easyweather.dat format.
-	else if (program_settings.show_easyweather)
-	{
-		// Output chronologically.
-		for (i = (HISTORY_MAX - items_to_read); i < HISTORY_MAX; i++)
-		{
-			print_history_item(&history[i], i);
-		}
-	}
-}
-
-//
-// Resets the weather station memory.
-//
-void reset_memory(struct usb_dev_handle *h)
-{
-	// TODO: Use the 32 byte write instead here.
-	// Set data count to zero.
-	write_weather_1(h, 27, 0x0);
-	write_weather_1(h, 28, 0x0);
-	
-	// Reset the address to 256 (0x100). 
-	write_weather_1(h, 30, 0x00);
-	write_weather_1(h, 31, 0x1);
-
-	// Finally tell the station the data has been updated.
-	write_weather_1(h, 26, 0xAA);
-}
-
-//
-// Sets weather display settings.
-//
-void set_weather_data(struct usb_dev_handle *h)
-{
-	if (program_settings.set_timezone)
-	{
-		if (!set_timezone(h, program_settings.timezone))
-		{
-			printf("Timezone set to CET%s%d\n", ((program_settings.timezone >= 0) ? "+" : "-"), program_settings.timezone);
-		}
-		else
-		{
-			fprintf(stderr, "Failed to update timezone.\n");
-		}
-	}
-
-	if (program_settings.set_delay)
-	{
-		if (!set_delay(h, program_settings.delay))
-		{
-			printf("Updating delay set to %u minutes.\n", program_settings.delay);
-			printf("!!! NOTICE that using --quickrain now will produce inaccurate !!!\n");
-			printf("!!! rain data unless you reset the station memory, due to the !!!\n");
-			printf("!!! fact that it assumes the delay between each weather       !!!\n");
-			printf("!!! reading is the same throughout the entire history.        !!!\n");
-		}
-		else
-		{
-			fprintf(stderr, "Failed to update delay.\n");
-		}
-	}
-	
-	if (program_settings.writebyte)
-	{
-		fprintf(stderr, "About to write %d (0x%x) to address %d (0x%x)\n", 
-			program_settings.byte, program_settings.byte,
-			 program_settings.addr, program_settings.addr); 
-		
-		fprintf(stderr, "Are you sure you want to write to the weather station memory? (Y/N): ");
-		
-		if (prompt_user() != 'Y')
-		{
-			return;
-		}
-		
-		if (write_weather_1(h, program_settings.addr, program_settings.byte))
-		{
-			fprintf(stderr, "Failed to write to the weather station\n");
-			return;
-		}
-		
-		printf("Wrote to the weather station successfully\n");
-	}
-}
-
-int dump_memory(struct usb_dev_handle *h)
-{
-	FILE *f; 
-	
-	if (file_exists(program_settings.dumpfile))
-	{
-		fprintf(stderr, "The file \"%s\" already exists. Overwrite? (Y/N): ", program_settings.dumpfile);
-		
-		if (prompt_user() != 'Y')
-		{
-			return -1;
-		}
-	}
-	
-	if (!(f = fopen(program_settings.dumpfile, "w")))
-	{
-		fprintf(stderr, "Failed to open \"%s\"", program_settings.dumpfile);
-		return -1;
-	}
-	else
-	{
-		// Dump the memory to file.
-		unsigned short offset;
-		int trycount;
-		char buf[32];
-		
-		for (offset = 0; offset < (HISTORY_END - 32); offset += 32)
-		{
-			trycount = 0;
-			memset(buf, 0, sizeof(buf));
-			
-			while (read_weather_address(h, offset, buf) && (trycount < NUM_TRIES))
-			{
-				fprintf(stderr, "Failed to read from weather memory offset %d (0x%x). Try %d of %d\n", 
-						offset, offset, trycount + 1, NUM_TRIES);
-				
-				trycount++;
-			}
-			
-			fwrite(buf, 1, sizeof(buf), f);
-			
-			print_bytes(2, buf, 32);
-		}
-	}
-	
-	fclose(f);
-	
-	return 0;
-}
-
-int read_arguments(int argc, char **argv)
-{
-	int c;
-	memset(&program_settings, 0, sizeof(program_settings));
-
-	// Set defaults.
-	program_settings.count = 1;
-	program_settings.mode = get_mode;
-	program_settings.product_id = PRODUCT_ID;
-	program_settings.vendor_id = VENDOR_ID;
-
-	while (1)
-	{
-		static struct option long_options[] =
-		{
-			{"all", no_argument,			0, 'a'},
-			{"status", no_argument,			&program_settings.show_status, 1},
-			{"alarms", no_argument,			&program_settings.show_alarms, 1},
-			{"settings", no_argument,		&program_settings.show_settings, 1},
-			{"maxmin", no_argument,			&program_settings.show_maxmin, 1},
-			{"settings", no_argument,		&program_settings.show_settings, 1},
-			{"easyweather", no_argument,	&program_settings.show_easyweather, 1},
-			{"summary", no_argument,		&program_settings.show_summary, 1},
-			{"quickrain", no_argument,		&program_settings.quickrain, 1},
-			{"count", required_argument,		0, 'c'},
-			{"timezone", required_argument, 	0, 't'},
-			{"delay", required_argument, 		0, 'd'},
-			{"help", required_argument,			0, 'h'},
-			{"format", required_argument,		0, 0},
-			{"formatlist", no_argument,			0, 0},
-			{"altitude", required_argument,		0, 'A'},
-			{"productid", required_argument,	0, 0},
-			{"vendorid", required_argument,		0, 0},
-			{"dumpmem", required_argument,		0, 0},
-			{"infile", required_argument,		0, 0},
-			{"reset", no_argument,				0, 0},
-			{"writebyte", required_argument,	0, 0},
-			{"address", required_argument,		0, 0},
-			{0, 0, 0, 0}
-		};
-
-		int option_index = 0;
-		c = getopt_long(argc, argv, "aesvmc:ht:d:A:", long_options, &option_index);
-
-		if (c == -1)
-		{
-			break;
-		}
-
-		switch (c)
-		{
-			case 0:
-			{
-				if (!strcmp("reset", long_options[option_index].name))
-				{
-					program_settings.reset = 1;
-				}
-				else if (!strcmp("address", long_options[option_index].name))
-				{
-					program_settings.address_is_set = 1;
-					sscanf(optarg, "%x", (unsigned int *)&program_settings.addr);
-				}
-				else if (!strcmp("writebyte", long_options[option_index].name))
-				{
-					program_settings.writebyte = 1;
-					program_settings.mode = set_mode;
-					sscanf(optarg, "%x", (unsigned int *)&program_settings.byte);
-					program_settings.byte &= 0xff;
-				}
-				else if (!strcmp("infile", long_options[option_index].name))
-				{
-					program_settings.from_file = 1;
-					strcpy(program_settings.infile, optarg);
-				}
-				else if (!strcmp("dumpmem", long_options[option_index].name))
-				{
-					program_settings.mode = dump_mode;
-					strcpy(program_settings.dumpfile, optarg);
-				}
-				else if (!strcmp("format", long_options[option_index].name))
-				{
-					program_settings.show_formatted = 1;
-					strcpy(program_settings.format_str, optarg);
-				}
-				else if (!strcmp("formatlist", long_options[option_index].name))
-				{
-					program_settings.show_formatlist = 1;
-				}
-				else if (!strcmp("productid", long_options[option_index].name))
-				{
-					sscanf(optarg, "%x", &program_settings.product_id);
-				}
-				else if (!strcmp("vendorid", long_options[option_index].name))
-				{
-					sscanf(optarg, "%x", &program_settings.vendor_id);
-				}
-
-				break;
-			}
-			case 'a': program_settings.count = 0;				break;
-			case 'v': program_settings.debug++;					break;
-			case 'm': program_settings.show_maxmin = 1;			break;
-			case 's': program_settings.show_status = 1;			break;
-			case 'e': program_settings.show_easyweather = 1;	break;
-			case 'A': program_settings.altitude = atoi(optarg); break;
-			case 'd':
-			{
-				program_settings.mode = set_mode;
-				program_settings.set_delay = 1;
-				program_settings.delay = atoi(optarg);
-				break;
-			}
-			case 't':
-			{
-				program_settings.mode = set_mode;
-				program_settings.set_timezone = 1;
-				program_settings.timezone = atoi(optarg);
-				break;
-			}
-			case 'h':
-			{
-				show_usage(argv[0]);
-				exit(0);
-			}
-			case 'c':
-			{
-				// The number of history events to fetch.
-				program_settings.count = atoi(optarg);
-				break;
-			}
-			default:
-			{
-				show_usage(argv[0]);
-				abort();
-				break;
-			}
-		}
-	}
-
-	// Set show summary as default if nothing else has been set to show.
-	if (!program_settings.show_status
-	&& !program_settings.show_maxmin
-	&& !program_settings.show_easyweather
-	&& !program_settings.show_formatlist
-	&& !program_settings.show_formatted)
-	{
-		program_settings.show_summary = 1;
-	}
-
-	// Turn off quickrain if we're getting all items,
-	// then we can be accurate without spending more time :)
-	if (program_settings.count == 0)
-	{
-		program_settings.quickrain = 0;
-	}
-
-	debug = program_settings.debug;
-
-	return 0;
-}
-
-int main(int argc, char **argv)
-{
-	if (read_arguments(argc, argv))
-	{
-		printf("Error reading arguments\n");
-		return 1;
-	}
-
-	if (program_settings.show_formatlist)
-	{
-		printf("%%h - Inside humidity (%%).\n");
-		printf("%%H - Outside humidity (%%).\n");
-		printf("%%t - Inside temperature (Celcius).\n");
-		printf("%%T - Outside temperature (Celcius).\n");
-		printf("%%C - Outside dew point temperature (Celcius).\n");
-		printf("%%c - Outside Wind chill temperature (Celcius).\n");
-		printf("%%W - Wind speed (m/s).\n");
-		printf("%%G - Gust speed (m/s).\n");
-		printf("%%D - Name of wind direction.\n");
-		printf("%%d - Wind direction in degrees.\n");
-		printf("%%P - Absolute pressure (hPa).\n");
-		printf("%%p - Relative pressure (hPa).\n");
-		printf("!!! To correctly calculate rain info you need to read  !!!\n");
-		printf("!!! at least 24h of events or use --quickrain          !!!\n");
-		printf("%%r - Rain 1h (mm/h).\n");
-		printf("%%f - Rain 24h (mm/h).\n");
-		printf("%%F - Rain 24h (mm).\n");
-		printf("%%R - Total rain (mm).\n");
-		printf("%%N - Date/time string for the weather reading.\n");
-		printf("%%e - Do we have contact with the sensor for this reading? (True/False).\n");
-		printf("%%E - Do we have contact with the sensor for this reading? (1/0).\n");
-		printf("%%b - Original bytes in hex format containing the data.\n");
-		printf("%%a - Address in history.\n");
-		printf("%%%% - %% sign\n");
-		printf("\\n - Newline.\n");
-		printf("\\t - Tab.\n");
-		printf("\\r - Carriage return.\n");
-
-		return 0;
-	}
-
-	// Open te device.
-	devh = open_device();
-	signal(SIGTERM, sigterm_handler);
-	init_device_descriptors(devh);
-	
-	if (program_settings.reset)
-	{
-		fprintf(stderr, "Are you sure you want to reset the weather station memory? (Y/N): ");
-		
-		if (prompt_user() != 'Y')
-		{
-			return -1;
-		}
-		
-		reset_memory(devh);
-		printf("Memory reset\n");
-		
-		return 0;
-	}
-	else if (program_settings.from_file)
-	{
-		FILE *f;
-		
-		debug_printf(1, "Reading input from \"%s\"\n", program_settings.infile);
-		
-		if (program_settings.mode != get_mode)
-		{
-			fprintf(stderr, "You cannot set any settings or dump the memory while using a dump file as input.\n");
-			goto cleanup;
-		}
-
-		if (!(f = fopen(program_settings.infile, "r")))
-		{
-			fprintf(stderr, "Failed to open file \"%s\". ", program_settings.infile);
-			perror(NULL);
-			goto cleanup;
-		}
-		
-		program_settings.f = f;
-	}
-	
-	switch (program_settings.mode)
-	{
-		default:
-		case get_mode:
-		{
-			get_weather_data(devh);
-			break;
-		}
-		case set_mode:
-		{
-			set_weather_data(devh);
-			break;
-		}
-		case dump_mode:
-		{
-			if (dump_memory(devh))
-			{
-				fprintf(stderr, "Failed to dump memory.\n");
-			}
-			break;
-		}
-	}
-	
-cleanup:
-	close_device(devh);
-	if (program_settings.f)
-	{
-		fclose(program_settings.f);
-	}
-
-	return 0;
-}
-
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ------------------------------------------------------------------------
+//
+// This program is designed to interface with the Fineoffset line
+// of weather stations (WP1400, WH1080, WH1081, W-8681, etc).
+//
+// The information about how the data is stored on the device is
+// based on information from Jim Easterbrooks webpage
+// (http://www.jim-easterbrook.me.uk/weather/mm/)
+// including the EasyWeather.dat layout
+// (http://www.jim-easterbrook.me.uk/weather/ew/).
+//
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include "wsp.h"
+#include "wspusb.h"
+#include "memory.h"
+#include "utils.h"
+#include "writer.h"
+#include "output.h"
+#include "weather.h"
+#include "usbasync.h"
+#include "transport.h"
+#include "state.h"
+#include "memcache.h"
+#include "thread.h"
+#include "batch.h"
+#include "format.h"
+#include "export.h"
+#include "json.h"
+#include "sink.h"
+#include "parallel.h"
+#include "http.h"
+#include "metrics.h"
+#ifndef WIN32
+#include "broker.h"
+#endif // WIN32
+#ifdef WSP_PUBLISH
+#include "publish.h"
+#endif // WSP_PUBLISH
+
+program_settings_t program_settings;
+
+typedef unsigned char byte;
+
+wsp_device_t *devices[MAX_STATIONS];
+unsigned int device_count = 0;
+wsp_mutex_t output_mutex;
+volatile sig_atomic_t stop_polling = 0;
+unsigned int debug = 0;
+
+//
+// Shows usage.
+//
+void show_usage(char *program_name)
+{
+	printf("Weather Station Poller v%u.%u build %d\n", MAJOR_VERSION, MINOR_VERSION, svn_revision());
+	printf("Copyright (C) Joakim Söderberg.\n");
+	printf("  Usage: %s [option]... \n", program_name);
+	printf("\n");
+	printf("  -e, --easyweather     Outputs the weather data in the\n");
+	printf("                        easyweather.dat csv format.\n");
+	printf("  -s, --status          Shows status of the device, such\n");
+	printf("                        as data count, date/time.\n");
+	printf("  --settings            Prints the weather display's settings.\n");
+	printf("  --maxmin              Outputs the max/min weather data\n");
+	printf("                        recorded by the station.\n");
+	printf("  --alarms              Displays all alarms set on the device\n");
+	printf("                        and if they're enabled.\n");
+	printf("  -c, --count #	        The number of history items to read (1-4080).\n");
+	printf("                        Default is 1.\n");
+	printf("  -a, --all             Gets all available history items.\n");
+	printf("  -v[v..]               Shows extra debug information. For more\n");
+	printf("                        detailed info, add more v's.\n");
+	printf("  -t, --timezone #      Sets the timezone offset from CET\n");
+	printf("                        from -12 to 12.\n");
+	printf("  -d, --delay #         Sets the read update delay between\n");
+	printf("                        weather data readings.\n");
+	printf("  -A, --altitude #      Sets the altitude in m over sea level in meters.\n");
+	printf("                        This is not saved anywhere, so it must be\n");
+	printf("                        specified on each call. Used to calculate\n");
+	printf("                        relative pressure.\n");
+	printf("  --quickrain           Enables faster, and potentially inaccurate rain\n");
+	printf("                        calculations. Instead of checking the time between\n");
+	printf("                        each history item to get the accurate timestamp\n");
+	printf("                        the delay is used. This will result in incorrect\n");
+	printf("                        values if you changed the delay without resetting\n");
+	printf("                        the memory. Notice that rain over 1h, 24h and so on\n");
+	printf("                        might be calculated incorrectly.\n");
+	printf("  --vendorid #          Changes the vendor id, should be in hex format.\n");
+    printf("                        Default is %x.\n", VENDOR_ID);
+	printf("  --productid #         Changes the product id, should be in hex format.\n");
+	printf("                        Default is %x.\n", PRODUCT_ID);
+	printf("  --format <string>     Writes the output in the given format.\n");
+	printf("  --formatlist          Lists available format string variables.\n");
+	printf("  --export-columnar <path>\n");
+	printf("                        Writes the history read to a file as typed\n");
+	printf("                        columns in the Arrow IPC file format (Feather),\n");
+	printf("                        for pyarrow, pandas, polars or DuckDB. With\n");
+	printf("                        --batch the merged history is written.\n");
+	printf("  --json                Outputs the history, and the status, settings,\n");
+	printf("                        alarms and max/min values asked for, as JSON\n");
+	printf("                        with one object per line.\n");
+	printf("  --output <kind>:<path>\n");
+	printf("                        Also writes the history to the given output, on\n");
+	printf("                        a thread of its own. The kind is easyweather,\n");
+	printf("                        json, or format:<format string>. The path - is\n");
+	printf("                        stdout. Can be given up to %d times.\n", MAX_OUTPUTS);
+	printf("  --epoch               Outputs the timestamps of the history as seconds\n");
+	printf("                        since the epoch instead of as dates.\n");
+	printf("  --dumpmem <path>      Dumps the entire weather station memory to a file.\n");
+	printf("  --infile <path>       Uses a file as input instead of reading from the\n");
+	printf("                        weather station memory. Use output from --dumpmem.\n");
+	printf("  --station [label=]<path>\n");
+	printf("                        Polls the station at the given path, can be\n");
+	printf("                        given several times to poll stations in parallel.\n");
+	printf("                        The output of each station is tagged with the label,\n");
+	printf("                        or the path if none is given. With --infile and\n");
+	printf("                        --simulate the path is a dump file.\n");
+	printf("  --all-stations        Polls all stations found in parallel.\n");
+	printf("  --list-stations       Lists the paths of all stations found.\n");
+	printf("  --batch <path>        Reads all dump files in a directory, or matching\n");
+	printf("                        a wildcard pattern, and outputs their history\n");
+	printf("                        merged in time order with duplicates removed.\n");
+	printf("                        The item still being written in each dump is\n");
+	printf("                        left out. Use with -a, and -e or --format.\n");
+	printf("  --threads #           The number of threads formatting the history,\n");
+	printf("                        and reading the dump files with --batch.\n");
+	printf("                        Default is %u.\n", DEFAULT_BATCH_THREADS);
+	printf("  --simulate <path>     Uses a simulated weather station serving a file\n");
+	printf("                        from --dumpmem. The station writes new history\n");
+	printf("                        as time passes.\n");
+	printf("  --sim-latency #       Milliseconds each transfer to the simulated\n");
+	printf("                        station takes. Default is 0.\n");
+	printf("  --sim-jitter #        Adds up to this many milliseconds at random\n");
+	printf("                        to each simulated transfer. Default is 0.\n");
+	printf("  --sim-failrate #      Percentage of simulated transfers that fail.\n");
+	printf("                        Default is 0.\n");
+	printf("  --sim-speed #         How many times faster than real time the\n");
+	printf("                        simulated station runs. Default is 1.\n");
+	printf("  --reset               Resets all the data on the weather station.\n");
+	printf("  --write #             Write a byte to a given address\n");
+	printf("  --summary             Shows a small summary of the last recorded weather.\n");
+	printf("  --daemon              Keeps the device open and polls it continuously.\n");
+	printf("                        Only history items finished since the previous\n");
+	printf("                        poll are output.\n");
+	printf("  --http [address:]port Keeps polling like --daemon, and serves the latest\n");
+	printf("                        data as JSON over HTTP at /current, /status,\n");
+	printf("                        /maxmin and /history?since=<seconds since epoch>.\n");
+	printf("                        Listens on 127.0.0.1 unless an address is given.\n");
+	printf("                        Use --all or --count for the history kept at start.\n");
+	printf("                        The metrics are served at /metrics.\n");
+	printf("  --metrics-file <path> Writes counters and the latest weather values in\n");
+	printf("                        the Prometheus text format after each poll.\n");
+	#ifndef WIN32
+	printf("  --broker <path>       Keeps the station open and serves its memory to\n");
+	printf("                        other instances connecting to the Unix socket at\n");
+	printf("                        path. Reads asked for at the same time are done\n");
+	printf("                        once for all of them.\n");
+	printf("  --connect <path>      Reads the station through the broker at path\n");
+	printf("                        instead of opening it.\n");
+	#endif // WIN32
+	#ifdef WSP_PUBLISH
+	printf("  --publish <path>      Keeps polling like --daemon, and sends each new\n");
+	printf("                        history item as JSON to the subscribers connected\n");
+	printf("                        to the Unix socket at path, along with the current\n");
+	printf("                        item whenever it changes.\n");
+	printf("  --publish-policy <p>  What to do when a subscriber falls behind: drop\n");
+	printf("                        the items, disconnect it or block the polling.\n");
+	printf("                        Subscribers can send their own. Default is drop.\n");
+	printf("  --publish-buffer #    Bytes buffered for each subscriber. Default is %u.\n", DEFAULT_PUBLISH_BUFFER);
+	#endif // WSP_PUBLISH
+	printf("  --interval #          Seconds between each poll in daemon mode.\n");
+	printf("                        Default is %u.\n", DEFAULT_POLL_INTERVAL);
+	printf("  --state <path>        Keeps track of the last history item read in a file,\n");
+	printf("                        and only reads the history written since then.\n");
+	printf("                        --count and --all only apply to the first run.\n");
+	#ifdef WSP_LIBUSB1
+	printf("  --async               Uses libusb-1.0 asynchronous transfers, keeping\n");
+	printf("                        reads of the history and memory dump in flight\n");
+	printf("                        while the previous ones are decoded.\n");
+	printf("  --queue #             The number of reads to keep in flight with --async\n");
+	printf("                        (1-%u). Default is %u.\n", USBASYNC_MAX_QUEUE, USBASYNC_DEFAULT_QUEUE);
+	#endif // WSP_LIBUSB1
+	printf("  -h, --help            Shows this help text.\n");
+	printf("\n");
+}
+
+//
+// Handles SIGTERM.
+//
+void sigterm_handler(int signum)
+{
+	unsigned int i;
+
+	// In daemon mode each station finishes its poll and is closed on the
+	// way out. If that doesn't happen, the next signal closes them at once.
+	if (program_settings.daemon && !stop_polling)
+	{
+		stop_polling = 1;
+		return;
+	}
+
+	fprintf(stderr, "SIGTERM: Closing device\n");
+
+	for (i = 0; i < device_count; i++)
+	{
+		close_transport(devices[i]);
+	}
+
+	exit(1);
+}
+
+void set_wind_direction(char *winddir, const char data)
+{
+	strcpy(winddir, get_wind_direction(data));
+}
+
+//
+// Gets the raw bytes of the weather settings block.
+//
+void get_settings_block_raw(wsp_device_t *dev, char *buf, unsigned int len)
+{
+	unsigned int offset;
+
+	assert(len <= WEATHER_SETTINGS_CHUNK_SIZE);
+	assert((len % 32) == 0);
+
+	memset(buf, 0, len);
+
+	// Read 256 bytes in 32-byte chunks.
+	for (offset = 0; (offset < WEATHER_SETTINGS_CHUNK_SIZE) && (offset < len); offset += 32)
+	{
+		// TODO: Check for error here.
+		read_weather_address(dev, offset, &buf[offset]);
+		
+		print_bytes(2, &buf[offset], 32);
+	}
+}
+
+//
+// Gets the weather settings block (the first 256 bytes in the weather display memory).
+//
+weather_settings_t get_settings_block(wsp_device_t *dev)
+{
+	weather_settings_t ws;
+	char buf[WEATHER_SETTINGS_CHUNK_SIZE];
+
+	memset(&ws, 0, sizeof(ws));
+
+	get_settings_block_raw(dev, buf, sizeof(buf));
+
+	ws.magic_number[0]				= buf[0];
+	ws.magic_number[1]				= buf[1];
+	ws.read_period					= buf[16];
+	ws.unit_settings1				= buf[17];
+	ws.unit_settings2				= buf[18];
+	ws.display_options1 			= buf[19];
+	ws.display_options2 			= buf[20];
+	ws.alarm_enable1				= buf[21];
+	ws.alarm_enable2				= buf[22];
+	ws.alarm_enable3				= buf[23];
+	ws.timezone						= buf[24];
+	ws.data_refreshed				= buf[26];
+	ws.data_count					= (buf[27] & 0xff) | (buf[28] << 8);
+	ws.current_pos					= (buf[30] & 0xff) | (buf[31] << 8);
+	ws.relative_pressure			= (buf[32] & 0xff) | (buf[33] << 8);
+	ws.absolute_pressure			= (buf[34] & 0xff) | (buf[35] << 8);
+	memcpy(&ws.unknown, &buf[36], 7);
+	memcpy(&ws.datetime, &buf[43], 5);
+	ws.alarm_inhumid_high			= buf[48];
+	ws.alarm_inhumid_low			= buf[49];
+	ws.alarm_intemp_high			= FIX_SIGN((buf[50] & 0xff) | (buf[51] << 8));
+	ws.alarm_intemp_low				= FIX_SIGN((buf[52] & 0xff) | (buf[53] << 8));
+	ws.alarm_outhumid_high			= buf[54];
+	ws.alarm_outhumid_low			= buf[55];
+	ws.alarm_outtemp_high			= FIX_SIGN((buf[56] & 0xff) | (buf[57] << 8));
+	ws.alarm_outtemp_low			= FIX_SIGN((buf[58] & 0xff) | (buf[59] << 8));
+	ws.alarm_windchill_high			= FIX_SIGN((buf[60] & 0xff) | (buf[61] << 8));
+	ws.alarm_windchill_low			= FIX_SIGN((buf[62] & 0xff) | (buf[63] << 8));
+	ws.alarm_dewpoint_high			= FIX_SIGN((buf[64] & 0xff) | (buf[65] << 8));
+	ws.alarm_dewpoint_low			= FIX_SIGN((buf[66] & 0xff) | (buf[67] << 8));
+	ws.alarm_abs_pressure_high		= (buf[68] & 0xff) | (buf[69] << 8);
+	ws.alarm_abs_pressure_low		= (buf[70] & 0xff) | (buf[71] << 8);
+	ws.alarm_rel_pressure_high		= (buf[72] & 0xff) | (buf[73] << 8);
+	ws.alarm_rel_pressure_low		= (buf[74] & 0xff) | (buf[75] << 8);
+	ws.alarm_avg_wspeed_beaufort	= buf[76];
+	ws.alarm_avg_wspeed_ms			= buf[77];
+	ws.alarm_gust_wspeed_beaufort 	= buf[79];
+	ws.alarm_gust_wspeed_ms			= buf[80];
+	ws.alarm_wind_direction			= buf[82];
+	ws.alarm_rain_hourly			= (buf[83] & 0xff) | (buf[84] << 8);
+	ws.alarm_rain_daily				= (buf[85] & 0xff) | (buf[86] << 8);
+	ws.alarm_time					= (buf[87] & 0xff) | (buf[88] << 8);
+	ws.max_inhumid					= buf[98];
+	ws.min_inhumid					= buf[99];
+	ws.max_outhumid					= buf[100];
+	ws.min_outhumid					= buf[101];
+	ws.max_intemp					= FIX_SIGN((buf[102] & 0xff) | (buf[103] << 8));
+	ws.min_intemp					= FIX_SIGN((buf[104] & 0xff) | (buf[105] << 8));
+	ws.max_outtemp					= FIX_SIGN((buf[106] & 0xff) | (buf[107] << 8));
+	ws.min_outtemp					= FIX_SIGN((buf[108] & 0xff) | (buf[109] << 8));
+	ws.max_windchill				= FIX_SIGN((buf[110] & 0xff) | (buf[111] << 8));
+	ws.min_windchill				= FIX_SIGN((buf[112] & 0xff) | (buf[113] << 8));
+	ws.max_dewpoint					= FIX_SIGN((buf[114] & 0xff) | (buf[115] << 8));
+	ws.min_dewpoint					= FIX_SIGN((buf[116] & 0xff) | (buf[117] << 8));
+	ws.max_abs_pressure				= (buf[118] & 0xff) | (buf[119] << 8);
+	ws.min_abs_pressure				= (buf[120] & 0xff) | (buf[121] << 8);
+	ws.max_rel_pressure				= (buf[122] & 0xff) | (buf[123] << 8);
+	ws.min_rel_pressure				= (buf[124] & 0xff) | (buf[125] << 8);
+	ws.max_avg_wspeed				= (buf[126] & 0xff) | (buf[127] << 8);
+	ws.max_gust_wspeed				= (buf[128] & 0xff) | (buf[129] << 8);
+	ws.max_rain_hourly				= (buf[130] & 0xff) | (buf[131] << 8);
+	ws.max_rain_daily				= (buf[132] & 0xff) | (buf[133] << 8);
+	ws.max_rain_weekly				= (buf[134] & 0xff) | (buf[135] << 8);
+	ws.max_rain_monthly				= (buf[136] & 0xff) | (buf[137] << 8);
+	ws.max_rain_total				= (buf[138] & 0xff) | (buf[139] << 8);
+	memcpy(&ws.max_inhumid_date, &buf[141], sizeof(ws.max_inhumid_date));
+	memcpy(&ws.min_inhumid_date, &buf[146], sizeof(ws.min_inhumid_date));
+	memcpy(&ws.max_outhumid_date, &buf[151], sizeof(ws.max_outhumid_date));
+	memcpy(&ws.min_outhumid_date, &buf[156], sizeof(ws.min_outhumid_date));
+	memcpy(&ws.max_intemp_date, &buf[161], sizeof(ws.max_intemp_date));
+	memcpy(&ws.min_intemp_date, &buf[166], sizeof(ws.min_intemp_date));
+	memcpy(&ws.max_outtemp_date, &buf[171], sizeof(ws.max_outtemp_date));
+	memcpy(&ws.min_outtemp_date, &buf[176], sizeof(ws.min_outtemp_date));
+	memcpy(&ws.max_windchill_date, &buf[181], sizeof(ws.max_windchill_date));
+	memcpy(&ws.min_windchill_date, &buf[186], sizeof(ws.min_windchill_date));
+	memcpy(&ws.max_dewpoint_date, &buf[191], sizeof(ws.max_dewpoint_date));
+	memcpy(&ws.min_dewpoint_date, &buf[196], sizeof(ws.min_dewpoint_date));
+	memcpy(&ws.max_abs_pressure_date, &buf[201], sizeof(ws.max_abs_pressure_date));
+	memcpy(&ws.min_abs_pressure_date, &buf[206], sizeof(ws.min_abs_pressure_date));
+	memcpy(&ws.max_rel_pressure_date, &buf[211], sizeof(ws.max_rel_pressure_date));
+	memcpy(&ws.min_rel_pressure_date, &buf[216], sizeof(ws.min_rel_pressure_date));
+	memcpy(&ws.max_avg_wspeed_date, &buf[221], sizeof(ws.max_avg_wspeed_date));
+	memcpy(&ws.max_gust_wspeed_date, &buf[226], sizeof(ws.max_gust_wspeed_date));
+	memcpy(&ws.max_rain_hourly_date, &buf[231], sizeof(ws.max_rain_hourly_date));
+	memcpy(&ws.max_rain_daily_date, &buf[236], sizeof(ws.max_rain_daily_date));
+	memcpy(&ws.max_rain_weekly_date, &buf[241], sizeof(ws.max_rain_weekly_date));
+	memcpy(&ws.max_rain_monthly_date, &buf[246], sizeof(ws.max_rain_monthly_date));
+	memcpy(&ws.max_rain_total_date, &buf[251], sizeof(ws.max_rain_total_date));
+
+	return ws;
+}
+
+//
+// Sets a single byte at a specified offset in the fixed weather settings chunk.
+//
+int set_weather_setting_byte(wsp_device_t *dev, unsigned int offset, char data)
+{
+	assert(offset < WEATHER_SETTINGS_CHUNK_SIZE);
+	return write_weather_1(dev, offset, data);
+}
+
+//
+// Writes a notify byte so the weather station knows a setting has changed.
+//
+int notify_weather_setting_change(wsp_device_t *dev)
+{
+	// Write 0xAA to address 0x1a to indicate a change of settings.
+	return set_weather_setting_byte(dev, 0x1a, 0xaa);
+}
+
+//
+// Sets a weather setting at a given offset in the weather settings chunk.
+//
+int set_weather_setting(wsp_device_t *dev, unsigned int offset, char *data, unsigned int len)
+{
+	unsigned int i;
+	for (i = 0; i < len; i++)
+	{
+		if (set_weather_setting_byte(dev, offset, data[i]) != 0)
+		{
+			return -1;
+		}
+	}
+
+	notify_weather_setting_change(dev);
+	return 0;
+}
+
+// TODO: Remake this to weather_settings_t structure and write all changes in that to the device.
+int set_weather_settings_bulk(wsp_device_t *dev, unsigned int change_offset, char *data, unsigned int len)
+{
+	char buf[WEATHER_SETTINGS_CHUNK_SIZE];
+
+	// Make sure we're not trying to write outside the settings buffer.
+	assert((change_offset + len) < WEATHER_SETTINGS_CHUNK_SIZE);
+
+	// Makes sure the settings are in the memory cache.
+	get_settings_block_raw(dev, buf, sizeof(buf));
+
+	// Change the settings, and send back only the 32-byte chunks that changed.
+	if (memcache_modify(dev->cache, change_offset, data, len) || memcache_flush(dev))
+	{
+		return -1;
+	}
+
+	notify_weather_setting_change(dev);
+
+	return 0;
+}
+
+int set_timezone(wsp_device_t *dev, signed char timezone)
+{
+	return set_weather_setting(dev, 24, (char *)&timezone, 1);
+}
+
+int set_delay(wsp_device_t *dev, unsigned char delay)
+{
+	return set_weather_setting(dev, 16, (char *)&delay, 1);
+}
+
+//
+// Gets the history chunk at a memory address in the history.
+//
+void get_history_chunk(wsp_device_t *dev, weather_settings_t *ws, unsigned short history_pos, unsigned char raw_data[HISTORY_CHUNK_SIZE])
+{
+	// We always read 32 bytes at a time, that is two chunks (1 chunk = 16 bytes).
+	// By reading from a 32-byte aligned address both chunks of each read
+	// belong to the history, and the read is kept in the memory cache
+	// so the neighbouring chunk is decoded without reading it again.
+	int block_pos = history_pos & ~(2 * HISTORY_CHUNK_SIZE - 1);
+	int trycount = 0;
+	char buf[32];
+
+	// Try reading the chunk 3 times.
+	do
+	{
+		if (!read_weather_address(dev, block_pos, buf))
+		{
+			print_bytes(2, buf, 32);
+			break;
+		}
+
+		print_bytes(2, buf, 32);
+
+		fprintf(stderr, "Failed to read history chunk. Try %d of %d\n", trycount, NUM_TRIES);
+
+		trycount++;
+		metrics_count(dev, METRIC_CHUNK_RETRIES, 1);
+	} while (trycount < NUM_TRIES);
+
+	memcpy(raw_data, &buf[history_pos - block_pos], HISTORY_CHUNK_SIZE);
+}
+
+//
+// Starts the output of a station. When polling several stations the
+// output is tagged with the station label.
+//
+static void lock_output(wsp_device_t *dev)
+{
+	mutex_lock(&output_mutex);
+
+	if (device_count > 1)
+	{
+		printf("[%s]\n", dev->label);
+	}
+}
+
+static void unlock_output()
+{
+	fflush(stdout);
+	mutex_unlock(&output_mutex);
+}
+
+//
+// Writes the metrics of all stations to the file given with --metrics-file.
+//
+static void write_poll_metrics()
+{
+	if (!program_settings.metrics_file)
+		return;
+
+	mutex_lock(&output_mutex);
+	write_metrics_file(program_settings.metricsfile, devices, device_count);
+	mutex_unlock(&output_mutex);
+}
+
+//
+// Gets the number of history chunks from the given address up to the current position.
+//
+unsigned int get_history_distance(unsigned short current_pos, unsigned short history_pos)
+{
+	int distance = current_pos - history_pos;
+
+	// The history is a circular buffer, so the current position might have wrapped.
+	if (distance < 0)
+	{
+		distance += (HISTORY_END - HISTORY_START);
+	}
+
+	return (distance / HISTORY_CHUNK_SIZE);
+}
+
+typedef struct history_read_s
+{
+	weather_settings_t *ws;
+	weather_history_t *history;
+	unsigned int items_to_read;
+} history_read_t;
+
+//
+// Decodes both history chunks of a 32-byte read into the history items
+// they belong to. Called as each read arrives.
+//
+static void decode_history_block(unsigned short addr, const char buf[32], int status, void *arg)
+{
+	history_read_t *r = (history_read_t *)arg;
+	unsigned short history_pos;
+	weather_item_t *item;
+	unsigned int j;
+	int k;
+
+	for (k = 0; k < 2; k++)
+	{
+		history_pos = addr + (k * HISTORY_CHUNK_SIZE);
+		j = get_history_distance(r->ws->current_pos, history_pos);
+
+		// The other chunk in the block might not be one we're after.
+		if (j >= r->items_to_read)
+			continue;
+
+		item = get_history_item(r->history, HISTORY_MAX - 1 - j);
+		item->address = history_pos;
+
+		if (status)
+		{
+			fprintf(stderr, "Failed to read history chunk at %d (0x%x)\n", history_pos, history_pos);
+			continue;
+		}
+
+		memcpy(item->raw_data, &buf[k * HISTORY_CHUNK_SIZE], HISTORY_CHUNK_SIZE);
+	}
+}
+
+//
+// Reads the history items from the current position and backwards into the
+// history. Two chunks are read at a time from 32-byte
+// aligned addresses, and the reads are pipelined with --async.
+//
+int read_history(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int items_to_read)
+{
+	unsigned short addrs[HISTORY_MAX / 2 + 1];
+	unsigned int count = 0;
+	unsigned int j;
+	int history_address = ws->current_pos;
+	history_read_t r;
+
+	for (j = 0; j < items_to_read; j++, history_address -= HISTORY_CHUNK_SIZE)
+	{
+		unsigned short block_pos;
+
+		if (history_address < HISTORY_START)
+		{
+			history_address = HISTORY_END - (HISTORY_START - history_address);
+		}
+
+		block_pos = history_address & ~(2 * HISTORY_CHUNK_SIZE - 1);
+
+		if ((count == 0) || (addrs[count - 1] != block_pos))
+		{
+			addrs[count++] = block_pos;
+		}
+	}
+
+	r.ws = ws;
+	r.history = history;
+	r.items_to_read = items_to_read;
+
+	return read_weather_addresses(dev, addrs, count, decode_history_block, &r);
+}
+
+//
+// Drops the cached history between two positions (both included),
+// the station has written to it since it was read.
+//
+static void expire_history(wsp_device_t *dev, unsigned short from_pos, unsigned short to_pos)
+{
+	if (from_pos <= to_pos)
+	{
+		memcache_expire(dev->cache, from_pos, (to_pos - from_pos) + HISTORY_CHUNK_SIZE);
+	}
+	else
+	{
+		// The current position has wrapped.
+		memcache_expire(dev->cache, from_pos, HISTORY_END - from_pos);
+		memcache_expire(dev->cache, HISTORY_START, (to_pos - HISTORY_START) + HISTORY_CHUNK_SIZE);
+	}
+}
+
+//
+// Gets the number of history items the station has finished writing
+// since the position stored in the cursor.
+//
+unsigned int get_new_history_count(wsp_device_t *dev, history_cursor_t *cursor, weather_settings_t *ws)
+{
+	// Everything that is stored, except the item currently being written.
+	unsigned int all_items = (ws->data_count > 0) ? (ws->data_count - 1) : 0;
+	int last_pos = cursor->current_pos - HISTORY_CHUNK_SIZE;
+
+	if (last_pos < HISTORY_START)
+	{
+		last_pos = HISTORY_END - (HISTORY_START - last_pos);
+	}
+
+	// Only the history from the last item we got up to the current position
+	// has been written since the last poll. The last item is read again
+	// to check that it is still there.
+	expire_history(dev, (unsigned short)last_pos, ws->current_pos);
+
+	// The data count only goes down if the station memory has been reset,
+	// in that case everything that is stored is new.
+	if (ws->data_count < cursor->data_count)
+	{
+		debug_printf(1, "Data count went down, the memory has been reset since last poll\n");
+		memcache_expire(dev->cache, HISTORY_START, HISTORY_END - HISTORY_START);
+		return all_items;
+	}
+
+	// If the station has stored more items than fits in the history since the
+	// last poll, the current position has wrapped all the way around.
+	if (ws->read_period > 0)
+	{
+		time_t station_date = bcd_to_unix_date(parse_bcd_date(ws->datetime));
+		time_t cursor_date = bcd_to_unix_date(parse_bcd_date(cursor->datetime));
+
+		if ((station_date > cursor_date)
+		&& (((station_date - cursor_date) / (ws->read_period * 60)) >= HISTORY_MAX))
+		{
+			debug_printf(1, "The entire history has been written since last poll\n");
+			memcache_expire(dev->cache, HISTORY_START, HISTORY_END - HISTORY_START);
+			return all_items;
+		}
+	}
+
+	// Make sure the last item we got is still there, otherwise the memory
+	// has been reset or overwritten and our position means nothing.
+	if (cursor->has_last_hash && (ws->data_count > 1))
+	{
+		unsigned char last[HISTORY_CHUNK_SIZE];
+
+		get_history_chunk(dev, ws, (unsigned short)last_pos, last);
+
+		if (hash_bytes(last, sizeof(last)) != cursor->last_hash)
+		{
+			debug_printf(1, "The last history item from the last poll has changed\n");
+			memcache_expire(dev->cache, HISTORY_START, HISTORY_END - HISTORY_START);
+			return all_items;
+		}
+	}
+
+	return min(get_history_distance(ws->current_pos, cursor->current_pos), all_items);
+}
+
+//
+// Does the output asked for have any rain over a period? If not, no room is
+// made for the history the rain calculations read. The EasyWeather and JSON
+// outputs always have the rain, the summary only has the total rain.
+//
+static int output_needs_rain(void)
+{
+	if (program_settings.json)
+	{
+		return 1;
+	}
+
+	if (program_settings.show_formatted)
+	{
+		return (program_settings.format.needs & FORMAT_NEEDS_RAIN);
+	}
+
+	return program_settings.show_easyweather;
+}
+
+//
+// Does the output asked for have the rain over the last 7 days and longer,
+// of the EasyWeather format? Those need all of the history stored.
+//
+static int output_needs_rain_windows(void)
+{
+	if (!program_settings.json && !program_settings.show_formatted && program_settings.show_easyweather)
+	{
+		return 1;
+	}
+
+	return sinks_have_output(easyweather_output);
+}
+
+//
+// Reads the settings block and history from the weather station, and
+// calculates the timestamp of each history item. The index of the first
+// item read is returned, or -1 on failure. If a valid cursor is given,
+// only the history items written since the last poll are read.
+// The history must be freed with free_history().
+//
+int read_weather_data(wsp_device_t *dev, history_cursor_t *cursor, weather_settings_t *ws_out, weather_history_t *history)
+{
+	int i = 0;
+	int history_address;
+	weather_settings_t ws;
+	unsigned int items_to_read = 0;
+	unsigned int items_read;
+	unsigned int room;
+	unsigned int lookback;
+	long short_seconds;
+	unsigned long start = get_milliseconds();
+
+	memset(history, 0, sizeof(weather_history_t));
+
+	// Start a new generation in the memory cache, anything read from here on
+	// is from this poll. The settings block changes all the time.
+	memcache_next_generation(dev->cache);
+	memcache_expire(dev->cache, 0, WEATHER_SETTINGS_CHUNK_SIZE);
+
+	// Try 3 times until the magic number is correct, otherwise abort.
+	do
+	{
+		if (i >= NUM_TRIES)
+		{
+			fprintf(stderr, "Incorrect magic number!\n");
+			return -1;
+		}
+
+		if (i > 0)
+		{
+			// Don't get the same bad read from the cache.
+			memcache_invalidate(dev->cache, 0, WEATHER_SETTINGS_CHUNK_SIZE);
+		}
+
+		debug_printf(1, "Start Reading status block\n");
+		ws = get_settings_block(dev);
+		debug_printf(1, "End Reading status block\n\n");
+
+		if ((ws.magic_number[0] != 0x55) && (ws.magic_number[1] != 0xaa))
+		{
+			metrics_count(dev, METRIC_MAGIC_FAILURES, 1);
+		}
+
+		i++;
+	} while ((ws.magic_number[0] != 0x55) && (ws.magic_number[1] != 0xaa));
+
+	metrics_phase(dev, PHASE_SETTINGS, start);
+	start = get_milliseconds();
+
+	items_to_read = (program_settings.count == 0) ? ws.data_count : program_settings.count;
+
+	if (!cursor || !cursor->valid)
+	{
+		// We don't know what the station has written since the last poll.
+		memcache_expire(dev->cache, HISTORY_START, HISTORY_END - HISTORY_START);
+	}
+
+	if (cursor)
+	{
+		// The current item is read as well as the ones asked for, so the
+		// timestamps can be calculated, see get_weather_data().
+		if (cursor->valid)
+		{
+			items_to_read = get_new_history_count(dev, cursor, &ws) + 1;
+			debug_printf(1, "%u new history items since last poll\n", items_to_read - 1);
+		}
+		else
+		{
+			items_to_read = min(items_to_read + 1, max((unsigned int)ws.data_count, 1));
+		}
+	}
+
+	items_to_read = min(items_to_read, HISTORY_MAX);
+
+	// Only the items read are stored. The rain over the last hour and 24
+	// hours needs the items up to 24 hours before the first one output,
+	// if there are any. Quick rain calculations read those as they go, so
+	// only room is left for them, otherwise they are read with the rest.
+	// The rain windows of the EasyWeather output go back as far as the
+	// station does, so all of the history is read for them.
+	items_read = items_to_read;
+	room = items_to_read;
+
+	if (output_needs_rain_windows())
+	{
+		items_read = max(items_to_read, min((unsigned int)ws.data_count, HISTORY_MAX));
+		room = items_read;
+	}
+	else if (output_needs_rain())
+	{
+		lookback = (24 * 60) / max(ws.read_period, 1) + 1;
+
+		if (program_settings.quickrain)
+		{
+			room += lookback;
+		}
+		else if (items_to_read < ws.data_count)
+		{
+			items_read = min(items_to_read + lookback, min((unsigned int)ws.data_count, HISTORY_MAX));
+			room = items_read;
+		}
+	}
+
+	for (;;)
+	{
+		history->first = HISTORY_MAX - min(room, HISTORY_MAX);
+
+		if (!(history->items = (weather_item_t *)calloc(HISTORY_MAX - history->first, sizeof(weather_item_t))))
+		{
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+
+		// Read all events.
+		// Loop through the events in reverse order, starting with the last recorded one
+		// and calculate the timestamp for each event. We only know the current
+		// weather station date/time + the delay in minutes between each event, so
+		// we can only get the timestamps by doing it this way.
+		{
+			// Convert the weather station date from a BCD date to unix date.
+			time_t station_date = bcd_to_unix_date(parse_bcd_date(ws.datetime));
+			unsigned int total_seconds = 0;
+			unsigned int seconds = 0;
+			unsigned int history_begin = (ws.current_pos + HISTORY_CHUNK_SIZE);
+			int history_index;
+			unsigned int j;
+			char timestamp[32];
+			weather_item_t *item;
+			int failed;
+
+			// An item that couldn't be read would be output with made up
+			// readings, and with --state the cursor would move past it.
+			if ((failed = read_history(dev, &ws, history, items_read)))
+			{
+				fprintf(stderr, "Failed to read %d history blocks\n", failed);
+				free_history(history);
+				return -1;
+			}
+
+			debug_printf(2, "Start reading history blocks\n");
+			debug_printf(2, "Index\tTimestamp\t\tDelay\n");
+
+			for (history_address = ws.current_pos, i = (HISTORY_MAX - 1), j = 0;
+				(j < items_read);
+				history_address -= HISTORY_CHUNK_SIZE, i--, j++)
+			{
+				// The buffer is full so it acts as a circular buffer, so we need to
+				// wrap to the end to get the next item.
+				if (history_address < HISTORY_START)
+				{
+					history_address = HISTORY_END - (HISTORY_START - history_address);
+				}
+
+				// Calculate the index we're at in the history, from 0-4080.
+				if (ws.data_count < HISTORY_MAX)
+				{
+					history_index = 1 + (history_address - HISTORY_START) / HISTORY_CHUNK_SIZE; // Normal.
+				}
+				else
+				{
+					history_index = 1 + ((history_address - HISTORY_START) + (HISTORY_END - history_begin)) / HISTORY_CHUNK_SIZE; // Circular buffer.
+				}
+
+				item = get_history_item(history, i);
+				item->history_index = history_index;
+
+				// Calculate timestamp.
+				item->timestamp = (time_t)(station_date - total_seconds);
+				seconds = item_delay(item) * 60;
+				total_seconds += seconds;
+
+				// Debug print.	
+				debug_printf(2, "DEBUG: Seconds before current event = %d\n", total_seconds);
+				debug_printf(2, "DEBUG: Temp = %2.1fC\n", item_in_temp(item) * 0.1f);
+				debug_printf(2, "DEBUG: %d,\t%s,\t%u minutes\n",
+					i,
+					format_timestamp(item->timestamp, timestamp, sizeof(timestamp)),
+					item_delay(item));
+		
+			}
+
+			debug_printf(1, "End reading history blocks\n\n");
+		}
+
+		// Items closer together than the read period, like after the station
+		// has been reset, leave the lookback short of 24 hours. Then read on
+		// from where it got to, the items read so far come from the cache.
+		if ((items_read == items_to_read) || (items_read >= min((unsigned int)ws.data_count, HISTORY_MAX)))
+		{
+			break;
+		}
+
+		short_seconds = get_history_item(history, HISTORY_MAX - items_read)->timestamp
+						- (get_history_item(history, HISTORY_MAX - items_to_read)->timestamp - 24 * 60 * 60);
+
+		if (short_seconds <= 0)
+		{
+			break;
+		}
+
+		items_read = min(items_read + (unsigned int)short_seconds / (max(ws.read_period, 1) * 60) + 1,
+						min((unsigned int)ws.data_count, HISTORY_MAX));
+		room = items_read;
+		free(history->items);
+	}
+
+	*ws_out = ws;
+	history->read_time = time(NULL);
+	metrics_phase(dev, PHASE_HISTORY, start);
+
+	return HISTORY_MAX - items_to_read;
+}
+
+void free_history(weather_history_t *history)
+{
+	free(history->items);
+	free(history->elapsed);
+	free(history->rain_wraps);
+	history->items = NULL;
+	history->elapsed = NULL;
+	history->rain_wraps = NULL;
+}
+
+//
+// Outputs the weather data read, as text in the formats asked for.
+//
+static void print_weather_data(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int first, unsigned int end)
+{
+	if (program_settings.show_status)
+	{
+		print_status(ws);
+	}
+
+	if (program_settings.show_alarms)
+	{
+		print_alarms(ws);
+	}
+
+	if (program_settings.show_settings)
+	{
+		print_settings(ws);
+	}
+
+	if (program_settings.show_maxmin)
+	{
+		print_maxmin(ws);
+	}
+
+	if (program_settings.show_summary)
+	{
+		debug_printf(1, "Show summary:\n");
+		print_summary(ws, get_history_item(history, HISTORY_MAX - 1));
+	}
+
+	if (program_settings.show_formatted)
+	{
+		writer_t w;
+
+		debug_printf(1, "Show formatted:\n");
+		writer_init(&w, stdout);
+		print_history_parallel(&w, formatted_output, dev, ws, history, first, end, &program_settings.format);
+		writer_free(&w);
+	}
+	// Prints output in the Easyweather.dat format.
+	else if (program_settings.show_easyweather)
+	{
+		writer_t w;
+
+		// Output chronologically.
+		writer_init(&w, stdout);
+		print_history_parallel(&w, easyweather_output, dev, ws, history, first, end, NULL);
+		writer_free(&w);
+	}
+}
+
+//
+// Outputs the weather data read as JSON Lines, see json.c. This replaces
+// the text outputs, so the output can be parsed line by line.
+//
+static void print_weather_data_json(wsp_device_t *dev, weather_settings_t *ws, weather_history_t *history, unsigned int first, unsigned int end)
+{
+	writer_t w;
+
+	writer_init(&w, stdout);
+
+	if (program_settings.show_status)
+	{
+		print_json_status(&w, dev, ws);
+	}
+
+	if (program_settings.show_alarms)
+	{
+		print_json_alarms(&w, dev, ws);
+	}
+
+	if (program_settings.show_settings)
+	{
+		print_json_settings(&w, dev, ws);
+	}
+
+	if (program_settings.show_maxmin)
+	{
+		print_json_maxmin(&w, dev, ws);
+	}
+
+	print_history_parallel(&w, json_output, dev, ws, history, first, end, NULL);
+	writer_free(&w);
+}
+
+//
+// Reads the settings block and history from the weather station and outputs it.
+// If a valid cursor is given, only the history items finished since the
+// last poll are read, and the cursor is updated.
+//
+int get_weather_data(wsp_device_t *dev, history_cursor_t *cursor)
+{
+	weather_history_t history;
+	weather_settings_t ws;
+	unsigned int items_to_read;
+	unsigned int end = HISTORY_MAX;
+	unsigned long start;
+	int first;
+	int ret = 0;
+
+	metrics_count(dev, METRIC_POLLS, 1);
+
+	if ((first = read_weather_data(dev, cursor, &ws, &history)) < 0)
+	{
+		free_history(&history);
+		metrics_count(dev, METRIC_POLL_FAILURES, 1);
+		write_poll_metrics();
+		return -1;
+	}
+
+	items_to_read = HISTORY_MAX - first;
+
+	// The item at the current position is still being written to, so when
+	// keeping track of the position we only output finished items, so each
+	// item is output once.
+	if (cursor)
+	{
+		end = HISTORY_MAX - 1;
+	}
+
+	// Several stations can be polled at once, keep the output of each together.
+	start = get_milliseconds();
+	lock_output(dev);
+
+	if (program_settings.json)
+	{
+		print_weather_data_json(dev, &ws, &history, first, end);
+	}
+	else
+	{
+		print_weather_data(dev, &ws, &history, first, end);
+	}
+
+	unlock_output();
+
+	if (program_settings.export_columnar
+	&& export_columnar(program_settings.exportfile, &history, first, end))
+	{
+		ret = -1;
+	}
+
+	metrics_phase(dev, PHASE_OUTPUT, start);
+	metrics_update(dev, get_history_item(&history, HISTORY_MAX - 1));
+
+	if (cursor)
+	{
+		// Remember the last finished item, so we can tell if the memory
+		// has been changed under our feet until the next poll.
+		if (items_to_read >= 2)
+		{
+			cursor->has_last_hash = 1;
+			cursor->last_hash = hash_bytes(get_history_item(&history, HISTORY_MAX - 2)->raw_data, HISTORY_CHUNK_SIZE);
+		}
+		else if (cursor->current_pos != ws.current_pos)
+		{
+			cursor->has_last_hash = 0;
+		}
+
+		cursor->valid = 1;
+		cursor->current_pos = ws.current_pos;
+		cursor->data_count = ws.data_count;
+		memcpy(cursor->datetime, ws.datetime, sizeof(cursor->datetime));
+	}
+
+	if (program_settings.http)
+	{
+		update_http_cache(dev, &ws, &history, first, end);
+	}
+
+	#ifdef WSP_PUBLISH
+	if (program_settings.publish)
+	{
+		publish_weather_data(dev, &ws, &history, first, end);
+	}
+	#endif // WSP_PUBLISH
+
+	// The outputs take over the history.
+	publish_to_sinks(dev, &ws, &history, first, end);
+
+	memcache_print_stats(dev->cache, 1);
+	free_history(&history);
+	write_poll_metrics();
+
+	return ret;
+}
+
+//
+// Gets the path of the state file for a station. When polling several
+// stations each one gets its own, named after the label.
+//
+static void get_state_path(wsp_device_t *dev, char *path, unsigned int len)
+{
+	unsigned int prefix_len = strlen(program_settings.statefile) + 1;
+	char *c;
+
+	if (device_count <= 1)
+	{
+		snprintf(path, len, "%s", program_settings.statefile);
+		return;
+	}
+
+	snprintf(path, len, "%s.%s", program_settings.statefile, dev->label);
+
+	// Paths such as 001:004 can't be part of a file name everywhere.
+	for (c = &path[min(prefix_len, strlen(path))]; *c; c++)
+	{
+		if (!isalnum((unsigned char)*c) && (*c != '-') && (*c != '_'))
+		{
+			*c = '_';
+		}
+	}
+}
+
+//
+// Keeps the device open and polls it every interval, only reading the
+// history items written since the previous poll.
+//
+void poll_weather_data(wsp_device_t *dev)
+{
+	history_cursor_t cursor;
+	char statefile[sizeof(program_settings.statefile) + STATION_PATH_LEN];
+
+	memset(&cursor, 0, sizeof(cursor));
+	get_state_path(dev, statefile, sizeof(statefile));
+
+	if (program_settings.use_state)
+	{
+		read_state_file(statefile, &cursor);
+	}
+
+	while (!stop_polling)
+	{
+		unsigned int seconds;
+
+		debug_printf(1, "Polling weather station\n");
+
+		if (get_weather_data(dev, &cursor))
+		{
+			fprintf(stderr, "Failed to poll the weather station, retrying in %u seconds.\n", program_settings.interval);
+		}
+		else if (program_settings.use_state)
+		{
+			write_state_file(statefile, &cursor);
+		}
+
+		// Sleep a second at a time, so we can stop when asked to.
+		for (seconds = 0; (seconds < program_settings.interval) && !stop_polling; seconds++)
+		{
+			sleep_seconds(1);
+		}
+	}
+}
+
+//
+// Gets the weather data once. With --state only the history written
+// since the last run is read.
+//
+int sync_weather_data(wsp_device_t *dev)
+{
+	history_cursor_t cursor;
+	char statefile[sizeof(program_settings.statefile) + STATION_PATH_LEN];
+
+	if (!program_settings.use_state)
+	{
+		return get_weather_data(dev, NULL);
+	}
+
+	get_state_path(dev, statefile, sizeof(statefile));
+
+	memset(&cursor, 0, sizeof(cursor));
+	read_state_file(statefile, &cursor);
+
+	if (get_weather_data(dev, &cursor))
+	{
+		return -1;
+	}
+
+	return write_state_file(statefile, &cursor);
+}
+
+//
+// Resets the weather station memory.
+//
+void reset_memory(wsp_device_t *dev)
+{
+	// TODO: Use the 32 byte write instead here.
+	// Set data count to zero.
+	write_weather_1(dev, 27, 0x0);
+	write_weather_1(dev, 28, 0x0);
+	
+	// Reset the address to 256 (0x100). 
+	write_weather_1(dev, 30, 0x00);
+	write_weather_1(dev, 31, 0x1);
+
+	// Finally tell the station the data has been updated.
+	write_weather_1(dev, 26, 0xAA);
+}
+
+//
+// Sets weather display settings.
+//
+void set_weather_data(wsp_device_t *dev)
+{
+	if (program_settings.set_timezone)
+	{
+		if (!set_timezone(dev, program_settings.timezone))
+		{
+			printf("Timezone set to CET%s%d\n", ((program_settings.timezone >= 0) ? "+" : "-"), program_settings.timezone);
+		}
+		else
+		{
+			fprintf(stderr, "Failed to update timezone.\n");
+		}
+	}
+
+	if (program_settings.set_delay)
+	{
+		if (!set_delay(dev, program_settings.delay))
+		{
+			printf("Updating delay set to %u minutes.\n", program_settings.delay);
+			printf("!!! NOTICE that using --quickrain now will produce inaccurate !!!\n");
+			printf("!!! rain data unless you reset the station memory, due to the !!!\n");
+			printf("!!! fact that it assumes the delay between each weather       !!!\n");
+			printf("!!! reading is the same throughout the entire history.        !!!\n");
+		}
+		else
+		{
+			fprintf(stderr, "Failed to update delay.\n");
+		}
+	}
+	
+	if (program_settings.writebyte)
+	{
+		fprintf(stderr, "About to write %d (0x%x) to address %d (0x%x)\n", 
+			program_settings.byte, program_settings.byte,
+			 program_settings.addr, program_settings.addr); 
+		
+		fprintf(stderr, "Are you sure you want to write to the weather station memory? (Y/N): ");
+		
+		if (prompt_user() != 'Y')
+		{
+			return;
+		}
+		
+		if (write_weather_1(dev, program_settings.addr, program_settings.byte))
+		{
+			fprintf(stderr, "Failed to write to the weather station\n");
+			return;
+		}
+		
+		printf("Wrote to the weather station successfully\n");
+	}
+}
+
+static void write_dump_block(unsigned short addr, const char buf[32], int status, void *arg)
+{
+	char zeros[32];
+
+	// The block is still written so the rest stay at their addresses.
+	if (status)
+	{
+		fprintf(stderr, "Failed to read address %d (0x%x)\n", addr, addr);
+		memset(zeros, 0, sizeof(zeros));
+		buf = zeros;
+	}
+
+	fwrite(buf, 1, 32, (FILE *)arg);
+}
+
+int dump_memory(wsp_device_t *dev)
+{
+	FILE *f; 
+	int failed;
+	
+	if (file_exists(program_settings.dumpfile))
+	{
+		fprintf(stderr, "The file \"%s\" already exists. Overwrite? (Y/N): ", program_settings.dumpfile);
+		
+		if (prompt_user() != 'Y')
+		{
+			return -1;
+		}
+	}
+	
+	if (!(f = fopen(program_settings.dumpfile, "w")))
+	{
+		fprintf(stderr, "Failed to open \"%s\"", program_settings.dumpfile);
+		return -1;
+	}
+	else
+	{
+		// Dump the memory to file, up to the end of the history.
+		unsigned short addrs[HISTORY_END / 32];
+		unsigned int count = 0;
+		unsigned int offset;
+
+		for (offset = 0; offset < HISTORY_END; offset += 32)
+		{
+			addrs[count++] = offset;
+		}
+
+		failed = read_weather_addresses(dev, addrs, count, write_dump_block, f);
+	}
+	
+	if (ferror(f))
+	{
+		fprintf(stderr, "Failed to write to \"%s\"\n", program_settings.dumpfile);
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+
+	if (failed)
+	{
+		fprintf(stderr, "Failed to read %d blocks of the weather station memory\n", failed);
+		return -1;
+	}
+	
+	return 0;
+}
+
+//
+// Prints the path of a station found.
+//
+static void print_station(const char *path, void *arg)
+{
+	printf("%s\n", path);
+}
+
+//
+// Opens a station given as [label=]path.
+//
+static int open_station(const char *station)
+{
+	char label[STATION_ARG_LEN];
+	const char *path = station;
+	const char *equals;
+
+	label[0] = '\0';
+
+	if ((equals = strchr(station, '=')))
+	{
+		snprintf(label, sizeof(label), "%.*s", (int)(equals - station), station);
+		path = equals + 1;
+	}
+
+	if (!(devices[device_count] = open_transport(path, label)))
+	{
+		fprintf(stderr, "Failed to open the station \"%s\".\n", station);
+		return -1;
+	}
+
+	device_count++;
+
+	return 0;
+}
+
+//
+// Opens a station found with --all-stations, using a label given with
+// --station for the same path.
+//
+static void open_found_station(const char *path, void *arg)
+{
+	int *failed = (int *)arg;
+	char station[STATION_ARG_LEN];
+	unsigned int i;
+
+	if (device_count >= MAX_STATIONS)
+	{
+		fprintf(stderr, "Too many stations, at most %d can be polled.\n", MAX_STATIONS);
+		return;
+	}
+
+	snprintf(station, sizeof(station), "%s", path);
+
+	for (i = 0; i < program_settings.station_count; i++)
+	{
+		const char *equals = strchr(program_settings.stations[i], '=');
+
+		if (equals && !strcmp(equals + 1, path))
+		{
+			snprintf(station, sizeof(station), "%s", program_settings.stations[i]);
+		}
+	}
+
+	if (open_station(station))
+	{
+		*failed = 1;
+	}
+}
+
+//
+// Opens the stations given by the program settings. If none are given
+// the first station found is opened.
+//
+int open_stations()
+{
+	int failed = 0;
+	unsigned int i;
+
+	if (program_settings.all_stations)
+	{
+		failed = enumerate_stations(open_found_station, &failed);
+
+		if (!failed && (device_count == 0))
+		{
+			fprintf(stderr, "No stations were found.\n");
+			failed = 1;
+		}
+	}
+	else if (program_settings.station_count > 0)
+	{
+		for (i = 0; (i < program_settings.station_count) && !failed; i++)
+		{
+			failed = open_station(program_settings.stations[i]);
+		}
+	}
+	else
+	{
+		if ((devices[0] = open_transport(NULL, NULL)))
+		{
+			device_count = 1;
+		}
+		else
+		{
+			failed = 1;
+		}
+	}
+
+	if (failed)
+	{
+		for (i = 0; i < device_count; i++)
+		{
+			close_transport(devices[i]);
+		}
+
+		device_count = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+//
+// Gets the weather data from a station, once or continuously in daemon mode.
+//
+static void poll_station(void *arg)
+{
+	wsp_device_t *dev = (wsp_device_t *)arg;
+
+	if (program_settings.daemon)
+	{
+		poll_weather_data(dev);
+	}
+	else
+	{
+		sync_weather_data(dev);
+	}
+}
+
+//
+// Polls all the open stations, each one in its own thread.
+//
+void poll_stations()
+{
+	wsp_thread_t threads[MAX_STATIONS];
+	int started[MAX_STATIONS];
+	unsigned int i;
+
+	if (device_count == 1)
+	{
+		poll_station(devices[0]);
+		return;
+	}
+
+	for (i = 0; i < device_count; i++)
+	{
+		started[i] = !thread_create(&threads[i], poll_station, devices[i]);
+	}
+
+	for (i = 0; i < device_count; i++)
+	{
+		if (started[i])
+		{
+			thread_join(threads[i]);
+		}
+	}
+}
+
+int read_arguments(int argc, char **argv)
+{
+	int c;
+	memset(&program_settings, 0, sizeof(program_settings));
+
+	// Set defaults.
+	program_settings.count = 1;
+	program_settings.mode = get_mode;
+	program_settings.product_id = PRODUCT_ID;
+	program_settings.vendor_id = VENDOR_ID;
+	program_settings.interval = DEFAULT_POLL_INTERVAL;
+	program_settings.sim_speed = 1.0f;
+	program_settings.threads = DEFAULT_BATCH_THREADS;
+	program_settings.publish_buffer = DEFAULT_PUBLISH_BUFFER;
+	#ifdef WSP_LIBUSB1
+	program_settings.queue_depth = USBASYNC_DEFAULT_QUEUE;
+	#endif // WSP_LIBUSB1
+
+	while (1)
+	{
+		static struct option long_options[] =
+		{
+			{"all", no_argument,			0, 'a'},
+			{"status", no_argument,			&program_settings.show_status, 1},
+			{"alarms", no_argument,			&program_settings.show_alarms, 1},
+			{"settings", no_argument,		&program_settings.show_settings, 1},
+			{"maxmin", no_argument,			&program_settings.show_maxmin, 1},
+			{"settings", no_argument,		&program_settings.show_settings, 1},
+			{"easyweather", no_argument,	&program_settings.show_easyweather, 1},
+			{"summary", no_argument,		&program_settings.show_summary, 1},
+			{"quickrain", no_argument,		&program_settings.quickrain, 1},
+			{"count", required_argument,		0, 'c'},
+			{"timezone", required_argument, 	0, 't'},
+			{"delay", required_argument, 		0, 'd'},
+			{"help", required_argument,			0, 'h'},
+			{"format", required_argument,		0, 0},
+			{"epoch", no_argument,			&program_settings.epoch, 1},
+			{"json", no_argument,			&program_settings.json, 1},
+			{"export-columnar", required_argument,	0, 0},
+			{"output", required_argument,		0, 0},
+			{"formatlist", no_argument,			0, 0},
+			{"altitude", required_argument,		0, 'A'},
+			{"productid", required_argument,	0, 0},
+			{"vendorid", required_argument,		0, 0},
+			{"dumpmem", required_argument,		0, 0},
+			{"infile", required_argument,		0, 0},
+			{"reset", no_argument,				0, 0},
+			{"writebyte", required_argument,	0, 0},
+			{"address", required_argument,		0, 0},
+			{"daemon", no_argument,				&program_settings.daemon, 1},
+			{"interval", required_argument,		0, 0},
+			{"http", required_argument,			0, 0},
+			{"metrics-file", required_argument,	0, 0},
+			#ifndef WIN32
+			{"broker", required_argument,		0, 0},
+			{"connect", required_argument,		0, 0},
+			#endif // WIN32
+			#ifdef WSP_PUBLISH
+			{"publish", required_argument,		0, 0},
+			{"publish-policy", required_argument,	0, 0},
+			{"publish-buffer", required_argument,	0, 0},
+			#endif // WSP_PUBLISH
+			{"state", required_argument,		0, 0},
+			{"simulate", required_argument,		0, 0},
+			{"sim-latency", required_argument,	0, 0},
+			{"sim-jitter", required_argument,	0, 0},
+			{"sim-failrate", required_argument,	0, 0},
+			{"sim-speed", required_argument,	0, 0},
+			{"station", required_argument,		0, 0},
+			{"all-stations", no_argument,		&program_settings.all_stations, 1},
+			{"list-stations", no_argument,		&program_settings.list_stations, 1},
+			{"batch", required_argument,		0, 0},
+			{"threads", required_argument,		0, 0},
+			#ifdef WSP_LIBUSB1
+			{"async", no_argument,				&program_settings.async, 1},
+			{"queue", required_argument,		0, 0},
+			#endif // WSP_LIBUSB1
+			{0, 0, 0, 0}
+		};
+
+		int option_index = 0;
+		c = getopt_long(argc, argv, "aesvmc:ht:d:A:", long_options, &option_index);
+
+		if (c == -1)
+		{
+			break;
+		}
+
+		switch (c)
+		{
+			case 0:
+			{
+				if (!strcmp("reset", long_options[option_index].name))
+				{
+					program_settings.reset = 1;
+				}
+				else if (!strcmp("address", long_options[option_index].name))
+				{
+					program_settings.address_is_set = 1;
+					sscanf(optarg, "%x", (unsigned int *)&program_settings.addr);
+				}
+				else if (!strcmp("writebyte", long_options[option_index].name))
+				{
+					program_settings.writebyte = 1;
+					program_settings.mode = set_mode;
+					sscanf(optarg, "%x", (unsigned int *)&program_settings.byte);
+					program_settings.byte &= 0xff;
+				}
+				else if (!strcmp("infile", long_options[option_index].name))
+				{
+					program_settings.from_file = 1;
+					strcpy(program_settings.infile, optarg);
+				}
+				else if (!strcmp("dumpmem", long_options[option_index].name))
+				{
+					program_settings.mode = dump_mode;
+					strcpy(program_settings.dumpfile, optarg);
+				}
+				else if (!strcmp("format", long_options[option_index].name))
+				{
+					program_settings.show_formatted = 1;
+					strcpy(program_settings.format_str, optarg);
+				}
+				else if (!strcmp("formatlist", long_options[option_index].name))
+				{
+					program_settings.show_formatlist = 1;
+				}
+				else if (!strcmp("productid", long_options[option_index].name))
+				{
+					sscanf(optarg, "%x", &program_settings.product_id);
+				}
+				else if (!strcmp("vendorid", long_options[option_index].name))
+				{
+					sscanf(optarg, "%x", &program_settings.vendor_id);
+				}
+				else if (!strcmp("interval", long_options[option_index].name))
+				{
+					program_settings.interval = atoi(optarg);
+				}
+				else if (!strcmp("http", long_options[option_index].name))
+				{
+					program_settings.http = 1;
+					program_settings.daemon = 1;
+					snprintf(program_settings.http_address, sizeof(program_settings.http_address), "%s", optarg);
+				}
+				else if (!strcmp("metrics-file", long_options[option_index].name))
+				{
+					program_settings.metrics_file = 1;
+					snprintf(program_settings.metricsfile, sizeof(program_settings.metricsfile), "%s", optarg);
+				}
+				else if (!strcmp("broker", long_options[option_index].name))
+				{
+					// Stops on SIGTERM like the daemon.
+					program_settings.broker = 1;
+					program_settings.daemon = 1;
+					snprintf(program_settings.brokerpath, sizeof(program_settings.brokerpath), "%s", optarg);
+				}
+				else if (!strcmp("connect", long_options[option_index].name))
+				{
+					program_settings.connect = 1;
+					snprintf(program_settings.brokerpath, sizeof(program_settings.brokerpath), "%s", optarg);
+				}
+				else if (!strcmp("publish", long_options[option_index].name))
+				{
+					program_settings.publish = 1;
+					program_settings.daemon = 1;
+					snprintf(program_settings.publishpath, sizeof(program_settings.publishpath), "%s", optarg);
+				}
+				else if (!strcmp("publish-policy", long_options[option_index].name))
+				{
+					if (!strcmp(optarg, "drop"))
+					{
+						program_settings.publish_policy = publish_drop;
+					}
+					else if (!strcmp(optarg, "disconnect"))
+					{
+						program_settings.publish_policy = publish_disconnect;
+					}
+					else if (!strcmp(optarg, "block"))
+					{
+						program_settings.publish_policy = publish_block;
+					}
+					else
+					{
+						fprintf(stderr, "Unknown publish policy \"%s\", use drop, disconnect or block.\n", optarg);
+						return -1;
+					}
+				}
+				else if (!strcmp("publish-buffer", long_options[option_index].name))
+				{
+					program_settings.publish_buffer = max(atoi(optarg), MIN_PUBLISH_BUFFER);
+				}
+				else if (!strcmp("state", long_options[option_index].name))
+				{
+					program_settings.use_state = 1;
+					snprintf(program_settings.statefile, sizeof(program_settings.statefile), "%s", optarg);
+				}
+				else if (!strcmp("queue", long_options[option_index].name))
+				{
+					program_settings.queue_depth = atoi(optarg);
+				}
+				else if (!strcmp("simulate", long_options[option_index].name))
+				{
+					program_settings.simulate = 1;
+					snprintf(program_settings.simfile, sizeof(program_settings.simfile), "%s", optarg);
+				}
+				else if (!strcmp("sim-latency", long_options[option_index].name))
+				{
+					program_settings.sim_latency = atoi(optarg);
+				}
+				else if (!strcmp("sim-jitter", long_options[option_index].name))
+				{
+					program_settings.sim_jitter = atoi(optarg);
+				}
+				else if (!strcmp("sim-failrate", long_options[option_index].name))
+				{
+					program_settings.sim_failrate = (float)atof(optarg);
+				}
+				else if (!strcmp("sim-speed", long_options[option_index].name))
+				{
+					program_settings.sim_speed = (float)atof(optarg);
+				}
+				else if (!strcmp("station", long_options[option_index].name))
+				{
+					if (program_settings.station_count >= MAX_STATIONS)
+					{
+						fprintf(stderr, "Too many stations, at most %d can be polled.\n", MAX_STATIONS);
+						return -1;
+					}
+
+					snprintf(program_settings.stations[program_settings.station_count++], STATION_ARG_LEN, "%s", optarg);
+				}
+				else if (!strcmp("batch", long_options[option_index].name))
+				{
+					program_settings.batch = 1;
+					program_settings.from_file = 1;
+					snprintf(program_settings.batchpath, sizeof(program_settings.batchpath), "%s", optarg);
+				}
+				else if (!strcmp("threads", long_options[option_index].name))
+				{
+					program_settings.threads = atoi(optarg);
+				}
+				else if (!strcmp("export-columnar", long_options[option_index].name))
+				{
+					program_settings.export_columnar = 1;
+					snprintf(program_settings.exportfile, sizeof(program_settings.exportfile), "%s", optarg);
+				}
+				else if (!strcmp("output", long_options[option_index].name))
+				{
+					if (program_settings.output_count >= MAX_OUTPUTS)
+					{
+						fprintf(stderr, "Too many outputs, at most %d can be given.\n", MAX_OUTPUTS);
+						return -1;
+					}
+
+					snprintf(program_settings.outputs[program_settings.output_count++], OUTPUT_ARG_LEN, "%s", optarg);
+				}
+
+				break;
+			}
+			case 'a': program_settings.count = 0;				break;
+			case 'v': program_settings.debug++;					break;
+			case 'm': program_settings.show_maxmin = 1;			break;
+			case 's': program_settings.show_status = 1;			break;
+			case 'e': program_settings.show_easyweather = 1;	break;
+			case 'A': program_settings.altitude = atoi(optarg); break;
+			case 'd':
+			{
+				program_settings.mode = set_mode;
+				program_settings.set_delay = 1;
+				program_settings.delay = atoi(optarg);
+				break;
+			}
+			case 't':
+			{
+				program_settings.mode = set_mode;
+				program_settings.set_timezone = 1;
+				program_settings.timezone = atoi(optarg);
+				break;
+			}
+			case 'h':
+			{
+				show_usage(argv[0]);
+				exit(0);
+			}
+			case 'c':
+			{
+				// The number of history events to fetch.
+				program_settings.count = atoi(optarg);
+				break;
+			}
+			default:
+			{
+				show_usage(argv[0]);
+				abort();
+				break;
+			}
+		}
+	}
+
+	// A batch of dump files is only output as history, or exported.
+	if (program_settings.batch && !program_settings.show_formatted && !program_settings.json
+	&& !program_settings.export_columnar)
+	{
+		program_settings.show_easyweather = 1;
+	}
+
+	// Catch an incorrect format string before anything is read.
+	if (program_settings.show_formatted
+	&& compile_format(&program_settings.format, program_settings.format_str))
+	{
+		return -1;
+	}
+
+	// The export is written again on each poll, and by each station.
+	if (program_settings.export_columnar
+	&& (program_settings.daemon
+		|| program_settings.all_stations || (program_settings.station_count > 1)))
+	{
+		fprintf(stderr, "--export-columnar can only be used with a single station, and without --daemon.\n");
+		return -1;
+	}
+
+	if (program_settings.output_count && program_settings.batch)
+	{
+		fprintf(stderr, "--output can't be used with --batch.\n");
+		return -1;
+	}
+
+	// The server keeps the data of one station.
+	if (program_settings.http
+	&& (program_settings.batch || program_settings.all_stations || (program_settings.station_count > 1)))
+	{
+		fprintf(stderr, "--http can only be used with a single station, and without --batch.\n");
+		return -1;
+	}
+
+	if (program_settings.broker
+	&& (program_settings.connect || program_settings.batch || program_settings.http
+		|| program_settings.all_stations || (program_settings.station_count > 1)))
+	{
+		fprintf(stderr, "--broker can only be used with a single station, and without --connect, --http or --batch.\n");
+		return -1;
+	}
+
+	// The current item sent to subscribers is kept for one station.
+	if (program_settings.publish
+	&& (program_settings.batch || program_settings.broker
+		|| program_settings.all_stations || (program_settings.station_count > 1)))
+	{
+		fprintf(stderr, "--publish can only be used with a single station, and without --broker or --batch.\n");
+		return -1;
+	}
+
+	// Set show summary as default if nothing else has been set to show.
+	if (!program_settings.show_status
+	&& !program_settings.show_maxmin
+	&& !program_settings.show_easyweather
+	&& !program_settings.show_formatlist
+	&& !program_settings.show_formatted
+	&& !program_settings.json
+	&& !program_settings.export_columnar
+	&& !program_settings.output_count
+	&& !program_settings.http
+	&& !program_settings.broker
+	&& !program_settings.publish)
+	{
+		program_settings.show_summary = 1;
+	}
+
+	// Turn off quickrain if we're getting all items,
+	// then we can be accurate without spending more time :)
+	if (program_settings.count == 0)
+	{
+		program_settings.quickrain = 0;
+	}
+
+	// Quick rain reads from the station, which the outputs and the
+	// HTTP server can't do from their threads, and a batch of dumps can't
+	// do once they're merged.
+	if (program_settings.output_count || program_settings.http || program_settings.batch)
+	{
+		program_settings.quickrain = 0;
+	}
+
+	debug = program_settings.debug;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+
+	if (read_arguments(argc, argv))
+	{
+		printf("Error reading arguments\n");
+		return 1;
+	}
+
+	if (program_settings.show_formatlist)
+	{
+		printf("%%h - Inside humidity (%%).\n");
+		printf("%%H - Outside humidity (%%).\n");
+		printf("%%t - Inside temperature (Celcius).\n");
+		printf("%%T - Outside temperature (Celcius).\n");
+		printf("%%C - Outside dew point temperature (Celcius).\n");
+		printf("%%c - Outside Wind chill temperature (Celcius).\n");
+		printf("%%W - Wind speed (m/s).\n");
+		printf("%%G - Gust speed (m/s).\n");
+		printf("%%D - Name of wind direction.\n");
+		printf("%%d - Wind direction in degrees.\n");
+		printf("%%P - Absolute pressure (hPa).\n");
+		printf("%%p - Relative pressure (hPa).\n");
+		printf("!!! To correctly calculate rain info you need to read  !!!\n");
+		printf("!!! at least 24h of events or use --quickrain          !!!\n");
+		printf("%%r - Rain 1h (mm/h).\n");
+		printf("%%f - Rain 24h (mm/h).\n");
+		printf("%%F - Rain 24h (mm).\n");
+		printf("%%R - Total rain (mm).\n");
+		printf("%%N - Date/time string for the weather reading, or seconds since\n");
+		printf("     the epoch with --epoch.\n");
+		printf("%%e - Do we have contact with the sensor for this reading? (True/False).\n");
+		printf("%%E - Do we have contact with the sensor for this reading? (1/0).\n");
+		printf("%%b - Original bytes in hex format containing the data.\n");
+		printf("%%a - Address in history.\n");
+		printf("%%L - Label of the station, or its path.\n");
+		printf("%%%% - %% sign\n");
+		printf("\\n - Newline.\n");
+		printf("\\t - Tab.\n");
+		printf("\\r - Carriage return.\n");
+
+		return 0;
+	}
+
+	if (program_settings.from_file && !program_settings.simulate && (program_settings.mode != get_mode))
+	{
+		fprintf(stderr, "You cannot set any settings or dump the memory while using a dump file as input.\n");
+		return -1;
+	}
+
+	if (program_settings.batch)
+	{
+		return read_batch(program_settings.batchpath);
+	}
+
+	if (program_settings.list_stations)
+	{
+		return enumerate_stations(print_station, NULL);
+	}
+
+	// Open te devices.
+	mutex_init(&output_mutex);
+
+	if (open_sinks())
+	{
+		return -1;
+	}
+
+	if (open_stations())
+	{
+		close_sinks();
+		return -1;
+	}
+
+	signal(SIGTERM, sigterm_handler);
+
+	if ((device_count > 1) && (program_settings.reset || (program_settings.mode != get_mode)))
+	{
+		fprintf(stderr, "Settings can only be changed and the memory dumped for one station at a time.\n");
+		goto cleanup;
+	}
+	
+	if (program_settings.reset)
+	{
+		fprintf(stderr, "Are you sure you want to reset the weather station memory? (Y/N): ");
+		
+		if (prompt_user() != 'Y')
+		{
+			close_transport(devices[0]);
+			return -1;
+		}
+		
+		reset_memory(devices[0]);
+		printf("Memory reset\n");
+		
+		goto cleanup;
+	}
+	
+	switch (program_settings.mode)
+	{
+		default:
+		case get_mode:
+		{
+			if (program_settings.daemon)
+			{
+				signal(SIGINT, sigterm_handler);
+			}
+
+			#ifndef WIN32
+			if (program_settings.broker)
+			{
+				run_broker(devices[0], program_settings.brokerpath);
+				break;
+			}
+			#endif // WIN32
+
+			if (program_settings.http && start_http_server(devices[0]))
+			{
+				goto cleanup;
+			}
+
+			#ifdef WSP_PUBLISH
+			if (program_settings.publish && start_publisher(devices[0], program_settings.publishpath))
+			{
+				stop_http_server();
+				goto cleanup;
+			}
+			#endif // WSP_PUBLISH
+
+			poll_stations();
+			stop_http_server();
+			#ifdef WSP_PUBLISH
+			stop_publisher();
+			#endif // WSP_PUBLISH
+			break;
+		}
+		case set_mode:
+		{
+			set_weather_data(devices[0]);
+			break;
+		}
+		case dump_mode:
+		{
+			if (dump_memory(devices[0]))
+			{
+				fprintf(stderr, "Failed to dump memory.\n");
+			}
+			break;
+		}
+	}
+	
+cleanup:
+	// The outputs might still be writing history read from the stations.
+	close_sinks();
+
+	for (i = 0; i < device_count; i++)
+	{
+		close_transport(devices[i]);
+	}
+
+	mutex_destroy(&output_mutex);
+	free_format(&program_settings.format);
+
+	return 0;
+}
+
@@ -1,150 +1,319 @@
-//
-// Weather Station Poller
-//
-// Copyright (C) 2010 Joakim Sderberg
-//
-// This program is free software: you can redistribute it and/or modify
-// it under the terms of the GNU General Public License as published by
-// the Free Software Foundation, either version 3 of the License, or
-// (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-// GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program.  If not, see <http://www.gnu.org/licenses/>.
-//
-
-#include <stdio.h>
-#include <assert.h>
-#include "wsp.h"
-#include "wspusb.h"
-
-//
-// Finds the device based on vendor and product id.
-//
-struct usb_device *find_device(int vendor, int product)
-{
-    struct usb_bus *bus;
-	struct usb_device *dev;
-
-    for (bus = usb_get_busses(); bus; bus = bus->next)
-	{
-		for (dev = bus->devices; dev; dev = dev->next)
-		{
-			if (dev->descriptor.idVendor == vendor
-			&& dev->descriptor.idProduct == product)
-			{
-				return dev;
-			}
-		}
-    }
-    return NULL;
-}
-
-//
-// Closes the connection to the USB device.
-//
-void close_device(struct usb_dev_handle *h)
-{
-	int ret = usb_release_interface(h, 0);
-
-	if (ret != 0)
-		fprintf(stderr, "Could not release interface: %d\n", ret);
-
-	ret = usb_close(h);
-
-	if (ret != 0)
-		fprintf(stderr, "Error closing interface: %d\n", ret);
-}
-
-
-//
-// Opens the USB device.
-//
-struct usb_dev_handle *open_device()
-{
-	int ret;
-	struct usb_dev_handle *h;
-    struct usb_device *dev;
-	char buf[1024];
-
-    usb_init();
-    usb_find_busses();
-    usb_find_devices();
-
-    dev = find_device(program_settings.vendor_id, program_settings.product_id);
-
-	if (!dev)
-	{
-		fprintf(stderr, "No device with vendor id: 0x%x (%d) and product id: %x (%d) was found\n",
-			program_settings.vendor_id, program_settings.vendor_id,
-			program_settings.product_id, program_settings.product_id);
-		exit(1);
-	}
-
-    h = usb_open(dev);
-    assert(h);
-
-	#ifdef LIBUSB_HAS_GET_DRIVER_NP
-    ret = usb_get_driver_np(h, 0, buf, sizeof(buf));
-
-    if (ret == 0)
-	{
-		if ((ret = usb_detach_kernel_driver_np(h, 0)) != 0)
-		{
-			fprintf(stderr, "Could not open usb device. Failed o detached from driver \"%s\": %d\n", buf, ret);
-			exit(1);
-		}
-    }
-	#endif // LIBUSB_HAS_GET_DRIVER_NP
-
-    // TODO: Add support for using HIDAPI instead on OSX. http://www.libusb.org/ticket/89
-    ret = usb_claim_interface(h, 0);
-
-    if (ret != 0)
-	{
-		fprintf(stderr, "Could not open usb device, errorcode: %d\n", ret);
-		exit(1);
-    }
-
-    ret = usb_set_altinterface(h, 0);
-
-	if (!h || ret != 0)
-	{
-		fprintf(stderr, "Failed to open USB device, errorcode: %d\n", ret);
-		exit(1);
-	}
-
-	return h;
-}
-
-//
-// Inits the USB descriptors.
-//
-void init_device_descriptors(struct usb_dev_handle *h)
-{
-	char buf[1024];
-	int ret = 0;
-
-	ret = usb_get_descriptor(h, USB_DT_DEVICE, 0, buf, sizeof(buf));
-	ret = usb_get_descriptor(h, USB_DT_CONFIG, 0, buf, sizeof(buf));
-	ret = usb_release_interface(h, 0);
-
-	if (ret != 0)
-		fprintf(stderr, "Failed to release interface before set_configuration: %d\n", ret);
-
-	ret = usb_set_configuration(h, 1);
-	ret = usb_claim_interface(h, 0);
-
-	if (ret != 0)
-		fprintf(stderr, "Claim after set_configuration failed with error: %d\n", ret);
-
-	ret = usb_set_altinterface(h, 0);
-	ret = usb_control_msg(h, USB_TYPE_CLASS + USB_RECIP_INTERFACE, 0xa, 0, 0, NULL, 0, USB_TIMEOUT);
-	ret = usb_get_descriptor(h, USB_DT_REPORT, 0, buf, sizeof(buf));
-}
-
-
+//
+// Weather Station Poller
+//
+// Copyright (C) 2010 Joakim Söderberg
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "wsp.h"
+#include "wspusb.h"
+#include "memory.h"
+#include "utils.h"
+
+//
+// Inits libusb and finds the devices, only done once.
+//
+static void init_usb()
+{
+	static int initialized = 0;
+
+	if (initialized)
+		return;
+
+    usb_init();
+    usb_find_busses();
+    usb_find_devices();
+
+	initialized = 1;
+}
+
+//
+// Gets the path identifying a device, made up of the bus and device names.
+// Fails if it doesn't fit in len.
+//
+int get_device_path(struct usb_device *dev, char *path, unsigned int len)
+{
+	int n = snprintf(path, len, "%s:%s", dev->bus->dirname, dev->filename);
+
+	return ((n < 0) || ((unsigned int)n >= len)) ? -1 : 0;
+}
+
+//
+// Finds the device based on vendor and product id. If a path is given
+// the device must also be at that path, otherwise the first one is used.
+//
+struct usb_device *find_device(int vendor, int product, const char *path)
+{
+    struct usb_bus *bus;
+	struct usb_device *dev;
+	char dev_path[STATION_PATH_LEN];
+
+    for (bus = usb_get_busses(); bus; bus = bus->next)
+	{
+		for (dev = bus->devices; dev; dev = dev->next)
+		{
+			if (dev->descriptor.idVendor == vendor
+			&& dev->descriptor.idProduct == product)
+			{
+				if (get_device_path(dev, dev_path, sizeof(dev_path)))
+				{
+					continue;
+				}
+
+				if (!path || !*path || !strcmp(path, dev_path))
+				{
+					return dev;
+				}
+			}
+		}
+    }
+    return NULL;
+}
+
+//
+// Closes the connection to the USB device.
+//
+void close_device(struct usb_dev_handle *h)
+{
+	int ret;
+
+	ret = usb_release_interface(h, 0);
+
+	if (ret != 0)
+		fprintf(stderr, "Could not release interface: %d\n", ret);
+
+	ret = usb_close(h);
+
+	if (ret != 0)
+		fprintf(stderr, "Error closing interface: %d\n", ret);
+}
+
+
+//
+// Opens the USB device. Returns NULL on failure.
+//
+struct usb_dev_handle *open_device(struct usb_device *dev)
+{
+	int ret;
+	struct usb_dev_handle *h;
+	char buf[1024];
+
+    h = usb_open(dev);
+    assert(h);
+
+	#ifdef LIBUSB_HAS_GET_DRIVER_NP
+    ret = usb_get_driver_np(h, 0, buf, sizeof(buf));
+
+    if (ret == 0)
+	{
+		if ((ret = usb_detach_kernel_driver_np(h, 0)) != 0)
+		{
+			fprintf(stderr, "Could not open usb device. Failed o detached from driver \"%s\": %d\n", buf, ret);
+			usb_close(h);
+			return NULL;
+		}
+    }
+	#endif // LIBUSB_HAS_GET_DRIVER_NP
+
+    // TODO: Add support for using HIDAPI instead on OSX. http://www.libusb.org/ticket/89
+    ret = usb_claim_interface(h, 0);
+
+    if (ret != 0)
+	{
+		fprintf(stderr, "Could not open usb device, errorcode: %d\n", ret);
+		usb_close(h);
+		return NULL;
+    }
+
+    ret = usb_set_altinterface(h, 0);
+
+	if (!h || ret != 0)
+	{
+		fprintf(stderr, "Failed to open USB device, errorcode: %d\n", ret);
+		close_device(h);
+		return NULL;
+	}
+
+	return h;
+}
+
+//
+// Inits the USB descriptors.
+//
+void init_device_descriptors(struct usb_dev_handle *h)
+{
+	char buf[1024];
+	int ret = 0;
+
+	ret = usb_get_descriptor(h, USB_DT_DEVICE, 0, buf, sizeof(buf));
+	ret = usb_get_descriptor(h, USB_DT_CONFIG, 0, buf, sizeof(buf));
+	ret = usb_release_interface(h, 0);
+
+	if (ret != 0)
+		fprintf(stderr, "Failed to release interface before set_configuration: %d\n", ret);
+
+	ret = usb_set_configuration(h, 1);
+	ret = usb_claim_interface(h, 0);
+
+	if (ret != 0)
+		fprintf(stderr, "Claim after set_configuration failed with error: %d\n", ret);
+
+	ret = usb_set_altinterface(h, 0);
+	ret = usb_control_msg(h, USB_TYPE_CLASS + USB_RECIP_INTERFACE, 0xa, 0, 0, NULL, 0, USB_TIMEOUT);
+	ret = usb_get_descriptor(h, USB_DT_REPORT, 0, buf, sizeof(buf));
+}
+
+//
+// Sends a USB message to the device from a given buffer.
+//
+static int send_usb_msgbuf(struct usb_dev_handle *h, char *msg, int msgsize)
+{
+	int bytes_written = 0;
+
+	debug_printf(2, "--> ");
+	print_bytes(2, msg, msgsize);
+
+	bytes_written = usb_control_msg(h, USB_TYPE_CLASS + USB_RECIP_INTERFACE,
+									9, 0x200, 0, msg, msgsize, USB_TIMEOUT);
+	//assert(bytes_written == msgsize);
+	
+	return bytes_written;
+}
+
+//
+// All data from the weather station is read in 32 byte chunks.
+//
+static int read_weather_msg(struct usb_dev_handle *h, char buf[32])
+{
+	return usb_interrupt_read(h, ENDPOINT_INTERRUPT_ADDRESS, buf, 32, USB_TIMEOUT);
+}
+
+static int usb_transport_open(wsp_device_t *dev)
+{
+	struct usb_device *usbdev;
+	struct usb_dev_handle *h;
+
+	init_usb();
+
+	if (!(usbdev = find_device(program_settings.vendor_id, program_settings.product_id, dev->path)))
+	{
+		fprintf(stderr, "No device with vendor id: 0x%x (%d) and product id: %x (%d) was found%s%s\n",
+			program_settings.vendor_id, program_settings.vendor_id,
+			program_settings.product_id, program_settings.product_id,
+			(*dev->path ? " at " : ""), dev->path);
+		return -1;
+	}
+
+	if (!(h = open_device(usbdev)))
+	{
+		return -1;
+	}
+
+	if (get_device_path(usbdev, dev->path, sizeof(dev->path)))
+	{
+		fprintf(stderr, "The path of the device is too long.\n");
+		close_device(h);
+		return -1;
+	}
+
+	init_device_descriptors(h);
+	dev->data = h;
+
+	return 0;
+}
+
+static int usb_transport_enumerate(station_found_cb cb, void *arg)
+{
+    struct usb_bus *bus;
+	struct usb_device *dev;
+	char path[STATION_PATH_LEN];
+
+	init_usb();
+
+    for (bus = usb_get_busses(); bus; bus = bus->next)
+	{
+		for (dev = bus->devices; dev; dev = dev->next)
+		{
+			if (dev->descriptor.idVendor == program_settings.vendor_id
+			&& dev->descriptor.idProduct == program_settings.product_id)
+			{
+				if (!get_device_path(dev, path, sizeof(path)))
+				{
+					cb(path, arg);
+				}
+			}
+		}
+    }
+
+	return 0;
+}
+
+static void usb_transport_close(wsp_device_t *dev)
+{
+	close_device((struct usb_dev_handle *)dev->data);
+}
+
+static int usb_transport_read32(wsp_device_t *dev, unsigned short addr, char buf[32])
+{
+	struct usb_dev_handle *h = (struct usb_dev_handle *)dev->data;
+	char msg[8] = {0xa1, (addr >> 8), (addr & 0xff), 0x20, 0xa1, 0, 0, 0x20};
+
+	send_usb_msgbuf(h, msg, 8);
+	return (read_weather_msg(h, buf) != 32);
+}
+
+static int usb_transport_write1(wsp_device_t *dev, unsigned short addr, char data)
+{
+	char msg[8] = {0xa2, (addr >> 8), (addr & 0xff), 0x20, 0xa2, data, 0, 0x20};
+
+	send_usb_msgbuf((struct usb_dev_handle *)dev->data, msg, 8);
+	return 0;
+}
+
+static int usb_transport_write32(wsp_device_t *dev, unsigned short addr, char data[32])
+{
+	struct usb_dev_handle *h = (struct usb_dev_handle *)dev->data;
+	char msg[8] = {0xa0, (addr >> 8), (addr & 0xff), 0x20, 0xa0, 0, 0, 0x20};
+
+	send_usb_msgbuf(h, msg, 8);		// Send write command.
+	send_usb_msgbuf(h, data, 32);	// Send data.
+	return 0;
+}
+
+static int usb_transport_ack(wsp_device_t *dev)
+{
+	char buf[32];
+
+	read_weather_msg((struct usb_dev_handle *)dev->data, buf);
+
+	return check_weather_ack(buf);
+}
+
+const wsp_transport_t usb_transport =
+{
+	"libusb",
+	usb_transport_open,
+	usb_transport_close,
+	usb_transport_read32,
+	usb_transport_write1,
+	usb_transport_write32,
+	usb_transport_ack,
+	NULL,
+	usb_transport_enumerate,
+	NULL
+};